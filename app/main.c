@@ -2,6 +2,70 @@
 
 #include "ln.h"
 
-int main(){
+static char* read_file(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = malloc(file_size + 1);
+    if(buffer == NULL){
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(74);
+    }
+
+    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    if(bytes_read < file_size){
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        exit(74);
+    }
+
+    buffer[bytes_read] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+int main(int argc, char** argv){
+    bool stats = false;
+    bool registers = false;
+    int optimize_level = 0;
+    while(argc > 1 && argv[1][0] == '-'){
+        if(strcmp(argv[1], "--stats") == 0){
+            stats = true;
+        }else if(strcmp(argv[1], "--registers") == 0){
+            registers = true;
+        }else if(strcmp(argv[1], "-O") == 0 || strcmp(argv[1], "-O1") == 0){
+            optimize_level = 1;
+        }else if(strcmp(argv[1], "-O0") == 0){
+            optimize_level = 0;
+        }else{
+            fprintf(stderr, "Unknown option \"%s\".\n", argv[1]);
+            return 64;
+        }
+        argc--;
+        argv++;
+    }
+
+    if(argc < 2){
+        fprintf(stderr, "Usage: ln [--stats] [--registers] [-O] [path]\n");
+        return 64;
+    }
+
+    char* source = read_file(argv[1]);
+    LnVM* vm = init_vm(argc, argv);
+    if(registers) vm->register_tier = true;
+    vm->optimize_level = optimize_level;
+    LnInterpretResult result = interpret(vm, argv[1], source);
+    if(stats) print_opcode_stats(vm, stderr);
+    free_vm(vm);
+    free(source);
+
+    if(result == INTERPRET_COMPILER_ERROR) return 65;
+    if(result == INTERPRET_RUNTIME_ERROR) return 70;
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "ln.h"
+
+static char* read_file(const char* path){
+    FILE* file = fopen(path, "rb");
+    if(file == NULL){
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END);
+    size_t file_size = ftell(file);
+    rewind(file);
+
+    char* buffer = malloc(file_size + 1);
+    if(buffer == NULL){
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(74);
+    }
+
+    size_t bytes_read = fread(buffer, sizeof(char), file_size, file);
+    buffer[bytes_read] = '\0';
+    fclose(file);
+    return buffer;
+}
+
+//runs a script in a fresh vm every time so no run pays for the previous one's heap
+static bool bench_script(char* path, int runs, bool registers, int optimize_level){
+    char* source = read_file(path);
+    double best = 0;
+    double total = 0;
+
+    for (int i = 0; i < runs; i++) {
+        LnVM* vm = init_vm(0, NULL);
+        if(registers) vm->register_tier = true;
+        vm->optimize_level = optimize_level;
+        clock_t start = clock();
+        LnInterpretResult result = interpret(vm, path, source);
+        double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+        free_vm(vm);
+
+        if(result != INTERPRET_OK){
+            fprintf(stderr, "%s failed to run.\n", path);
+            free(source);
+            return false;
+        }
+
+        total += elapsed;
+        if(i == 0 || elapsed < best) best = elapsed;
+    }
+
+    printf("%-40s best %8.3fs  mean %8.3fs  (%d runs)\n", path, best, total / runs, runs);
+    free(source);
+    return true;
+}
+
+int main(int argc, char** argv){
+    int runs = 3;
+    int first = 1;
+    bool registers = false;
+    int optimize_level = 0;
+
+    while(first < argc && argv[first][0] == '-'){
+        if(strcmp(argv[first], "-n") == 0 && first + 1 < argc){
+            runs = atoi(argv[first + 1]);
+            first += 2;
+        }else if(strcmp(argv[first], "-r") == 0){
+            registers = true;
+            first++;
+        }else if(strcmp(argv[first], "-O") == 0){
+            optimize_level = 1;
+            first++;
+        }else{
+            break;
+        }
+    }
+
+    if(first >= argc || runs < 1){
+        fprintf(stderr, "Usage: ln_bench [-n runs] [-r] [-O] script...\n");
+        return 64;
+    }
+
+    for (int i = first; i < argc; i++) {
+        if(!bench_script(argv[i], runs, registers, optimize_level)) return 70;
+    }
+    return 0;
+}
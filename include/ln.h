@@ -9,6 +9,7 @@
 #include <stdarg.h>
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #include "src/scanner.h"
 #include "src/compiler.h"
@@ -18,6 +19,12 @@
 #include "src/object.h"
 #include "src/hash_table.h"
 #include "src/vm.h"
+#include "src/natives.h"
+#include "src/debug.h"
+#include "src/registers.h"
+#include "src/peephole.h"
+#include "src/optimizer.h"
+#include "src/arena.h"
 
 
 typedef enum {
@@ -26,5 +33,11 @@ typedef enum {
     INTERPRET_RUNTIME_ERROR
 }LnInterpretResult;
 
+LnVM* init_vm(int argc, char** argv);
+
+void free_vm(LnVM* vm);
+
+LnInterpretResult interpret(LnVM* vm, char* module_name, char* source);
+
 
 #endif
\ No newline at end of file
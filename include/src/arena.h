@@ -0,0 +1,29 @@
+#ifndef file_arena_h
+#define file_arena_h
+
+#include <stddef.h>
+
+//memory that is only needed while one module compiles. Allocations are
+//bumped out of blocks and all of it is released at once by free_arena.
+//None of it is counted by the GC, so allocating here never starts a collection
+typedef struct ArenaBlock{
+    struct ArenaBlock* next;
+    size_t capacity;
+    size_t used;
+    char data[];
+}ArenaBlock;
+
+typedef struct{
+    ArenaBlock* blocks;
+}Arena;
+
+void init_arena(Arena* arena);
+
+void* arena_allocate(Arena* arena, size_t size);
+
+//moves an allocation to one of new_size bytes, in place when it was the last one
+void* arena_grow(Arena* arena, void* previous, size_t old_size, size_t new_size);
+
+void free_arena(Arena* arena);
+
+#endif
@@ -3,12 +3,48 @@
 
 #include "value.h"
 
+#define INLINE_CACHE_SIZE 4
+
+//WIDE before a jump gives it a 24 bit offset
+#define WIDE_JUMP_MAX 0xffffff
+
+typedef enum{
+  CACHE_FIELD,
+  CACHE_METHOD,
+  //SET_PROPERTY adding a field, moves the instance to transition
+  CACHE_TRANSITION
+}CacheKind;
+
+typedef struct{
+  struct sShape* shape;
+  CacheKind kind;
+  //slot of the field in the instance
+  int index;
+  struct sShape* transition;
+  Value method;
+}CacheEntry;
+
+//lookup cache of one GET_PROPERTY, SET_PROPERTY or INVOKE site. It is
+//monomorphic with one entry, polymorphic up to INLINE_CACHE_SIZE shapes and
+//megamorphic, so never consulted again, after that.
+typedef struct{
+  int count;
+  bool megamorphic;
+  CacheEntry entries[INLINE_CACHE_SIZE];
+}InlineCache;
+
 typedef struct{
   int count;
   int capacity;
   uint8_t *code;
   int *lines;
   ValueArray constants;
+  //open addressed index into constants by value bits, -1 marks a free entry
+  int* constant_indices;
+  int constant_index_capacity;
+  InlineCache* caches;
+  int cache_count;
+  int cache_capacity;
 }Chunk;
 
 void init_chunk(Chunk* chunk);
@@ -19,5 +55,9 @@ void write_chunk(LnVM* vm,Chunk* chunk, uint8_t byte, int line);
 
 int add_constant(LnVM* vm,Chunk* chunk,Value value);
 
+int lookup_constant(Chunk* chunk,Value value);
+
+int add_inline_cache(LnVM* vm,Chunk* chunk);
+
 
 #endif // file_chunk_h
@@ -5,6 +5,8 @@
 
 #include "object.h"
 #include "value.h"
+#include "peephole.h"
+#include "arena.h"
 
 
 typedef enum{
@@ -35,11 +37,17 @@ typedef struct
     Token previous;
     bool hasError;
     bool panicMode;
+    //locals, upvalues and the other bookkeeping of every function in the module
+    Arena arena;
+    //module functions compiled earlier in the source by slot, calls to them
+    //can be inlined. NULL where the slot's value isn't known
+    ObjFun** functions;
+    int function_capacity;
 }Parser;
 
 typedef struct
 {
-    uint8_t index;
+    uint16_t index;
     bool is_local;
 }UpValue;
 
@@ -47,8 +55,21 @@ typedef struct{
     Token name;
     int depth;
     bool is_captured;
+    //captured by the function it names, before CLOSURE has pushed its value
+    bool self_captured;
+    bool assigned;
+    //code of the `var` initializer, init_start is -1 for other locals
+    int init_start;
+    int init_end;
 }Local;
 
+//the kind byte of a CLOSURE capturing a local, it becomes CAPTURE_COPY once
+//the local goes out of scope without having been assigned
+typedef struct{
+    int slot;
+    int offset;
+}Capture;
+
 typedef struct sClassCompiler {
     struct sClassCompiler* enclosing;
     Token name;
@@ -68,6 +89,8 @@ typedef struct Loop{
     int body;
     int end;
     int scope_depth;
+    //a switch takes break but leaves continue to the loop around it
+    bool is_switch;
 }Loop;
 
 
@@ -75,18 +98,36 @@ typedef struct sCompiler {
     struct sCompiler* enclosing;
     Parser* parser;
     FunctionType type;
-    Local locals[UINT8_COUNT];
+    Local* locals;
     int local_count;
-    UpValue upvalues[UINT8_COUNT];
+    int local_capacity;
+    UpValue* upvalues;
+    int upvalue_capacity;
     int scope_depth;
     ClassCompiler* class;
     Loop* loop;
     ObjFun* function;
+    //offset of the last call instruction, -1 once a jump has been patched past it
+    int last_call;
+    //offset of a GET_PROPERTY ending the code so far, -1 like last_call
+    int last_property;
+    //offset of a GET_MODULE ending the code so far, -1 like last_call
+    int last_module;
+    //locals never assigned after their declaration, for constant propagation
+    ConstantLocal* constant_locals;
+    int constant_local_count;
+    int constant_local_capacity;
+    Capture* captures;
+    int capture_count;
+    int capture_capacity;
+    //jumps take 24 bit offsets after a 16 bit one overflowed and the function was compiled again
+    bool long_jumps;
+    bool jump_overflow;
 }Compiler;
 
 
 typedef void (*ParsePrefixFn)(Compiler* compiler, bool can_assign);
-typedef void (*ParseInfixFn)(Compiler* compiler, bool can_assign);
+typedef void (*ParseInfixFn)(Compiler* compiler, Token previous_token, bool can_assign);
 
 
 typedef struct{
@@ -96,4 +137,14 @@ typedef struct{
 }ParserRule;
 
 ObjFun* compile(LnVM* vm, ObjModule* module, const char* source);
+
+void gray_compiler_roots(LnVM* vm);
+
+int get_arg_count(uint8_t* code, ValueArray constants, int ip);
+
+int stack_effect(uint8_t* code, int ip);
+
+int switch_entry_count(uint8_t* code, int ip);
+
+int switch_target(uint8_t* code, int ip, int entry);
 #endif
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef file_debug_h
+#define file_debug_h
+
+#include <stdio.h>
+
+#include "vm.h"
+
+const char* opcode_name(uint8_t instruction);
+
+void print_opcode_stats(LnVM* vm, FILE* out);
+
+#endif
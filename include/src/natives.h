@@ -0,0 +1,8 @@
+#ifndef file_natives_h
+#define file_natives_h
+
+#include "value.h"
+
+void define_all_natives(LnVM* vm);
+
+#endif
@@ -63,12 +63,17 @@ struct sObjString
     int length;
     char* chars;
     uint32_t hash;
+    //index in vm->symbols once a method has this name, -1 before that
+    int symbol;
 };
 typedef struct{
     Obj obj;
     ObjString* name;
     ObjString* path;
-    HashTable values;
+    //slot of every variable by name, for access through the module object
+    HashTable slots;
+    //variable values by slot, EMPTY_VAL until the variable is defined
+    ValueArray values;
 }ObjModule;
 
 typedef struct{
@@ -78,6 +83,11 @@ typedef struct{
     ObjString* name;
     ObjModule* module;
     Chunk chunk;
+    //register tier translation of chunk, empty when the function runs stack code
+    Chunk registers;
+    int register_count;
+    //most values the function keeps on the stack above its arguments
+    int max_stack;
 }ObjFun;
 
 typedef struct sUpvalue{
@@ -87,31 +97,86 @@ typedef struct sUpvalue{
     struct sUpvalue* next;
 }ObjUpvalue;
 
+//how CLOSURE takes each upvalue
+typedef enum{
+    //shares an upvalue of the enclosing closure
+    CAPTURE_UPVALUE,
+    //shares a local of the enclosing frame through an ObjUpvalue
+    CAPTURE_LOCAL,
+    //copies a local that is never assigned into the closure's cell
+    CAPTURE_COPY
+}CaptureKind;
+
 typedef struct{
     Obj obj;
     ObjFun* function;
-    ObjUpvalue **upvalues;
     int upvalue_count;
+    //one per upvalue after the pointers, a copied capture lives in its cell
+    //and never becomes an object of its own
+    ObjUpvalue* cells;
+    ObjUpvalue* upvalues[];
 }ObjClosure;
 
+#define CLOSURE_SIZE(count) (sizeof(ObjClosure) + (sizeof(ObjUpvalue*) + sizeof(ObjUpvalue)) * (count))
+
 typedef struct{
     Obj obj;
     Value receiver;
     ObjClosure* method;
 }ObjBoundMethod;
 
+//fields past SHAPE_MAX_FIELDS, or shapes past CLASS_MAX_SHAPES, put an instance in dictionary mode
+#define SHAPE_MAX_FIELDS 64
+#define CLASS_MAX_SHAPES 256
+//most field slots an instance reserves inside its own allocation
+#define INSTANCE_MAX_INLINE_FIELDS 16
+
+//field layout shared by the instances that added the same fields in the same
+//order. The shapes of a class form a transition tree rooted at klass->shape,
+//so a shape also identifies the class of its instances.
+typedef struct sShape{
+    struct Klass* klass;
+    struct sShape* parent;
+    //field added by the transition from parent, it lives in slot field_count - 1
+    ObjString* name;
+    int field_count;
+    struct sShape** transitions;
+    int transition_count;
+    int transition_capacity;
+}Shape;
+
 typedef struct Klass{
     Obj obj;
     ObjString* name;
     struct Klass* super_class;
-    HashTable methods;
+    //vtable indexed by symbol, EMPTY_VAL where the class has no such method
+    ValueArray methods;
+    //properties set on this class itself
     HashTable properties;
+    //own and inherited properties, the nearest definition of each name. Valid
+    //while members_epoch matches vm->class_epoch
+    HashTable members;
+    uint32_t members_epoch;
+    //mutating a superclass invalidates every flattened table
+    bool has_subclasses;
+    Shape* shape;
+    int shape_count;
+    //inline slots reserved by new instances, the most fields seen on one so far
+    int field_hint;
 }ObjClass;
 
 typedef struct{
     Obj obj;
     ObjClass* klass;
-    HashTable fields;
+    //NULL once the instance fell back to dictionary mode
+    Shape* shape;
+    //field values by slot, pointing at inline_fields while they fit
+    Value* fields;
+    int capacity;
+    int inline_count;
+    //field values by name in dictionary mode
+    HashTable* dictionary;
+    Value inline_fields[];
 }ObjInstance;
 
 typedef struct {
@@ -154,6 +219,20 @@ struct sObjFile{
 
 ObjModule* new_module(LnVM* vm,ObjString* name);
 
+int module_slot(LnVM* vm, ObjModule* module, ObjString* name);
+
+ObjString* module_slot_name(ObjModule* module, int slot);
+
+bool module_get(ObjModule* module, ObjString* name, Value* value);
+
+void module_define(LnVM* vm, ObjModule* module, ObjString* name, Value value);
+
+int symbol_id(LnVM* vm, ObjString* name);
+
+bool method_get(ValueArray* methods, ObjString* name, Value* method);
+
+void method_set(LnVM* vm, ValueArray* methods, ObjString* name, Value method);
+
 ObjBoundMethod* new_boundmethod(LnVM* vm, Value receiver, ObjClosure* method);
 
 ObjClass* new_class(LnVM* vm, ObjString* name, ObjClass* super_class);
@@ -166,6 +245,12 @@ ObjFun* new_function(LnVM* vm, ObjModule* module);
 
 ObjInstance* new_instance(LnVM* vm, ObjClass* klass);
 
+int shape_slot(Shape* shape, ObjString* name);
+
+bool instance_get(ObjInstance* instance, ObjString* name, Value* value);
+
+void instance_set(LnVM* vm, ObjInstance* instance, ObjString* name, Value value);
+
 ObjNative* new_native(LnVM* vm, NativeFn function);
 
 ObjString* take_string(LnVM* vm,char* chars, int length);
@@ -176,10 +261,20 @@ ObjList* new_list(LnVM* vm);
 
 ObjMap* new_map(LnVM* vm);
 
+ObjList* copy_list(LnVM* vm, ObjList* list);
+
+ObjMap* copy_map(LnVM* vm, ObjMap* map);
+
 ObjFile* new_file(LnVM* vm);
 
 ObjUpvalue* new_upvalue(LnVM* vm, Value* slot);
 
+ObjUpvalue* copy_upvalue(ObjClosure* closure, int index, Value value);
+
+static inline bool is_copied_upvalue(ObjClosure* closure, ObjUpvalue* upvalue){
+    return upvalue >= closure->cells && upvalue < closure->cells + closure->upvalue_count;
+}
+
 char* list_to_string(Value value);
 
 char* map_to_string(Value value);
@@ -30,6 +30,7 @@ OPCODE(RIGHT_SHIFT)
 OPCODE(LEFT_SHIFT)
 OPCODE(NOT)
 OPCODE(LOOP)
+OPCODE(BREAK)
 OPCODE(CALL)
 OPCODE(INVOKE)
 OPCODE(WIDE)
@@ -42,6 +43,11 @@ OPCODE(INHERIT)
 OPCODE(METHOD)
 OPCODE(NEW_LIST)
 OPCODE(NEW_MAP)
+OPCODE(COPY_LITERAL)
+OPCODE(FOR_ITER)
+OPCODE(FOR_RANGE)
+OPCODE(TABLE_SWITCH)
+OPCODE(HASH_SWITCH)
 OPCODE(SUBSCRIPT)
 OPCODE(SUBSCRIPT_ASSIGN)
 OPCODE(SUBSCRIPT_PUSH)
@@ -51,4 +57,74 @@ OPCODE(SET_MODULE)
 OPCODE(IMPORT)
 OPCODE(IMPORT_BUILTIN)
 OPCODE(IMPORT_BUILTIN_VARIABLE)
-OPCODE(EMPTY)
\ No newline at end of file
+OPCODE(EMPTY)
+// Calls with up to three arguments carry the count in the opcode,
+// OP_CALL_0 + n, so they skip the operand byte.
+OPCODE(CALL_0)
+OPCODE(CALL_1)
+OPCODE(CALL_2)
+OPCODE(CALL_3)
+// A call whose result is returned right away, it reuses the caller's frame.
+OPCODE(TAIL_CALL)
+// Written by the peephole pass, see peephole.c. The comparisons stand for
+// the complementary comparison followed by NOT.
+OPCODE(GREATER_EQUAL)
+OPCODE(LESS_EQUAL)
+OPCODE(NOT_EQUAL)
+OPCODE(JUMP_IF_TRUE)
+// Compile-time inlining, see inline_call in compiler.c. INLINE_GUARD jumps
+// into an inlined body while the callee under the arguments still runs that
+// body's function, INLINE_RETURN drops the callee and its frame from under
+// the result.
+OPCODE(INLINE_GUARD)
+OPCODE(INLINE_RETURN)
+// Superinstructions. The compiler rewrites only the first opcode byte of a
+// matched sequence, so the operands and trailing opcodes stay in place and
+// a handler can fall back to running the original sequence one op at a time.
+OPCODE(GET_LOCAL_LOCAL_ADD)
+OPCODE(GET_LOCAL_CONSTANT_ADD)
+OPCODE(GET_LOCAL_CONSTANT_SUB)
+OPCODE(GET_LOCAL_CONSTANT_LESS_JUMP)
+OPCODE(GET_LOCAL_LOCAL_LESS_JUMP)
+OPCODE(CONSTANT_ADD_SET_LOCAL)
+OPCODE(SET_LOCAL_POP)
+// Quickened variants. A generic instruction rewrites its opcode byte into
+// one of these after seeing its operand types; the variant writes the
+// generic opcode back when its guard fails.
+OPCODE(ADD_NUM)
+OPCODE(ADD_STR)
+OPCODE(SUB_NUM)
+OPCODE(MUL_NUM)
+OPCODE(LESS_NUM)
+OPCODE(GREATER_NUM)
+OPCODE(SUBSCRIPT_LIST_NUM)
+// Register tier, see registers.c. Operands are frame slots (r), constant
+// indices (k) or 16 bit jump offsets; JUMP and LOOP are shared with the
+// stack code.
+OPCODE(REG_ENTER)
+OPCODE(REG_MOVE)
+OPCODE(REG_LOAD_CONSTANT)
+OPCODE(REG_LOAD_NIL)
+OPCODE(REG_LOAD_TRUE)
+OPCODE(REG_LOAD_FALSE)
+OPCODE(REG_GET_GLOBAL)
+OPCODE(REG_GET_MODULE)
+OPCODE(REG_EQUAL)
+OPCODE(REG_GREATER)
+OPCODE(REG_LESS)
+OPCODE(REG_ADD)
+OPCODE(REG_SUB)
+OPCODE(REG_MUL)
+OPCODE(REG_DIV)
+OPCODE(REG_ADD_CONSTANT)
+OPCODE(REG_SUB_CONSTANT)
+OPCODE(REG_NOT)
+OPCODE(REG_NEGATE)
+OPCODE(REG_JUMP_IF_FALSE)
+OPCODE(REG_JUMP_IF_TRUE)
+OPCODE(REG_LESS_JUMP)
+OPCODE(REG_LESS_CONSTANT_JUMP)
+OPCODE(REG_CALL)
+OPCODE(REG_TAIL_CALL)
+OPCODE(REG_INLINE_GUARD)
+OPCODE(REG_RETURN)
@@ -0,0 +1,9 @@
+#ifndef file_optimizer_h
+#define file_optimizer_h
+
+#include "object.h"
+#include "peephole.h"
+
+void optimize_function(LnVM* vm, ObjFun* function, ConstantLocal* locals, int local_count);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef file_peephole_h
+#define file_peephole_h
+
+#include "object.h"
+
+//a `var` local that is never assigned. If its initializer folds to a
+//constant, reads of the slot between end and scope_end read that constant.
+//The offsets are moved along when the pass compacts the code
+typedef struct{
+    uint8_t slot;
+    int start;
+    int end;
+    int scope_end;
+}ConstantLocal;
+
+void optimize_peephole(LnVM* vm, ObjFun* function, ConstantLocal* locals, int local_count);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef file_registers_h
+#define file_registers_h
+
+#include "object.h"
+
+bool translate_to_registers(LnVM* vm, ObjFun* function);
+
+#endif
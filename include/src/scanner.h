@@ -9,7 +9,9 @@ typedef enum{
     //keywords
     TOKEN_WHILE,TOKEN_FOR,TOKEN_FUNC,TOKEN_IF,
     TOKEN_ELSE,TOKEN_RETURN,TOKEN_CONTINUE,TOKEN_VAR,
-    TOKEN_CLASS,TOKEN_BREAK,TOKEN_IMPORT,
+    TOKEN_CLASS,TOKEN_BREAK,TOKEN_IMPORT,TOKEN_TRUE,
+    TOKEN_FALSE,TOKEN_NIL,TOKEN_THIS,TOKEN_SUPER,
+    TOKEN_IN,TOKEN_SWITCH,TOKEN_CASE,TOKEN_DEFAULT,
 
     //single character tokens
     TOKEN_PLUS,TOKEN_MINUS,TOKEN_SLASH,TOKEN_STAR,
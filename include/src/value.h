@@ -19,17 +19,28 @@ typedef struct sObjFile ObjFile;
 #define TAG_FALSE 2 
 #define TAG_TRUE  3
 #define TAG_EMPTY 4
+//integers that fit in 32 bits are boxed in the QNAN space as well, marked by
+//INT_BIT above the pointer bits with the integer in the low 32 bits
+#define INT_BIT ((uint64_t)1 << 48)
 
 typedef uint64_t Value;
 
 #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
 #define IS_NIL(value)      ((value) == NIL_VAL)
 #define IS_EMPTY(value)      ((value) == EMPTY_VAL)
-#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+#define IS_INT(value) \
+        (((value) & (SIGN_BIT | QNAN | INT_BIT)) == (QNAN | INT_BIT))
+#define IS_DOUBLE(value)  (((value) & QNAN) != QNAN)
+#define IS_NUMBER(value)  (IS_DOUBLE(value) || IS_INT(value))
+//both ints in one test: the tag bits of a & b and the sign bit of a | b
+#define ARE_INTS(a, b) \
+        (((((a) & (b)) | (((a) | (b)) & SIGN_BIT)) & (SIGN_BIT | QNAN | INT_BIT)) == (QNAN | INT_BIT))
+#define ARE_NUMBERS(a, b) (ARE_INTS(a, b) || (IS_NUMBER(a) && IS_NUMBER(b)))
 #define IS_OBJ(value) \
         (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
 #define AS_BOOL(value)  ((value) == TRUE_VAL)
+#define AS_INT(value)   ((int32_t)(uint32_t)(value))
 #define AS_NUMBER(value) value_to_num(value)
 #define AS_OBJ(value) \
         ((Obj*) (uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
@@ -39,6 +50,8 @@ typedef uint64_t Value;
 #define TRUE_VAL     ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL     ((Value)(uint64_t)(QNAN | TAG_NIL))
 #define EMPTY_VAL  ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+#define INT_VAL(i) \
+        ((Value)(QNAN | INT_BIT | (uint64_t)(uint32_t)(i)))
 #define NUMBER_VAL(num) num_to_value(num)
 #define OBJ_VAL(obj) \
         (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
@@ -50,18 +63,43 @@ typedef union{
     double num;
 }DoubleUnion;
 
-static inline double value_to_num(Value value){
+static inline double value_to_double(Value value){
     DoubleUnion data;
     data.bits64 = value;
     return data.num;
 }
 
+static inline double value_to_num(Value value){
+    if(IS_INT(value)) return AS_INT(value);
+    return value_to_double(value);
+}
+
 static inline Value num_to_value(double num){
     DoubleUnion data;
     data.num = num;
     return data.bits64;
 }
 
+//the int form of an integral number in int32 range, other numbers (and -0)
+//stay doubles. Arithmetic on doubles doesn't narrow its results, so the same
+//number can be boxed either way and comparisons go through the numeric value
+static inline Value narrow_number(double num){
+    if(num >= INT32_MIN && num <= INT32_MAX && (double)(int32_t)num == num && num_to_value(num) != SIGN_BIT){
+        return INT_VAL((int32_t)num);
+    }
+    return num_to_value(num);
+}
+
+static inline uint32_t hash_bits(uint64_t hash){
+    hash = ~hash + (hash << 18);
+    hash = hash ^ (hash >> 31);
+    hash = hash * 21;
+    hash = hash ^ (hash >> 11);
+    hash = hash + (hash << 6);
+    hash = hash ^ (hash >> 22);
+    return (uint32_t) (hash & 0x3fffffff);
+}
+
 typedef struct
 {
     int capacity;
@@ -8,58 +8,15 @@
 #include "compiler.h"
 
 typedef enum{//note: implement different op instr for comparison operators
-    OP_CONSTANT,
-    OP_NIL,
-    OP_TRUE,
-    OP_FALSE,
-    OP_POP,
-    OP_GET_LOCAL,
-    OP_SET_LOCAL,
-    OP_GET_GLOBAL,
-    OP_DEFINE_GLOBAL,
-    OP_SET_GLOBAL,
-    OP_GET_UPVALUE,
-    OP_SET_UPVALUE,
-    OP_GET_PROPERTY,
-    OP_SET_PROPERTY,
-    OP_GET_SUPER,
-    OP_EQUAL,
-    OP_GREATER,
-    OP_LESS,
-    OP_NEGATE,
-    OP_JUMP,
-    OP_JUMP_IF_FALSE,
-    OP_ADD,
-    OP_SUB,
-    OP_MUL,
-    OP_DIV,
-    OP_BITWISE_AND,
-    OP_BITWISE_OR,
-    OP_BITWISE_XOR,
-    OP_RIGHT_SHIFT,
-    OP_LEFT_SHIFT,
-    OP_NOT,
-    OP_LOOP,
-    OP_CALL,
-    OP_INVOKE,
-    OP_WIDE,
-    OP_SUPER_INVOKE,
-    OP_CLOSURE,
-    OP_CLOSE_UPVALUE,
-    OP_RETURN,
-    OP_CLASS,
-    OP_INHERIT,
-    OP_METHOD,
-    OP_EMPTY,
-    OP_GET_MODULE,
-    OP_DEFINE_MODULE,
-    OP_SET_MODULE,
-    OP_BREAK,
-    OP_IMPORT,
-    OP_IMPORT_BUILTIN
+#define OPCODE(name) OP_##name,
+#include "opcodes.h"
+#undef OPCODE
 }Opcode;
 
-#define STACK_MAX (64 * UINT8_COUNT)
+#define STACK_INITIAL 256
+//room kept above every frame's max_stack for values helpers and natives push
+#define STACK_HEADROOM 8
+#define FRAMES_MAX 4096
 
 typedef struct{
     ObjClosure* closure;
@@ -69,21 +26,32 @@ typedef struct{
 
 struct vm {
     Compiler* compiler;
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stack_top;
-    CallFrame* frames;
+    //a call grows the stack when the callee's max_stack would pass this
+    Value* stack_limit;
+    int stack_capacity;
+    CallFrame frames[FRAMES_MAX];
     int frame_count;
-    int frame_capacity;
     ObjModule* last_module;
     HashTable modules;
+    //slot of every global by name, the values are in global_values
     HashTable globals;
+    ValueArray global_values;
     HashTable strings;
-    HashTable string_methods;
-    HashTable list_methods;
-    HashTable map_methods;
-    HashTable file_methods;
+    //method names by symbol, see symbol_id
+    ValueArray symbols;
+    //vtables of the built-in types, indexed by symbol like a class's methods
+    ValueArray string_methods;
+    ValueArray list_methods;
+    ValueArray map_methods;
+    ValueArray file_methods;
     ObjString* init_string;
+    //name of the virtual field holding an instance's class
+    ObjString* class_string;
     ObjUpvalue* open_upvalues;
+    //bumped when a class with subclasses changes, see class_property
+    uint32_t class_epoch;
     size_t bytes_allocated;
     size_t next_gc;
     Obj* objects;
@@ -92,6 +60,13 @@ struct vm {
     Obj **gray_stack;
     int argc;
     char** argv;
+    //translate functions to the register tier as they are compiled
+    bool register_tier;
+    //0 compiles straight to bytecode, 1 runs optimizer.c on every function
+    int optimize_level;
+    int fusion_counts[UINT8_COUNT];
+    uint64_t* opcode_pairs;
+    uint8_t last_opcode;
 };
 
 void push(LnVM* vm, Value value);
@@ -102,6 +77,8 @@ void runtime_error(LnVM* vm, const char* format, ...);
 
 Value pop(LnVM* vm);
 
+bool is_falsey(Value value);
+
 ObjClosure* compile_module_to_closure(LnVM* vm, char* name, char* source);
 
 
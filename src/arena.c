@@ -0,0 +1,52 @@
+#include "ln.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+void init_arena(Arena* arena){
+    arena->blocks = NULL;
+}
+
+void* arena_allocate(Arena* arena, size_t size){
+    size = ARENA_ALIGN(size);
+    ArenaBlock* block = arena->blocks;
+    if(block == NULL || block->capacity - block->used < size){
+        size_t capacity = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + capacity);
+        if(block == NULL){
+            printf("Failed to allocate memory");
+            exit(71);
+        }
+        block->capacity = capacity;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void* arena_grow(Arena* arena, void* previous, size_t old_size, size_t new_size){
+    ArenaBlock* block = arena->blocks;
+    old_size = ARENA_ALIGN(old_size);
+    if(previous != NULL && block != NULL && (char*)previous + old_size == block->data + block->used &&
+       block->capacity - block->used >= ARENA_ALIGN(new_size) - old_size){
+        block->used += ARENA_ALIGN(new_size) - old_size;
+        return previous;
+    }
+
+    void* memory = arena_allocate(arena, new_size);
+    if(previous != NULL) memcpy(memory, previous, old_size < new_size ? old_size : new_size);
+    return memory;
+}
+
+void free_arena(Arena* arena){
+    ArenaBlock* block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
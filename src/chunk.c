@@ -6,19 +6,26 @@ void init_chunk(Chunk* chunk){
     chunk->code = NULL;
     chunk->lines = NULL;
     init_valueArray(&chunk->constants);
+    chunk->constant_indices = NULL;
+    chunk->constant_index_capacity = 0;
+    chunk->caches = NULL;
+    chunk->cache_count = 0;
+    chunk->cache_capacity = 0;
 }
 
 void free_chunk(LnVM* vm, Chunk* chunk){
     FREE_ARRAY(vm,uint8_t,chunk->code,chunk->capacity);
     FREE_ARRAY(vm,int,chunk->lines,chunk->capacity);
     free_valueArray(vm,&chunk->constants);
+    FREE_ARRAY(vm,int,chunk->constant_indices,chunk->constant_index_capacity);
+    FREE_ARRAY(vm,InlineCache,chunk->caches,chunk->cache_capacity);
     init_chunk(chunk);
 }
 
 void write_chunk(LnVM* vm, Chunk* chunk,uint8_t byte, int line){
     if(chunk->capacity < chunk->count + 1){
         int old_cap = chunk->capacity;
-        chunk->capacity - GROW_CAPACITY(old_cap);
+        chunk->capacity = GROW_CAPACITY(old_cap);
         chunk->code = GROW_ARRAY(vm,chunk->code,uint8_t,old_cap,chunk->capacity);
 
         chunk->lines = GROW_ARRAY(vm,chunk->lines,int,old_cap,chunk->capacity);
@@ -29,10 +36,54 @@ void write_chunk(LnVM* vm, Chunk* chunk,uint8_t byte, int line){
     chunk->count++;
 }
 
+//entry of value in the index, or the free entry it would go in
+static int* constant_entry(Chunk* chunk, Value value){
+    int mask = chunk->constant_index_capacity - 1;
+    int entry = hash_bits(value) & mask;
+    while (chunk->constant_indices[entry] != -1 && chunk->constants.value[chunk->constant_indices[entry]] != value) {
+        entry = (entry + 1) & mask;
+    }
+    return &chunk->constant_indices[entry];
+}
+
+//index of value in the constants, -1 when it isn't there. Constants are told
+//apart by their bits, so 1 and 1.0 or 0 and -0 get their own entries
+int lookup_constant(Chunk* chunk, Value value){
+    if(chunk->constant_index_capacity == 0) return -1;
+    return *constant_entry(chunk, value);
+}
+
+//identical constants share one entry
 int add_constant(LnVM* vm, Chunk* chunk,Value value){
-    push(vm,value);
+    int index = lookup_constant(chunk, value);
+    if(index != -1) return index;
 
+    push(vm,value);
     write_valueArray(vm,&chunk->constants,value);
+
+    //keep the index at most half full
+    if(chunk->constants.count * 2 > chunk->constant_index_capacity){
+        int old_cap = chunk->constant_index_capacity;
+        FREE_ARRAY(vm,int,chunk->constant_indices,old_cap);
+        chunk->constant_index_capacity = old_cap < 8 ? 16 : old_cap * 2;
+        chunk->constant_indices = ALLOCATE(vm,int,chunk->constant_index_capacity);
+        for (int i = 0; i < chunk->constant_index_capacity; i++) chunk->constant_indices[i] = -1;
+        for (int i = 0; i < chunk->constants.count - 1; i++) *constant_entry(chunk, chunk->constants.value[i]) = i;
+    }
+    *constant_entry(chunk, value) = chunk->constants.count - 1;
     pop(vm);
     return chunk->constants.count - 1;
-}
\ No newline at end of file
+}
+
+int add_inline_cache(LnVM* vm, Chunk* chunk){
+    if(chunk->cache_capacity < chunk->cache_count + 1){
+        int old_cap = chunk->cache_capacity;
+        chunk->cache_capacity = GROW_CAPACITY(old_cap);
+        chunk->caches = GROW_ARRAY(vm,chunk->caches,InlineCache,old_cap,chunk->cache_capacity);
+    }
+
+    InlineCache* cache = &chunk->caches[chunk->cache_count];
+    cache->count = 0;
+    cache->megamorphic = false;
+    return chunk->cache_count++;
+}
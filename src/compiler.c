@@ -4,8 +4,15 @@
 static void parser_init(Parser *parser){
     parser->hasError = false;
     parser->panicMode = false;
+    init_arena(&parser->arena);
+    parser->functions = NULL;
+    parser->function_capacity = 0;
 
 }
+//an array of the compile's arena moved to room for count elements
+#define GROW_TRANSIENT(parser, type, pointer, old_count, count) \
+    (type*)arena_grow(&(parser)->arena, pointer, sizeof(type) * (old_count), sizeof(type) * (count))
+
 static Chunk* current_chunk(Compiler* compiler){
     return &compiler->function->chunk;
 }
@@ -73,21 +80,67 @@ static void emit_bytes(Compiler* compiler,uint8_t first_byte, uint8_t second_byt
     emit_byte(compiler,second_byte);
 }
 
+static void emit_short(Compiler* compiler, uint16_t value){
+    emit_byte(compiler,(value >> 8) & 0xff);
+    emit_byte(compiler,value & 0xff);
+}
+
+//an instruction with a constant, name, local or upvalue operand, behind WIDE
+//when the operand needs 16 bits
+static void emit_operand(Compiler* compiler, uint8_t instruction, int operand){
+    if(operand <= UINT8_MAX){
+        emit_bytes(compiler,instruction,(uint8_t)operand);
+    }else{
+        emit_bytes(compiler,OP_WIDE,instruction);
+        emit_short(compiler,(uint16_t)operand);
+    }
+}
+
 static void emit_loop(Compiler* compiler, int loop_start){
-    emit_byte(compiler,OP_LOOP);
-    int offset = current_chunk(compiler)->count - loop_start + 2;
-    if(offset > UINT16_MAX) error(compiler->parser, "Loop body too large");
+    //distance from the end of the LOOP back to loop_start
+    int offset = current_chunk(compiler)->count - loop_start + 3;
+    if(offset <= UINT16_MAX){
+        emit_byte(compiler,OP_LOOP);
+        emit_short(compiler,(uint16_t)offset);
+        return;
+    }
 
-    emit_byte(compiler,(offset >> 8) & 0xff);
-    emit_byte(compiler,offset & 0xff);
+    offset += 2;
+    if(offset > WIDE_JUMP_MAX) error(compiler->parser, "Loop body too large");
+    emit_bytes(compiler,OP_WIDE,OP_LOOP);
+    emit_byte(compiler,(offset >> 16) & 0xff);
+    emit_short(compiler,(uint16_t)(offset & 0xffff));
 }
 
+//returns the offset of the jump's operand for patch_jump
 static int emit_jump(Compiler* compiler, uint8_t instruction){
+    if(compiler->long_jumps){
+        emit_bytes(compiler,OP_WIDE,instruction);
+        emit_byte(compiler,0xff);
+        emit_short(compiler,0xffff);
+        return current_chunk(compiler)->count - 3;
+    }
     emit_byte(compiler,instruction);
-    emit_byte(compiler,0xff);
-    emit_byte(compiler,0xff);
+    emit_short(compiler,0xffff);
     return current_chunk(compiler)->count - 2;
 }
+static void emit_call(Compiler* compiler, int arg_count){
+    if(arg_count <= 3){
+        emit_byte(compiler,OP_CALL_0 + arg_count);
+    }else{
+        emit_bytes(compiler,OP_CALL,arg_count);
+    }
+}
+
+//operand of GET_PROPERTY, SET_PROPERTY and INVOKE naming the site's inline cache
+static void emit_cache(Compiler* compiler){
+    int cache = add_inline_cache(compiler->parser->vm, current_chunk(compiler));
+    if(cache > UINT16_MAX){
+        error(compiler->parser, "Too many property accesses in one chunk");
+    }
+    emit_short(compiler,(uint16_t)cache);
+}
+
 static void emit_return(Compiler* compiler){
     if(compiler->type == TYPE_INITIALIZER){
         emit_bytes(compiler,OP_GET_LOCAL,0);
@@ -97,8 +150,19 @@ static void emit_return(Compiler* compiler){
     emit_byte(compiler,OP_RETURN);
 }
 
-static uint8_t make_constant(Compiler* compiler, Value value){
+//index of a constant for an instruction that can take it behind WIDE. The
+//others take the byte from make_constant
+static int add_literal(Compiler* compiler, Value value){
     int constant = add_constant(compiler->parser->vm, current_chunk(compiler),value);
+    if(constant > UINT16_MAX){
+        error(compiler->parser, "Too many constants in one chunk");
+        return 0;
+    }
+    return constant;
+}
+
+static uint8_t make_constant(Compiler* compiler, Value value){
+    int constant = add_literal(compiler, value);
     if(constant > UINT8_MAX){
         error(compiler->parser, "Too many constants in one chunk");
         return 0;
@@ -106,17 +170,44 @@ static uint8_t make_constant(Compiler* compiler, Value value){
     return (uint8_t)constant;
 }
 static void emit_constant(Compiler* compiler, Value value){
-    emit_bytes(compiler,OP_CONSTANT, make_constant(compiler,value));
+    emit_operand(compiler,OP_CONSTANT,add_literal(compiler,value));
 }
 static void patch_jump(Compiler* compiler, int offset){
-    int jump = current_chunk(compiler)->count - offset - 2;
+    uint8_t* code = current_chunk(compiler)->code;
+    if(compiler->long_jumps){
+        int jump = current_chunk(compiler)->count - offset - 3;
+        if(jump > WIDE_JUMP_MAX){
+            error(compiler->parser, "Too much code to jump over");
+        }
+        code[offset] = (jump >> 16) & 0xff;
+        code[offset + 1] = (jump >> 8) & 0xff;
+        code[offset + 2] = jump & 0xff;
+    }else{
+        int jump = current_chunk(compiler)->count - offset - 2;
+        //compiled again with long jumps once the function is done
+        if(jump > UINT16_MAX) compiler->jump_overflow = true;
 
-    if (jump > UINT16_MAX){
-        error(compiler->parser, "Too much code to jump over");
+        code[offset] = (jump >> 8) & 0xff;
+        code[offset + 1] = jump & 0xff;
     }
+    //the jump lands after the last call, property get or module read, none can be rewritten now
+    compiler->last_call = -1;
+    compiler->last_property = -1;
+    compiler->last_module = -1;
+}
 
-    current_chunk(compiler)->code[offset] = (jump >> 8) & 0xff;
-    current_chunk(compiler)->code[offset + 1] = jump & 0xff;
+static void grow_locals(Compiler* compiler){
+    if(compiler->local_capacity >= compiler->local_count + 1) return;
+    int old_capacity = compiler->local_capacity;
+    compiler->local_capacity = GROW_CAPACITY(old_capacity);
+    compiler->locals = GROW_TRANSIENT(compiler->parser, Local, compiler->locals, old_capacity, compiler->local_capacity);
+}
+
+static void grow_upvalues(Compiler* compiler){
+    if(compiler->upvalue_capacity >= compiler->function->upvalue_count + 1) return;
+    int old_capacity = compiler->upvalue_capacity;
+    compiler->upvalue_capacity = GROW_CAPACITY(old_capacity);
+    compiler->upvalues = GROW_TRANSIENT(compiler->parser, UpValue, compiler->upvalues, old_capacity, compiler->upvalue_capacity);
 }
 
 static void init_compiler(Parser* parser, Compiler* compiler, Compiler* parent, FunctionType type){
@@ -125,20 +216,34 @@ static void init_compiler(Parser* parser, Compiler* compiler, Compiler* parent,
     compiler->function = NULL; 
     compiler->class = NULL;
 
+    compiler->loop = NULL;
+
     if(parent != NULL){
         compiler->class = parent->class;
-        compiler->loop = parent->loop;
     }
 
     compiler->type = type;
+    compiler->locals = NULL;
     compiler->local_count = 0;
+    compiler->local_capacity = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalue_capacity = 0;
     compiler->scope_depth = 0;
+    compiler->last_call = -1;
+    compiler->last_property = -1;
+    compiler->last_module = -1;
+    compiler->constant_locals = NULL;
+    compiler->constant_local_count = 0;
+    compiler->constant_local_capacity = 0;
+    compiler->captures = NULL;
+    compiler->capture_count = 0;
+    compiler->capture_capacity = 0;
+    compiler->long_jumps = false;
+    compiler->jump_overflow = false;
 
     parser->vm->compiler = compiler;
 
-    compiler->function = new_function(parser->vm, parser->module);
-
-    compiler->function = new_function(parser->vm,parser->module);//TO add VM
+    compiler->function = new_function(parser->vm,parser->module);
 
     switch (type)
     {
@@ -151,10 +256,12 @@ static void init_compiler(Parser* parser, Compiler* compiler, Compiler* parent,
             break;
     }
 
+    grow_locals(compiler);
     Local* local = &compiler->locals[compiler->local_count++];
 
     local->depth = compiler->scope_depth;
     local->is_captured = false;
+    local->self_captured = false;
     if(type == TYPE_METHOD || type == TYPE_INITIALIZER) {
         local->name.start = "this";
         local->name.length = 4;
@@ -163,18 +270,92 @@ static void init_compiler(Parser* parser, Compiler* compiler, Compiler* parent,
         local->name.length = 0;
 
     }
+    local->assigned = false;
+    local->init_start = -1;
 }
 
+//records a local going out of scope at the current offset if its value never changes
+static void add_constant_local(Compiler* compiler, int slot){
+    Local* local = &compiler->locals[slot];
+    if(slot > UINT8_MAX || local->assigned || local->is_captured || local->init_start == -1) return;
+
+    if(compiler->constant_local_capacity < compiler->constant_local_count + 1){
+        int old_capacity = compiler->constant_local_capacity;
+        compiler->constant_local_capacity = GROW_CAPACITY(old_capacity);
+        compiler->constant_locals = GROW_TRANSIENT(compiler->parser, ConstantLocal, compiler->constant_locals,
+                                                   old_capacity, compiler->constant_local_capacity);
+    }
+    ConstantLocal* constant = &compiler->constant_locals[compiler->constant_local_count++];
+    constant->slot = (uint8_t)slot;
+    constant->start = local->init_start;
+    constant->end = local->init_end;
+    constant->scope_end = current_chunk(compiler)->count;
+}
+
+static void add_capture(Compiler* compiler, int slot, int offset){
+    if(compiler->capture_capacity < compiler->capture_count + 1){
+        int old_capacity = compiler->capture_capacity;
+        compiler->capture_capacity = GROW_CAPACITY(old_capacity);
+        compiler->captures = GROW_TRANSIENT(compiler->parser, Capture, compiler->captures, old_capacity, compiler->capture_capacity);
+    }
+    compiler->captures[compiler->capture_count].slot = slot;
+    compiler->captures[compiler->capture_count].offset = offset;
+    compiler->capture_count++;
+}
+
+// Settles the closures capturing a local going out of scope. A local that
+// is never assigned can't change once CLOSURE has read it, so the closures
+// copy it and no upvalue object is made. True if that happened and the
+// local needs no closing.
+static bool copy_captures(Compiler* compiler, int slot){
+    Local* local = &compiler->locals[slot];
+    bool copy = !local->assigned && !local->self_captured;
+    for (int i = compiler->capture_count - 1; i >= 0; i--) {
+        Capture* capture = &compiler->captures[i];
+        if(capture->slot != slot) continue;
+        if(copy) current_chunk(compiler)->code[capture->offset] = CAPTURE_COPY;
+        *capture = compiler->captures[--compiler->capture_count];
+    }
+    return copy;
+}
+
+static void fuse_superinstructions(Compiler* compiler);
+static int max_stack(Compiler* compiler);
+
 static ObjFun* end_compiler(Compiler* compiler){
     emit_return(compiler);
+    for (int i = 0; i < compiler->local_count; i++) {
+        if(compiler->locals[i].is_captured) copy_captures(compiler, i);
+    }
+    for (int i = 1; i < compiler->local_count; i++) {
+        add_constant_local(compiler, i);
+    }
+    optimize_peephole(compiler->parser->vm, compiler->function, compiler->constant_locals, compiler->constant_local_count);
+    if(compiler->parser->vm->optimize_level > 0){
+        optimize_function(compiler->parser->vm, compiler->function, compiler->constant_locals, compiler->constant_local_count);
+    }
+    compiler->function->max_stack = max_stack(compiler);
+    if(compiler->parser->vm->register_tier){
+        translate_to_registers(compiler->parser->vm, compiler->function);
+    }
+    fuse_superinstructions(compiler);
     ObjFun* function = compiler->function;
     //TODO: DEBUGGER
     if(compiler->enclosing != NULL){
-        emit_bytes(compiler->enclosing,OP_CLOSURE, make_constant(compiler->enclosing, OBJ_VAL(function)));
+        Compiler* enclosing = compiler->enclosing;
+        emit_operand(enclosing,OP_CLOSURE, add_literal(enclosing, OBJ_VAL(function)));
 
         for (int i = 0; i< function->upvalue_count; i++){
-            emit_byte(compiler->enclosing, compiler->upvalues[i].is_local ? 1: 0);
-            emit_byte(compiler->enclosing, compiler->upvalues[i].index);
+            UpValue* upvalue = &compiler->upvalues[i];
+            if(upvalue->is_local){
+                //a local function's own slot is pushed by this CLOSURE
+                if(compiler->type == TYPE_FUNCTION && enclosing->scope_depth > 0 && upvalue->index == enclosing->local_count - 1){
+                    enclosing->locals[upvalue->index].self_captured = true;
+                }
+                add_capture(enclosing, upvalue->index, current_chunk(enclosing)->count);
+            }
+            emit_byte(enclosing, upvalue->is_local ? CAPTURE_LOCAL : CAPTURE_UPVALUE);
+            emit_short(enclosing, upvalue->index);
         }
     }
     compiler->parser->vm->compiler = compiler->enclosing;
@@ -191,7 +372,8 @@ static void end_scope(Compiler* compiler){
     while (compiler->local_count >0 && compiler->locals[compiler->local_count - 1].depth >
     compiler->scope_depth)
     {
-        if(compiler->locals[compiler->local_count - 1].is_captured){
+        add_constant_local(compiler, compiler->local_count - 1);
+        if(compiler->locals[compiler->local_count - 1].is_captured && !copy_captures(compiler, compiler->local_count - 1)){
             emit_byte(compiler,OP_CLOSE_UPVALUE);
         } else{
             emit_byte(compiler,OP_POP);
@@ -207,14 +389,45 @@ static void statement(Compiler* compiler);
 static void declaration(Compiler* compiler);
 static ParserRule* get_rule(TokenType type);
 
-static uint8_t identifier_constant(Compiler* compiler, Token* name) {
+static int identifier_constant(Compiler* compiler, Token* name) {
     ObjString *string = copy_string(compiler->parser->vm, name->start, name->length);
 
-    uint8_t index = make_constant(compiler, OBJ_VAL(string));
+    int index = add_literal(compiler, OBJ_VAL(string));
     return index;
 }
 
 
+//slot of a module variable, names used before their definition get an undefined slot
+static int module_variable(Compiler* compiler, Token* name){
+    LnVM* vm = compiler->parser->vm;
+    ObjString* string = copy_string(vm, name->start, name->length);
+    int slot = module_slot(vm, compiler->parser->module, string);
+    if(slot > UINT16_MAX){
+        error(compiler->parser, "Too many module variables");
+        return 0;
+    }
+    return slot;
+}
+
+static ObjFun* find_module_function(Parser* parser, int slot){
+    return slot < parser->function_capacity ? parser->functions[slot] : NULL;
+}
+
+//a module slot given a new value, calls through it are no longer known
+static void forget_module_function(Parser* parser, int slot){
+    if(slot < parser->function_capacity) parser->functions[slot] = NULL;
+}
+
+static void remember_module_function(Parser* parser, int slot, ObjFun* function){
+    if(slot >= parser->function_capacity){
+        int old_capacity = parser->function_capacity;
+        while (parser->function_capacity <= slot) parser->function_capacity = GROW_CAPACITY(parser->function_capacity);
+        parser->functions = GROW_TRANSIENT(parser, ObjFun*, parser->functions, old_capacity, parser->function_capacity);
+        memset(parser->functions + old_capacity, 0, sizeof(ObjFun*) * (parser->function_capacity - old_capacity));
+    }
+    parser->functions[slot] = function;
+}
+
 static bool identifiers_equal(Token* a, Token* b){
     if(a->length != b->length) return false;
 
@@ -235,7 +448,7 @@ static int resolve_local(Compiler* compiler, Token* name){
     return -1;
 }
 
-static int add_upvalue(Compiler* compiler,uint8_t index, bool is_local){
+static int add_upvalue(Compiler* compiler,int index, bool is_local){
     int upvalue_count = compiler->function->upvalue_count;
     for (int i = 0; i < upvalue_count; i++)
     {
@@ -245,13 +458,14 @@ static int add_upvalue(Compiler* compiler,uint8_t index, bool is_local){
         }
     }
 
-    if(upvalue_count == UINT8_COUNT){
+    if(upvalue_count == UINT16_COUNT){
         error(compiler->parser,"Too many closure variables in function");
         return 0;
     }
 
+    grow_upvalues(compiler);
     compiler->upvalues[upvalue_count].is_local = is_local;
-    compiler->upvalues[upvalue_count].index = index;
+    compiler->upvalues[upvalue_count].index = (uint16_t)index;
 
     return compiler->function->upvalue_count++;
     
@@ -264,29 +478,33 @@ static int resolve_upvalue(Compiler* compiler,Token* name){
 
     if(local != -1){
         compiler->enclosing->locals[local].is_captured = true;
-        return add_upvalue(compiler,(uint8_t)local,true);
+        return add_upvalue(compiler,local,true);
     }
 
     int up_value = resolve_upvalue(compiler->enclosing,name);
 
     if(up_value != -1){
-        return add_upvalue(compiler,(uint8_t)local,false);
+        return add_upvalue(compiler,up_value,false);
     }
 
     return -1;
 }
 
 static void add_local(Compiler* compiler, Token name){
-    if(compiler->local_count == UINT8_COUNT){
+    if(compiler->local_count == UINT16_COUNT){
         error(compiler->parser, "Too many local variables in function");
         return;
     }
 
+    grow_locals(compiler);
     Local* local = &compiler->locals[compiler->local_count];
     local->name = name;
 
     local->depth = -1;
     local->is_captured = false;
+    local->self_captured = false;
+    local->assigned = false;
+    local->init_start = -1;
     compiler->local_count++;
 }
 
@@ -307,21 +525,30 @@ static void declare_variable(Compiler* compiler, Token* name){
     
 }
 
-static uint8_t parse_variable(Compiler* compiler, const char* error_message){
+static int parse_variable(Compiler* compiler, const char* error_message){
     consume(compiler,TOKEN_IDENTIFIER, error_message);
 
     if(compiler->scope_depth == 0){
-        return identifier_constant(compiler,&compiler->parser->previous);    }
+        return module_variable(compiler,&compiler->parser->previous);
+    }
     declare_variable(compiler,&compiler->parser->previous);
 
     return 0;
 }
 
-static void define_variable(Compiler* compiler, uint8_t global){
+static void mark_initialized(Compiler* compiler){
+    if(compiler->scope_depth == 0) return;
+
+    compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
+}
+
+static void define_variable(Compiler* compiler, int global){
     if(compiler->scope_depth == 0){
-        emit_bytes(compiler,OP_DEFINE_MODULE,global);
+        forget_module_function(compiler->parser, global);
+        emit_byte(compiler,OP_DEFINE_MODULE);
+        emit_short(compiler,(uint16_t)global);
     }else{
-        compiler->locals[compiler->local_count - 1].depth = compiler->scope_depth;
+        mark_initialized(compiler);
     }
 }
 
@@ -358,89 +585,19 @@ static int argument_list(Compiler* compiler){
     return arg_count;
 }
 
-static void expression(Compiler* compiler){
-
-}
-static void parse_precedence(Compiler* compiler, Precedence precedence){
-
-}
-
-static void and_(Compiler* compiler, bool can_assign){
+static void and_(Compiler* compiler, Token previous_token, bool can_assign){
     int end_jump = emit_jump(compiler,OP_JUMP_IF_FALSE);
     emit_byte(compiler,OP_POP);
     parse_precedence(compiler,PREC_AND);
     patch_jump(compiler,end_jump);
 }
 
-static bool fold_binary(Compiler* compiler,TokenType operator_type){
-#define FOLD(operator) \
-    do{                \
-        Chunk* chunk = current_chunk(compiler); \
-        uint8_t index = chunk->code[chunk->count - 1]; \
-        uint8_t constant = chunk->code[chunk->count - 3]; \
-        if(chunk->code[chunk->count - 2] != OP_CONSTANT) return false; \
-        if(chunk->code[chunk->count - 4] != OP_CONSTANT) return false; \
-        chunk->constants.value[constant] = NUMBER_VAL(AS_NUMBER(chunk->constants.value[constant]) operator AS_NUMBER(chunk->constants.value[index]));\
-        chunk->constants.count--;               \
-        chunk->count -=2;                       \
-        return true;\
-    }while(false)
-
-#define FOLD_FUNC(func) \
-        do{             \
-            Chunk* chunk = current_chunk(compiler); \
-            uint8_t index = chunk->code[chunk->count - 1]; \
-            uint8_t constant = chunk->code[chunk->count - 3]; \
-            if(chunk->code[chunk->count-2] != OP_CONSTANT) return false; \
-            if(chunk->code[chunk->count - 4] != OP_CONSTANT) return false; \
-            chunk->constants.values[constant] = NUMBER_VAL(\
-            func(\
-                AS_NUMBER(chunk->constants.value[constant]),  \
-                AS_NUMBER(chunk->constants.value[index])                        \
-              )           \
-            );          \
-            chunk->constants.count--;               \
-            chunk->count -= 2;                      \
-            return true;\
-        }while(false)
-
-    switch (operator_type) {
-        case TOKEN_PLUS:{
-            FOLD(+);
-            return false;
-        }
-        case TOKEN_MINUS:{
-            FOLD(-);
-            return false;
-        }
-        case TOKEN_STAR:{
-            FOLD(*);
-            return false;
-        }
-        case TOKEN_SLASH:{
-            FOLD(/);
-            return false;
-        }
-        default: return false;
-    }
-#undef FOLD
-#undef FOLD_FUNC
-}
-
 static void binary(Compiler* compiler, Token previous_token, bool can_assign) {
     TokenType operator_type = compiler->parser->previous.type;
 
     ParserRule *rule = get_rule(operator_type);
     parse_precedence(compiler, (Precedence) (rule->precedence + 1));
 
-    TokenType current_token = compiler->parser->previous.type;
-
-    //constant fold optimization
-    if ((previous_token.type == TOKEN_NUM) && (current_token == TOKEN_NUM || current_token == TOKEN_LEFT_PAREN) &&
-        fold_binary(compiler, operator_type)) {
-        return;
-    }
-
     switch (operator_type) {
         case TOKEN_BANGEQ:
             emit_bytes(compiler, OP_EQUAL, OP_NOT);
@@ -481,6 +638,12 @@ static void binary(Compiler* compiler, Token previous_token, bool can_assign) {
         case TOKEN_PIPE:
             emit_byte(compiler, OP_BITWISE_OR);
             break;
+        case TOKEN_SHIFT_LEFT:
+            emit_byte(compiler, OP_LEFT_SHIFT);
+            break;
+        case TOKEN_SHIFT_RIGHT:
+            emit_byte(compiler, OP_RIGHT_SHIFT);
+            break;
         default:
             return;
             //TODO: add powers e,g 10^2 = 20
@@ -500,7 +663,1782 @@ static void ternary(Compiler *compiler, Token previous_token, bool can_assign){
     patch_jump(compiler,end_jump);
 }
 
+static bool inline_call(Compiler* compiler, int callee, int arg_count);
+
 static void call(Compiler* compiler, Token previous_token, bool can_assign){
+    Chunk* chunk = current_chunk(compiler);
+    int property = compiler->last_property;
+    int callee = compiler->last_module != -1 && compiler->last_module + 3 == chunk->count &&
+                 compiler->parser->vm->optimize_level > 0 ? compiler->last_module : -1;
+    bool wide = property != -1 && chunk->code[property] == OP_WIDE;
+    if(property != -1 && property + (wide ? 6 : 4) == chunk->count){
+        //a method called through a grouping, (a.b)(), is invoked without binding it
+        int name = wide ? (chunk->code[property + 2] << 8) | chunk->code[property + 3] : chunk->code[property + 1];
+        uint8_t cache_high = chunk->code[chunk->count - 2];
+        uint8_t cache_low = chunk->code[chunk->count - 1];
+        chunk->count = property;
+        compiler->last_property = -1;
+
+        int arg_count = argument_list(compiler);
+        emit_operand(compiler,OP_INVOKE,name);
+        emit_byte(compiler,arg_count);
+        emit_bytes(compiler,cache_high,cache_low);
+        return;
+    }
+
     int arg_count = argument_list(compiler);
-    emit_bytes(compiler,OP_CALL,arg_count);
+    if(callee != -1 && inline_call(compiler, callee, arg_count)) return;
+    compiler->last_call = current_chunk(compiler)->count;
+    emit_call(compiler, arg_count);
+}
+
+static void or_(Compiler* compiler, Token previous_token, bool can_assign){
+    int else_jump = emit_jump(compiler,OP_JUMP_IF_FALSE);
+    int end_jump = emit_jump(compiler,OP_JUMP);
+
+    patch_jump(compiler,else_jump);
+    emit_byte(compiler,OP_POP);
+
+    parse_precedence(compiler,PREC_OR);
+    patch_jump(compiler,end_jump);
+}
+
+static void grouping(Compiler* compiler, bool can_assign){
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after expression");
+}
+
+static void number(Compiler* compiler, bool can_assign){
+    Token* token = &compiler->parser->previous;
+    char buffer[64];
+    int length = 0;
+
+    //strip digit separators before handing the literal to strtod
+    for (int i = 0; i < token->length && length < (int)sizeof(buffer) - 1; i++) {
+        if(token->start[i] != '_') buffer[length++] = token->start[i];
+    }
+    buffer[length] = '\0';
+
+    emit_constant(compiler,narrow_number(strtod(buffer,NULL)));
+}
+
+static void string(Compiler* compiler, bool can_assign){
+    Parser* parser = compiler->parser;
+    emit_constant(compiler,OBJ_VAL(copy_string(parser->vm,parser->previous.start + 1,parser->previous.length - 2)));
+}
+
+static void literal(Compiler* compiler, bool can_assign){
+    switch (compiler->parser->previous.type) {
+        case TOKEN_FALSE: emit_byte(compiler,OP_FALSE); break;
+        case TOKEN_TRUE: emit_byte(compiler,OP_TRUE); break;
+        case TOKEN_NIL: emit_byte(compiler,OP_NIL); break;
+        default: return;
+    }
+}
+
+static bool compound_operator(Compiler* compiler, uint8_t* instruction){
+    if(match(compiler,TOKEN_PLUSEQ)){
+        *instruction = OP_ADD;
+    }else if(match(compiler,TOKEN_MINUSEQ)){
+        *instruction = OP_SUB;
+    }else if(match(compiler,TOKEN_STAREQ)){
+        *instruction = OP_MUL;
+    }else if(match(compiler,TOKEN_SLASHEQ)){
+        *instruction = OP_DIV;
+    }else{
+        return false;
+    }
+    return true;
+}
+
+//module and global variables are addressed by a 16-bit slot, locals and upvalues by a byte
+//or by a short behind WIDE
+static void emit_variable(Compiler* compiler, uint8_t instruction, int arg){
+    switch (instruction) {
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_MODULE:
+        case OP_SET_MODULE:
+            emit_byte(compiler,instruction);
+            emit_short(compiler,(uint16_t)arg);
+            break;
+        default:
+            emit_operand(compiler,instruction,arg);
+    }
+}
+
+//an upvalue assigned in a closure marks the local it was captured from, in
+//whichever function that is
+static void assign_upvalue(Compiler* compiler, int index){
+    UpValue* upvalue = &compiler->upvalues[index];
+    if(upvalue->is_local){
+        compiler->enclosing->locals[upvalue->index].assigned = true;
+    }else{
+        assign_upvalue(compiler->enclosing, upvalue->index);
+    }
+}
+
+static void mark_assigned(Compiler* compiler, uint8_t set_op, int arg){
+    switch (set_op) {
+        case OP_SET_LOCAL: compiler->locals[arg].assigned = true; break;
+        case OP_SET_UPVALUE: assign_upvalue(compiler, arg); break;
+        case OP_SET_MODULE: forget_module_function(compiler->parser, arg); break;
+    }
+}
+
+static void named_variable(Compiler* compiler, Token name, bool can_assign){
+    uint8_t get_op, set_op;
+    int arg = resolve_local(compiler,&name);
+
+    if(arg != -1){
+        get_op = OP_GET_LOCAL;
+        set_op = OP_SET_LOCAL;
+    }else if((arg = resolve_upvalue(compiler,&name)) != -1){
+        get_op = OP_GET_UPVALUE;
+        set_op = OP_SET_UPVALUE;
+    }else{
+        ObjString* string = copy_string(compiler->parser->vm,name.start,name.length);
+        Value slot;
+        if(table_get(&compiler->parser->vm->globals,string,&slot)){
+            arg = (int)AS_NUMBER(slot);
+            get_op = OP_GET_GLOBAL;
+            set_op = OP_SET_GLOBAL;
+            can_assign = false;
+        }else{
+            arg = module_variable(compiler,&name);
+            get_op = OP_GET_MODULE;
+            set_op = OP_SET_MODULE;
+        }
+    }
+
+    uint8_t instruction;
+    if(can_assign && match(compiler,TOKEN_EQUALS)){
+        mark_assigned(compiler, set_op, arg);
+        expression(compiler);
+        emit_variable(compiler,set_op,arg);
+    }else if(can_assign && compound_operator(compiler,&instruction)){
+        mark_assigned(compiler, set_op, arg);
+        emit_variable(compiler,get_op,arg);
+        expression(compiler);
+        emit_byte(compiler,instruction);
+        emit_variable(compiler,set_op,arg);
+    }else{
+        if(get_op == OP_GET_MODULE) compiler->last_module = current_chunk(compiler)->count;
+        emit_variable(compiler,get_op,arg);
+    }
+}
+
+static void variable(Compiler* compiler, bool can_assign){
+    named_variable(compiler,compiler->parser->previous,can_assign);
+}
+
+static Token synthetic_token(const char* text){
+    Token token;
+    token.start = text;
+    token.length = (int)strlen(text);
+    return token;
+}
+
+static void unary(Compiler* compiler, bool can_assign){
+    TokenType operator_type = compiler->parser->previous.type;
+
+    parse_precedence(compiler,PREC_UNARY);
+
+    switch (operator_type) {
+        case TOKEN_BANG: emit_byte(compiler,OP_NOT); break;
+        case TOKEN_MINUS: emit_byte(compiler,OP_NEGATE); break;
+        default: return;
+    }
+}
+
+//the value pushed by the code from start to end when it is one literal
+static bool single_literal(Chunk* chunk, int start, int end, Value* value){
+    uint8_t* code = chunk->code;
+    switch (code[start]) {
+        case OP_NIL: *value = NIL_VAL; return end - start == 1;
+        case OP_TRUE: *value = BOOL_VAL(true); return end - start == 1;
+        case OP_FALSE: *value = BOOL_VAL(false); return end - start == 1;
+        case OP_CONSTANT:
+            if(end - start != 2) return false;
+            *value = chunk->constants.value[code[start + 1]];
+            return true;
+        case OP_WIDE:
+            if(end - start != 4 || code[start + 1] != OP_CONSTANT) return false;
+            *value = chunk->constants.value[(code[start + 2] << 8) | code[start + 3]];
+            return true;
+        default:
+            return false;
+    }
+}
+
+//the value of an element compiled from start to the end of the chunk, when
+//it is a literal or a negated number literal
+static bool literal_element(Compiler* compiler, int start, Value* value){
+    Chunk* chunk = current_chunk(compiler);
+    if(single_literal(chunk, start, chunk->count, value)) return true;
+    if(chunk->count - start < 2 || chunk->code[chunk->count - 1] != OP_NEGATE) return false;
+    if(!single_literal(chunk, start, chunk->count - 1, value) || !IS_NUMBER(*value)) return false;
+    *value = narrow_number(-AS_NUMBER(*value));
+    return true;
+}
+
+//a literal made only of constants is built once into a template in the
+//constant table, COPY_LITERAL copies it in one go each time it runs
+static void emit_template(Compiler* compiler, int start, Value* values, int count, bool is_map){
+    Obj* template = is_map ? (Obj*)new_map(compiler->parser->vm) : (Obj*)new_list(compiler->parser->vm);
+    //in the constant table before filling it, so it is reachable if that collects
+    int constant = add_literal(compiler, OBJ_VAL(template));
+    for (int i = 0; i < count; i++) {
+        if(is_map){
+            map_set(compiler->parser->vm, (ObjMap*)template, values[i * 2], values[i * 2 + 1]);
+        }else{
+            write_valueArray(compiler->parser->vm, &((ObjList*)template)->values, values[i]);
+        }
+    }
+    current_chunk(compiler)->count = start;
+    emit_operand(compiler, OP_COPY_LITERAL, constant);
+}
+
+static void list(Compiler* compiler, bool can_assign){
+    int count = 0;
+    int start = current_chunk(compiler)->count;
+    Value values[UINT8_COUNT];
+    bool constant = true;
+
+    do{
+        if(check(compiler,TOKEN_RIGHT_BRACKET)) break;
+
+        int element = current_chunk(compiler)->count;
+        expression(compiler);
+        if(constant && count < UINT8_COUNT) constant = literal_element(compiler, element, &values[count]);
+        count++;
+
+        if(count > UINT8_MAX){
+            error(compiler->parser,"Cannot have more than 255 elements in a list literal");
+        }
+    }while (match(compiler,TOKEN_COMMA));
+
+    consume(compiler,TOKEN_RIGHT_BRACKET,"Expected ']' at end of list literal");
+    if(constant && count > 0 && count <= UINT8_MAX){
+        emit_template(compiler, start, values, count, false);
+        return;
+    }
+    emit_bytes(compiler,OP_NEW_LIST,count);
+}
+
+static void map(Compiler* compiler, bool can_assign){
+    int count = 0;
+    int start = current_chunk(compiler)->count;
+    Value values[UINT8_COUNT * 2];
+    bool constant = true;
+
+    do{
+        if(check(compiler,TOKEN_RIGHT_BRACE)) break;
+
+        int element = current_chunk(compiler)->count;
+        expression(compiler);
+        if(constant && count < UINT8_COUNT) constant = literal_element(compiler, element, &values[count * 2]);
+        consume(compiler,TOKEN_FULL_COLON,"Expected ':' after map key");
+        element = current_chunk(compiler)->count;
+        expression(compiler);
+        if(constant && count < UINT8_COUNT) constant = literal_element(compiler, element, &values[count * 2 + 1]);
+        count++;
+
+        if(count > UINT8_MAX){
+            error(compiler->parser,"Cannot have more than 255 entries in a map literal");
+        }
+    }while (match(compiler,TOKEN_COMMA));
+
+    consume(compiler,TOKEN_RIGHT_BRACE,"Expected '}' at end of map literal");
+    if(constant && count > 0 && count <= UINT8_MAX){
+        emit_template(compiler, start, values, count, true);
+        return;
+    }
+    emit_bytes(compiler,OP_NEW_MAP,count);
+}
+
+static void subscript(Compiler* compiler, Token previous_token, bool can_assign){
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_BRACKET,"Expected ']' after subscript");
+
+    uint8_t instruction;
+    if(can_assign && match(compiler,TOKEN_EQUALS)){
+        expression(compiler);
+        emit_byte(compiler,OP_SUBSCRIPT_ASSIGN);
+    }else if(can_assign && compound_operator(compiler,&instruction)){
+        emit_byte(compiler,OP_SUBSCRIPT_PUSH);
+        expression(compiler);
+        emit_byte(compiler,instruction);
+        emit_byte(compiler,OP_SUBSCRIPT_ASSIGN);
+    }else{
+        emit_byte(compiler,OP_SUBSCRIPT);
+    }
+}
+
+static void dot(Compiler* compiler, Token previous_token, bool can_assign){
+    consume(compiler,TOKEN_IDENTIFIER,"Expected property name after '.'");
+    int name = identifier_constant(compiler,&compiler->parser->previous);
+
+    if(can_assign && match(compiler,TOKEN_EQUALS)){
+        expression(compiler);
+        emit_operand(compiler,OP_SET_PROPERTY,name);
+        emit_cache(compiler);
+    }else if(match(compiler,TOKEN_LEFT_PAREN)){
+        int arg_count = argument_list(compiler);
+        emit_operand(compiler,OP_INVOKE,name);
+        emit_byte(compiler,arg_count);
+        emit_cache(compiler);
+    }else{
+        compiler->last_property = current_chunk(compiler)->count;
+        emit_operand(compiler,OP_GET_PROPERTY,name);
+        emit_cache(compiler);
+    }
+}
+
+static void this_(Compiler* compiler, bool can_assign){
+    if(compiler->class == NULL){
+        error(compiler->parser,"Cannot use 'this' outside of a class");
+        return;
+    }
+    variable(compiler,false);
+}
+
+static void super_(Compiler* compiler, bool can_assign){
+    if(compiler->class == NULL){
+        error(compiler->parser,"Cannot use 'super' outside of a class");
+    }else if(!compiler->class->has_super_class){
+        error(compiler->parser,"Cannot use 'super' in a class with no superclass");
+    }
+
+    consume(compiler,TOKEN_DOT,"Expected '.' after 'super'");
+    consume(compiler,TOKEN_IDENTIFIER,"Expected superclass method name");
+    int name = identifier_constant(compiler,&compiler->parser->previous);
+
+    named_variable(compiler,synthetic_token("this"),false);
+    if(match(compiler,TOKEN_LEFT_PAREN)){
+        int arg_count = argument_list(compiler);
+        named_variable(compiler,synthetic_token("super"),false);
+        emit_operand(compiler,OP_SUPER_INVOKE,name);
+        emit_byte(compiler,arg_count);
+    }else{
+        named_variable(compiler,synthetic_token("super"),false);
+        emit_operand(compiler,OP_GET_SUPER,name);
+    }
+}
+
+static ParserRule rules[] = {
+    [TOKEN_LEFT_PAREN]    = {grouping, call, PREC_CALL},
+    [TOKEN_LEFT_BRACKET]  = {list, subscript, PREC_CALL},
+    [TOKEN_LEFT_BRACE]    = {map, NULL, PREC_NONE},
+    [TOKEN_DOT]           = {NULL, dot, PREC_CALL},
+    [TOKEN_MINUS]         = {unary, binary, PREC_TERM},
+    [TOKEN_PLUS]          = {NULL, binary, PREC_TERM},
+    [TOKEN_SLASH]         = {NULL, binary, PREC_FACTOR},
+    [TOKEN_STAR]          = {NULL, binary, PREC_FACTOR},
+    [TOKEN_BANG]          = {unary, NULL, PREC_NONE},
+    [TOKEN_BANGEQ]        = {NULL, binary, PREC_EQUALITY},
+    [TOKEN_EQUALEQ]       = {NULL, binary, PREC_EQUALITY},
+    [TOKEN_GREATER]       = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_GREATEREQ]     = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESS]          = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_LESSEQ]        = {NULL, binary, PREC_COMPARISON},
+    [TOKEN_AMP]           = {NULL, binary, PREC_BITWISE_AND},
+    [TOKEN_CARET]         = {NULL, binary, PREC_BITWISE_XOR},
+    [TOKEN_PIPE]          = {NULL, binary, PREC_BITWISE_OR},
+    [TOKEN_SHIFT_LEFT]    = {NULL, binary, PREC_LEFT_SHIFT},
+    [TOKEN_SHIFT_RIGHT]   = {NULL, binary, PREC_RIGHT_SHIFT},
+    [TOKEN_AMPAMP]        = {NULL, and_, PREC_AND},
+    [TOKEN_PIPEPIPE]      = {NULL, or_, PREC_OR},
+    [TOKEN_IDENTIFIER]    = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING]        = {string, NULL, PREC_NONE},
+    [TOKEN_NUM]           = {number, NULL, PREC_NONE},
+    [TOKEN_TRUE]          = {literal, NULL, PREC_NONE},
+    [TOKEN_FALSE]         = {literal, NULL, PREC_NONE},
+    [TOKEN_NIL]           = {literal, NULL, PREC_NONE},
+    [TOKEN_THIS]          = {this_, NULL, PREC_NONE},
+    [TOKEN_SUPER]         = {super_, NULL, PREC_NONE},
+};
+
+static ParserRule* get_rule(TokenType type){
+    return &rules[type];
+}
+
+static void parse_precedence(Compiler* compiler, Precedence precedence){
+    Parser* parser = compiler->parser;
+    advance(parser);
+
+    ParsePrefixFn prefix_rule = get_rule(parser->previous.type)->prefix;
+    if(prefix_rule == NULL){
+        error(parser,"Expected expression");
+        return;
+    }
+
+    bool can_assign = precedence <= PREC_ASSIGNMENT;
+    prefix_rule(compiler,can_assign);
+
+    while (precedence <= get_rule(parser->current.type)->precedence){
+        Token token = parser->previous;
+        advance(parser);
+        ParseInfixFn infix_rule = get_rule(parser->previous.type)->infix;
+        infix_rule(compiler,token,can_assign);
+    }
+
+    if(can_assign && match(compiler,TOKEN_EQUALS)){
+        error(parser,"Invalid assignment target");
+    }
+}
+
+static void expression(Compiler* compiler){
+    parse_precedence(compiler,PREC_ASSIGNMENT);
+}
+
+static bool is_wide_jump(uint8_t instruction){
+    switch (instruction) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_BREAK:
+        case OP_FOR_ITER:
+        case OP_FOR_RANGE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_switch(uint8_t instruction){
+    return instruction == OP_TABLE_SWITCH || instruction == OP_HASH_SWITCH;
+}
+
+//entries of the TABLE_SWITCH or HASH_SWITCH at ip after its default one
+int switch_entry_count(uint8_t* code, int ip){
+    return (code[ip + 3] << 8) | code[ip + 4];
+}
+
+//where the switch at ip goes for entry, 0 being the default. An entry holds
+//the distance back to its arm, or 0 to carry on after the instruction
+int switch_target(uint8_t* code, int ip, int entry){
+    int distance = (code[ip + 5 + entry * 2] << 8) | code[ip + 6 + entry * 2];
+    if(distance == 0) return ip + 7 + switch_entry_count(code, ip) * 2;
+    return ip - distance;
+}
+
+int get_arg_count(uint8_t* code, ValueArray constants, int ip){
+    switch (code[ip]) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_EMPTY:
+        case OP_POP:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_NEGATE:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_BITWISE_AND:
+        case OP_BITWISE_OR:
+        case OP_BITWISE_XOR:
+        case OP_RIGHT_SHIFT:
+        case OP_LEFT_SHIFT:
+        case OP_NOT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_SUBSCRIPT:
+        case OP_SUBSCRIPT_ASSIGN:
+        case OP_SUBSCRIPT_PUSH:
+        case OP_CALL_0:
+        case OP_CALL_1:
+        case OP_CALL_2:
+        case OP_CALL_3:
+        case OP_ADD_NUM:
+        case OP_ADD_STR:
+        case OP_SUB_NUM:
+        case OP_MUL_NUM:
+        case OP_LESS_NUM:
+        case OP_GREATER_NUM:
+        case OP_SUBSCRIPT_LIST_NUM:
+            return 0;
+
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_INLINE_RETURN:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_NEW_LIST:
+        case OP_NEW_MAP:
+        case OP_COPY_LITERAL:
+        case OP_IMPORT:
+            return 1;
+
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_MODULE:
+        case OP_DEFINE_MODULE:
+        case OP_SET_MODULE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_LOOP:
+        case OP_BREAK:
+        case OP_SUPER_INVOKE:
+        case OP_IMPORT_BUILTIN:
+            return 2;
+
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 3;
+
+        case OP_INVOKE:
+        case OP_INLINE_GUARD:
+        case OP_FOR_ITER:
+        case OP_FOR_RANGE:
+            return 4;
+
+        //constant, entry count and default entry, then one short per entry
+        case OP_TABLE_SWITCH:
+        case OP_HASH_SWITCH:
+            return 6 + switch_entry_count(code, ip) * 2;
+
+        case OP_IMPORT_BUILTIN_VARIABLE:
+            return 3;
+
+        //superinstructions span the operands and opcodes of their whole sequence
+        case OP_SET_LOCAL_POP:
+            return 2;
+        case OP_GET_LOCAL_LOCAL_ADD:
+        case OP_GET_LOCAL_CONSTANT_ADD:
+        case OP_GET_LOCAL_CONSTANT_SUB:
+        case OP_CONSTANT_ADD_SET_LOCAL:
+            return 4;
+        case OP_GET_LOCAL_CONSTANT_LESS_JUMP:
+        case OP_GET_LOCAL_LOCAL_LESS_JUMP:
+            return 7;
+
+        case OP_REG_ENTER:
+        case OP_REG_LOAD_NIL:
+        case OP_REG_LOAD_TRUE:
+        case OP_REG_LOAD_FALSE:
+        case OP_REG_RETURN:
+            return 1;
+        case OP_REG_MOVE:
+        case OP_REG_LOAD_CONSTANT:
+        case OP_REG_NOT:
+        case OP_REG_NEGATE:
+        case OP_REG_CALL:
+        case OP_REG_TAIL_CALL:
+            return 2;
+        case OP_REG_GET_GLOBAL:
+        case OP_REG_GET_MODULE:
+        case OP_REG_EQUAL:
+        case OP_REG_GREATER:
+        case OP_REG_LESS:
+        case OP_REG_ADD:
+        case OP_REG_SUB:
+        case OP_REG_MUL:
+        case OP_REG_DIV:
+        case OP_REG_ADD_CONSTANT:
+        case OP_REG_SUB_CONSTANT:
+        case OP_REG_JUMP_IF_FALSE:
+        case OP_REG_JUMP_IF_TRUE:
+            return 3;
+        case OP_REG_LESS_JUMP:
+        case OP_REG_LESS_CONSTANT_JUMP:
+        case OP_REG_INLINE_GUARD:
+            return 4;
+
+        //the wrapped opcode plus a short operand, or a 24 bit offset for jumps
+        case OP_WIDE:
+            if(code[ip + 1] == OP_CLOSURE){
+                ObjFun* function = AS_FUNC(constants.value[(code[ip + 2] << 8) | code[ip + 3]]);
+                return 3 + (function->upvalue_count * 3);
+            }
+            //a loop over a sequence keeps its short slot after the offset
+            if(code[ip + 1] == OP_FOR_ITER || code[ip + 1] == OP_FOR_RANGE) return 6;
+            //named instructions keep their other operands after the name
+            if(code[ip + 1] == OP_GET_PROPERTY || code[ip + 1] == OP_SET_PROPERTY) return 5;
+            if(code[ip + 1] == OP_INVOKE) return 6;
+            if(code[ip + 1] == OP_SUPER_INVOKE) return 4;
+            return 1 + (is_wide_jump(code[ip + 1]) ? 3 : 2);
+
+        case OP_CLOSURE:{
+            int constant = code[ip + 1];
+            ObjFun* function = AS_FUNC(constants.value[constant]);
+            //function constant plus an (is_local, index short) triple per upvalue
+            return 1 + (function->upvalue_count * 3);
+        }
+    }
+    return 0;
+}
+
+//values an instruction leaves on the stack minus the ones it takes off
+int stack_effect(uint8_t* code, int ip){
+    switch (code[ip]) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_GET_MODULE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+        case OP_SUBSCRIPT_PUSH:
+        case OP_IMPORT:
+        case OP_IMPORT_BUILTIN:
+        case OP_IMPORT_BUILTIN_VARIABLE:
+        case OP_EMPTY:
+        case OP_COPY_LITERAL:
+            return 1;
+
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_MODULE:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_GREATER_EQUAL:
+        case OP_LESS_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_BITWISE_AND:
+        case OP_BITWISE_OR:
+        case OP_BITWISE_XOR:
+        case OP_RIGHT_SHIFT:
+        case OP_LEFT_SHIFT:
+        case OP_CLOSE_UPVALUE:
+        case OP_INHERIT:
+        case OP_METHOD:
+        case OP_SUBSCRIPT:
+        case OP_TABLE_SWITCH:
+        case OP_HASH_SWITCH:
+            return -1;
+
+        case OP_SUBSCRIPT_ASSIGN:
+            return -2;
+
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return -code[ip + 1];
+        case OP_CALL_0:
+        case OP_CALL_1:
+        case OP_CALL_2:
+        case OP_CALL_3:
+            return -(code[ip] - OP_CALL_0);
+        case OP_INVOKE:
+            return -code[ip + 2];
+        case OP_INLINE_RETURN:
+            return -code[ip + 1] - 1;
+        case OP_SUPER_INVOKE:
+            return -code[ip + 2] - 1;
+        case OP_NEW_LIST:
+            return 1 - code[ip + 1];
+        case OP_NEW_MAP:
+            return 1 - code[ip + 1] * 2;
+        case OP_WIDE:
+            //the argument count sits one byte further on behind a wide name
+            if(code[ip + 1] == OP_INVOKE) return -code[ip + 4];
+            if(code[ip + 1] == OP_SUPER_INVOKE) return -code[ip + 4] - 1;
+            return stack_effect(code, ip + 1);
+    }
+    return 0;
+}
+
+// Stack depth above the arguments before each instruction, -1 where nothing
+// reaches. Follows jumps since a for loop's increment clause is only reached
+// by a backward LOOP. Jumps not patched yet point past the end and are
+// skipped.
+static int* stack_depths(Chunk* chunk){
+    int* depths = malloc(sizeof(int) * (chunk->count + 1));
+    int* worklist = malloc(sizeof(int) * (chunk->count + 1));
+    if(depths == NULL || worklist == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+    for (int i = 0; i <= chunk->count; i++) depths[i] = -1;
+
+    int count = 0;
+    depths[0] = 0;
+    worklist[count++] = 0;
+
+    while (count > 0) {
+        int offset = worklist[--count];
+        if(offset >= chunk->count) continue;
+        uint8_t instruction = chunk->code[offset];
+        int depth = depths[offset] + stack_effect(chunk->code, offset);
+        int next = offset + 1 + get_arg_count(chunk->code, chunk->constants, offset);
+
+        //a switch goes on to its entries, the default one is the end when it has no arm
+        if(is_switch(instruction)){
+            for (int entry = 0; entry <= switch_entry_count(chunk->code, offset); entry++) {
+                int successor = switch_target(chunk->code, offset, entry);
+                if(successor >= 0 && depths[successor] == -1){
+                    depths[successor] = depth;
+                    worklist[count++] = successor;
+                }
+            }
+            continue;
+        }
+        int target = -1;
+        bool falls_through = true;
+
+        //offsets count from the end of the jump's operand, 3 bytes behind WIDE
+        int jump = 0;
+        int operand_end = offset + 3;
+        if(instruction == OP_WIDE && is_wide_jump(chunk->code[offset + 1])){
+            instruction = chunk->code[offset + 1];
+            jump = (chunk->code[offset + 2] << 16) | (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+            operand_end = offset + 5;
+        }else if(next - offset >= 3){
+            jump = (uint16_t)((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]);
+        }
+
+        switch (instruction) {
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+                target = next + jump;
+                break;
+            case OP_INLINE_GUARD:
+            case OP_FOR_ITER:
+            case OP_FOR_RANGE:
+                target = operand_end + jump;
+                break;
+            case OP_JUMP:
+            case OP_BREAK:
+                target = next + jump;
+                falls_through = false;
+                break;
+            case OP_LOOP:
+                target = next - jump;
+                falls_through = false;
+                break;
+            case OP_RETURN:
+                falls_through = false;
+                break;
+        }
+
+        int successors[2] = {falls_through ? next : -1, target};
+        for (int i = 0; i < 2; i++) {
+            int successor = successors[i];
+            if(successor < 0 || successor > chunk->count) continue;
+            if(depths[successor] == -1){
+                depths[successor] = depth;
+                worklist[count++] = successor;
+            }
+        }
+    }
+
+    free(worklist);
+    return depths;
+}
+
+// Deepest the stack gets above the arguments. Runs before fusion so only the
+// plain instruction set shows up.
+static int max_stack(Compiler* compiler){
+    Chunk* chunk = current_chunk(compiler);
+    int* depths = stack_depths(chunk);
+
+    int max = 0;
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(depths[i] == -1) continue;
+        int depth = depths[i] + stack_effect(chunk->code, i);
+        if(depth > max) max = depth;
+    }
+
+    free(depths);
+    return max;
+}
+
+typedef struct{
+    uint8_t fused;
+    int length;
+    uint8_t sequence[4];
+}Superinstruction;
+
+//longest sequences first so they win over their prefixes
+static const Superinstruction superinstructions[] = {
+    {OP_GET_LOCAL_CONSTANT_LESS_JUMP, 4, {OP_GET_LOCAL, OP_CONSTANT, OP_LESS, OP_JUMP_IF_FALSE}},
+    {OP_GET_LOCAL_LOCAL_LESS_JUMP, 4, {OP_GET_LOCAL, OP_GET_LOCAL, OP_LESS, OP_JUMP_IF_FALSE}},
+    {OP_GET_LOCAL_LOCAL_ADD, 3, {OP_GET_LOCAL, OP_GET_LOCAL, OP_ADD}},
+    {OP_GET_LOCAL_CONSTANT_ADD, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_ADD}},
+    {OP_GET_LOCAL_CONSTANT_SUB, 3, {OP_GET_LOCAL, OP_CONSTANT, OP_SUB}},
+    {OP_CONSTANT_ADD_SET_LOCAL, 3, {OP_CONSTANT, OP_ADD, OP_SET_LOCAL}},
+    {OP_SET_LOCAL_POP, 2, {OP_SET_LOCAL, OP_POP}},
+};
+
+static bool match_superinstruction(Chunk* chunk, int offset, const Superinstruction* superinstruction){
+    for (int i = 0; i < superinstruction->length; i++){
+        if(offset >= chunk->count || chunk->code[offset] != superinstruction->sequence[i]) return false;
+        offset += 1 + get_arg_count(chunk->code,chunk->constants,offset);
+    }
+    return offset <= chunk->count;
+}
+
+// Rewrites the first opcode of every matched sequence into its
+// superinstruction. Nothing moves, so jump offsets stay valid and a jump
+// into the middle of a sequence still runs the original instructions.
+static void fuse_superinstructions(Compiler* compiler){
+    Chunk* chunk = current_chunk(compiler);
+    int count = sizeof(superinstructions) / sizeof(superinstructions[0]);
+
+    int i = 0;
+    while (i < chunk->count){
+        for (int s = 0; s < count; s++){
+            if(match_superinstruction(chunk, i, &superinstructions[s])){
+                chunk->code[i] = superinstructions[s].fused;
+                compiler->parser->vm->fusion_counts[superinstructions[s].fused]++;
+                break;
+            }
+        }
+        i += 1 + get_arg_count(chunk->code,chunk->constants,i);
+    }
+}
+
+//bytes of callee code a call site takes in at most
+#define INLINE_LIMIT 32
+
+//the opcode a superinstruction was fused from, the callee's code is finished
+static uint8_t unfused(uint8_t instruction){
+    int count = sizeof(superinstructions) / sizeof(superinstructions[0]);
+    for (int s = 0; s < count; s++){
+        if(superinstructions[s].fused == instruction) return superinstructions[s].sequence[0];
+    }
+    return instruction;
+}
+
+//where the callee's RETURN is, -1 unless the code runs straight to it without
+//closures, upvalues or reads of its own slot, and its locals still fit in a
+//byte once moved up to base
+static int inline_length(ObjFun* function, int slot, int base){
+    Chunk* chunk = &function->chunk;
+    int offset = 0;
+    while (offset < chunk->count && offset <= INLINE_LIMIT) {
+        uint8_t instruction = unfused(chunk->code[offset]);
+        switch (instruction) {
+            case OP_RETURN:
+                return offset;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                if(chunk->code[offset + 1] == 0 || base + chunk->code[offset + 1] > UINT8_MAX) return -1;
+                break;
+            case OP_GET_MODULE:
+            case OP_SET_MODULE:
+                if(((chunk->code[offset + 1] << 8) | chunk->code[offset + 2]) == slot) return -1;
+                break;
+            case OP_CONSTANT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_POP:
+            case OP_GET_GLOBAL:
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_GREATER_EQUAL:
+            case OP_LESS_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_BITWISE_AND:
+            case OP_BITWISE_OR:
+            case OP_BITWISE_XOR:
+            case OP_LEFT_SHIFT:
+            case OP_RIGHT_SHIFT:
+            case OP_NOT:
+            case OP_NEGATE:
+            case OP_CALL:
+            case OP_CALL_0:
+            case OP_CALL_1:
+            case OP_CALL_2:
+            case OP_CALL_3:
+            case OP_TAIL_CALL:
+            case OP_INVOKE:
+            case OP_NEW_LIST:
+            case OP_NEW_MAP:
+            case OP_COPY_LITERAL:
+            case OP_SUBSCRIPT:
+            case OP_SUBSCRIPT_ASSIGN:
+                break;
+            default:
+                return -1;
+        }
+        offset += 1 + get_arg_count(&instruction, chunk->constants, 0);
+    }
+    return -1;
+}
+
+// A call to a module function compiled earlier in the source takes a copy of
+// the callee's body, with its frame slots moved up to where the callee sits
+// on the stack:
+//
+//   GET_MODULE f, arguments, INLINE_GUARD body, CALL, JUMP end,
+//   body: ..., INLINE_RETURN, end:
+//
+// The slot can be assigned later on, then the guard fails and the call runs
+// normally. Returns false to leave the call to the caller.
+static bool inline_call(Compiler* compiler, int callee, int arg_count){
+    Chunk* chunk = current_chunk(compiler);
+    int slot = (chunk->code[callee + 1] << 8) | chunk->code[callee + 2];
+    ObjFun* function = find_module_function(compiler->parser, slot);
+    if(function == NULL || compiler->long_jumps || chunk->count > UINT16_MAX) return false;
+
+    Chunk* body = &function->chunk;
+    if(function->arity != arg_count || function->upvalue_count != 0) return false;
+    if(chunk->constants.count + body->constants.count + 1 > UINT8_COUNT) return false;
+
+    int* depths = stack_depths(chunk);
+    int base = depths[callee] == -1 ? -1 : compiler->function->arity + 1 + depths[callee];
+    free(depths);
+    if(base == -1) return false;
+    int length = inline_length(function, slot, base);
+    if(length == -1) return false;
+
+    int guard = emit_jump(compiler, OP_INLINE_GUARD);
+    emit_bytes(compiler, make_constant(compiler, OBJ_VAL(function)), (uint8_t)arg_count);
+    emit_call(compiler, arg_count);
+    int end = emit_jump(compiler, OP_JUMP);
+    patch_jump(compiler, guard);
+
+    //values above the callee, the arguments to begin with
+    int depth = arg_count;
+    int offset = 0;
+    while (offset < length) {
+        uint8_t instruction[5];
+        instruction[0] = unfused(body->code[offset]);
+        int size = 1 + get_arg_count(instruction, body->constants, 0);
+        memcpy(&instruction[1], &body->code[offset + 1], size - 1);
+        depth += stack_effect(instruction, 0);
+
+        switch (instruction[0]) {
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+                emit_operand(compiler, instruction[0], base + instruction[1]);
+                break;
+            case OP_CONSTANT:
+                emit_constant(compiler, body->constants.value[instruction[1]]);
+                break;
+            case OP_COPY_LITERAL:
+                emit_operand(compiler, OP_COPY_LITERAL, add_literal(compiler, body->constants.value[instruction[1]]));
+                break;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+                emit_bytes(compiler, instruction[0], make_constant(compiler, body->constants.value[instruction[1]]));
+                emit_cache(compiler);
+                break;
+            case OP_INVOKE:
+                emit_bytes(compiler, OP_INVOKE, make_constant(compiler, body->constants.value[instruction[1]]));
+                emit_byte(compiler, instruction[2]);
+                emit_cache(compiler);
+                break;
+            case OP_TAIL_CALL:
+                //the body doesn't return, the call's frame can't be reused
+                emit_call(compiler, instruction[1]);
+                break;
+            default:
+                for (int i = 0; i < size; i++) emit_byte(compiler, instruction[i]);
+                break;
+        }
+        offset += size;
+    }
+    emit_bytes(compiler, OP_INLINE_RETURN, (uint8_t)(depth - 1));
+    patch_jump(compiler, end);
+    return true;
+}
+
+static void end_loop(Compiler* compiler){
+    Chunk* chunk = current_chunk(compiler);
+
+    if(compiler->loop->end != -1){
+        patch_jump(compiler,compiler->loop->end);
+        emit_byte(compiler,OP_POP);
+    }
+
+    int i = compiler->loop->body;
+    while (i < chunk->count){
+        if(chunk->code[i] == OP_BREAK){
+            chunk->code[i] = OP_JUMP;
+            patch_jump(compiler,i + 1);
+            i += 3;
+        }else if(chunk->code[i] == OP_WIDE && chunk->code[i + 1] == OP_BREAK){
+            chunk->code[i + 1] = OP_JUMP;
+            patch_jump(compiler,i + 2);
+            i += 5;
+        }else{
+            i += 1 + get_arg_count(chunk->code,chunk->constants,i);
+        }
+    }
+
+    compiler->loop = compiler->loop->enclosing;
+}
+
+static void discard_loop_locals(Compiler* compiler, Loop* loop){
+    for (int i = compiler->local_count - 1; i >= 0 && compiler->locals[i].depth > loop->scope_depth; i--) {
+        if(compiler->locals[i].is_captured){
+            emit_byte(compiler,OP_CLOSE_UPVALUE);
+        }else{
+            emit_byte(compiler,OP_POP);
+        }
+    }
+}
+
+static void block(Compiler* compiler){
+    while (!check(compiler,TOKEN_RIGHT_BRACE) && !check(compiler,TOKEN_EOF)){
+        declaration(compiler);
+    }
+    consume(compiler,TOKEN_RIGHT_BRACE,"Expected '}' after block");
+}
+
+//parameters and body of a function
+static void compile_function(Compiler* fn_compiler){
+    begin_scope(fn_compiler);
+
+    consume(fn_compiler,TOKEN_LEFT_PAREN,"Expected '(' after function name");
+    if(!check(fn_compiler,TOKEN_RIGHT_PAREN)){
+        do{
+            fn_compiler->function->arity++;
+            if(fn_compiler->function->arity > 255){
+                error_at_current(fn_compiler->parser,"Cannot have more than 255 parameters");
+            }
+
+            int param = parse_variable(fn_compiler,"Expected parameter name");
+            define_variable(fn_compiler,param);
+        }while (match(fn_compiler,TOKEN_COMMA));
+    }
+    consume(fn_compiler,TOKEN_RIGHT_PAREN,"Expected ')' after parameters");
+
+    consume(fn_compiler,TOKEN_LEFT_BRACE,"Expected '{' before function body");
+    block(fn_compiler);
+}
+
+//where the scanner was when a function started, to compile it again with long jumps
+typedef struct{
+    Scanner scanner;
+    Token current;
+    Token previous;
+}ParserState;
+
+static ParserState save_parser(Parser* parser){
+    ParserState state;
+    state.scanner = parser->scanner;
+    state.current = parser->current;
+    state.previous = parser->previous;
+    return state;
+}
+
+static void restore_parser(Parser* parser, ParserState* state){
+    parser->scanner = state->scanner;
+    parser->current = state->current;
+    parser->previous = state->previous;
+}
+
+//true if the function has to be compiled again with long jumps. Drops the
+//code of the first attempt, the function object is left to the GC
+static bool retry_long_jumps(Compiler* compiler){
+    if(!compiler->jump_overflow || compiler->long_jumps) return false;
+    if(compiler->parser->hasError){
+        error(compiler->parser, "Too much code to jump over");
+        return false;
+    }
+    free_chunk(compiler->parser->vm, current_chunk(compiler));
+    compiler->parser->vm->compiler = compiler->enclosing;
+    return true;
+}
+
+static ObjFun* function(Compiler* compiler, FunctionType type){
+    ParserState state = save_parser(compiler->parser);
+    Compiler fn_compiler;
+    init_compiler(compiler->parser,&fn_compiler,compiler,type);
+    compile_function(&fn_compiler);
+
+    if(retry_long_jumps(&fn_compiler)){
+        restore_parser(compiler->parser, &state);
+        init_compiler(compiler->parser,&fn_compiler,compiler,type);
+        fn_compiler.long_jumps = true;
+        compile_function(&fn_compiler);
+    }
+
+    return end_compiler(&fn_compiler);
+}
+
+static void method(Compiler* compiler){
+    consume(compiler,TOKEN_IDENTIFIER,"Expected method name");
+    Token* name = &compiler->parser->previous;
+    int constant = identifier_constant(compiler,name);
+    //the name gets its vtable index while compiling, METHOD only stores into it.
+    //The constant is 0 when the chunk ran out of them, so the name is looked up again
+    symbol_id(compiler->parser->vm, copy_string(compiler->parser->vm, name->start, name->length));
+
+    FunctionType type = TYPE_METHOD;
+    if(compiler->parser->previous.length == 4 && memcmp(compiler->parser->previous.start,"init",4) == 0){
+        type = TYPE_INITIALIZER;
+    }
+
+    function(compiler,type);
+    emit_operand(compiler,OP_METHOD,constant);
+}
+
+static void class_declaration(Compiler* compiler){
+    int global = parse_variable(compiler,"Expected class name");
+    Token class_name = compiler->parser->previous;
+    int name_constant = identifier_constant(compiler,&class_name);
+
+    emit_operand(compiler,OP_CLASS,name_constant);
+    define_variable(compiler,global);
+
+    ClassCompiler class_compiler;
+    class_compiler.name = class_name;
+    class_compiler.has_super_class = false;
+    class_compiler.enclosing = compiler->class;
+    compiler->class = &class_compiler;
+
+    if(match(compiler,TOKEN_LESS)){
+        consume(compiler,TOKEN_IDENTIFIER,"Expected superclass name");
+        variable(compiler,false);
+
+        if(identifiers_equal(&class_name,&compiler->parser->previous)){
+            error(compiler->parser,"A class cannot inherit from itself");
+        }
+
+        begin_scope(compiler);
+        add_local(compiler,synthetic_token("super"));
+        define_variable(compiler,0);
+
+        named_variable(compiler,class_name,false);
+        emit_byte(compiler,OP_INHERIT);
+        class_compiler.has_super_class = true;
+    }
+
+    named_variable(compiler,class_name,false);
+    consume(compiler,TOKEN_LEFT_BRACE,"Expected '{' before class body");
+    while (!check(compiler,TOKEN_RIGHT_BRACE) && !check(compiler,TOKEN_EOF)){
+        method(compiler);
+    }
+    consume(compiler,TOKEN_RIGHT_BRACE,"Expected '}' after class body");
+    emit_byte(compiler,OP_POP);
+
+    if(class_compiler.has_super_class){
+        end_scope(compiler);
+    }
+
+    compiler->class = compiler->class->enclosing;
+}
+
+static void func_declaration(Compiler* compiler){
+    int global = parse_variable(compiler,"Expected function name");
+    mark_initialized(compiler);
+    ObjFun* compiled = function(compiler,TYPE_FUNCTION);
+    define_variable(compiler,global);
+    if(compiler->scope_depth == 0) remember_module_function(compiler->parser, global, compiled);
+}
+
+static void var_declaration(Compiler* compiler){
+    int global = parse_variable(compiler,"Expected variable name");
+    int start = current_chunk(compiler)->count;
+
+    if(match(compiler,TOKEN_EQUALS)){
+        expression(compiler);
+    }else{
+        emit_byte(compiler,OP_NIL);
+    }
+    consume(compiler,TOKEN_SEMICOLON,"Expected ';' after variable declaration");
+
+    if(compiler->scope_depth > 0 && compiler->local_count > 0){
+        compiler->locals[compiler->local_count - 1].init_start = start;
+        compiler->locals[compiler->local_count - 1].init_end = current_chunk(compiler)->count;
+    }
+
+    define_variable(compiler,global);
+}
+
+static void expression_statement(Compiler* compiler){
+    expression(compiler);
+    consume(compiler,TOKEN_SEMICOLON,"Expected ';' after expression");
+    emit_byte(compiler,OP_POP);
+}
+
+static void if_statement(Compiler* compiler){
+    consume(compiler,TOKEN_LEFT_PAREN,"Expected '(' after 'if'");
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after condition");
+
+    int then_jump = emit_jump(compiler,OP_JUMP_IF_FALSE);
+    emit_byte(compiler,OP_POP);
+    statement(compiler);
+
+    int else_jump = emit_jump(compiler,OP_JUMP);
+    patch_jump(compiler,then_jump);
+    emit_byte(compiler,OP_POP);
+
+    if(match(compiler,TOKEN_ELSE)) statement(compiler);
+    patch_jump(compiler,else_jump);
+}
+
+static void while_statement(Compiler* compiler){
+    Loop loop;
+    loop.start = current_chunk(compiler)->count;
+    loop.scope_depth = compiler->scope_depth;
+    loop.enclosing = compiler->loop;
+    loop.is_switch = false;
+    compiler->loop = &loop;
+
+    consume(compiler,TOKEN_LEFT_PAREN,"Expected '(' after 'while'");
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after condition");
+
+    loop.end = emit_jump(compiler,OP_JUMP_IF_FALSE);
+    emit_byte(compiler,OP_POP);
+    loop.body = current_chunk(compiler)->count;
+    statement(compiler);
+
+    emit_loop(compiler,loop.start);
+    end_loop(compiler);
+}
+
+//a local the compiler keeps for itself, initialized from the top of the stack
+static int add_hidden_local(Compiler* compiler, const char* name){
+    add_local(compiler, synthetic_token(name));
+    mark_initialized(compiler);
+    return compiler->local_count - 1;
+}
+
+//whether the bounds of range( ... ) start with a start bound, looking ahead
+//for a comma outside any brackets
+static bool range_has_start(Parser* parser){
+    ParserState state = save_parser(parser);
+    int depth = 0;
+    bool comma = false;
+    while (parser->current.type != TOKEN_EOF) {
+        TokenType type = parser->current.type;
+        if(type == TOKEN_LEFT_PAREN || type == TOKEN_LEFT_BRACKET || type == TOKEN_LEFT_BRACE){
+            depth++;
+        }else if(type == TOKEN_RIGHT_PAREN || type == TOKEN_RIGHT_BRACKET || type == TOKEN_RIGHT_BRACE){
+            if(depth-- == 0) break;
+        }else if(type == TOKEN_COMMA && depth == 0){
+            comma = true;
+            break;
+        }
+        advance(parser);
+    }
+    restore_parser(parser, &state);
+    return comma;
+}
+
+//whether the script declared range itself, as a local, an upvalue or a
+//module variable, so range(...) after 'in' is a plain call
+static bool range_declared(Compiler* compiler, Token* name){
+    if(resolve_local(compiler, name) != -1 || resolve_upvalue(compiler, name) != -1) return true;
+
+    ObjString* string = copy_string(compiler->parser->vm, name->start, name->length);
+    Value slot;
+    return table_get(&compiler->parser->vm->globals, string, &slot) || table_get(&compiler->parser->module->slots, string, &slot);
+}
+
+//the sequence of a for-in loop is range(end) or range(start, end), pushed as
+//the next number and the end. Anything else after 'in', a variable called
+//range included, is left for expression()
+static bool range_header(Compiler* compiler){
+    Token* token = &compiler->parser->current;
+    if(token->type != TOKEN_IDENTIFIER || token->length != 5 || memcmp(token->start, "range", 5) != 0) return false;
+    if(range_declared(compiler, token)) return false;
+
+    ParserState state = save_parser(compiler->parser);
+    advance(compiler->parser);
+    if(!match(compiler,TOKEN_LEFT_PAREN)){
+        restore_parser(compiler->parser, &state);
+        return false;
+    }
+
+    if(range_has_start(compiler->parser)){
+        expression(compiler);
+        consume(compiler,TOKEN_COMMA,"Expected ',' after range start");
+    }else{
+        emit_constant(compiler, INT_VAL(0));
+    }
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after range bounds");
+    return true;
+}
+
+// for (var name in sequence) statement. The sequence and a cursor into it
+// live in two hidden locals below the loop variable. FOR_ITER (FOR_RANGE for
+// a range, which keeps the next number and the end instead) stores the next
+// element in the loop variable or jumps out once there are none, so no
+// iterator object is allocated.
+static void for_in_statement(Compiler* compiler, Token name){
+    uint8_t instruction = OP_FOR_RANGE;
+    if(!range_header(compiler)){
+        instruction = OP_FOR_ITER;
+        expression(compiler);
+        emit_constant(compiler, INT_VAL(0));
+    }
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after for-in sequence");
+
+    int iterator = add_hidden_local(compiler, "for sequence");
+    add_hidden_local(compiler, "for cursor");
+    emit_byte(compiler,OP_NIL);
+    declare_variable(compiler, &name);
+    mark_initialized(compiler);
+    //written by the loop instruction on every pass, so captures share it
+    compiler->locals[compiler->local_count - 1].assigned = true;
+
+    Loop loop;
+    loop.start = current_chunk(compiler)->count;
+    loop.scope_depth = compiler->scope_depth;
+    loop.enclosing = compiler->loop;
+    loop.is_switch = false;
+    loop.end = -1;
+    compiler->loop = &loop;
+
+    int exit = emit_jump(compiler, instruction);
+    emit_short(compiler, (uint16_t)iterator);
+
+    loop.body = current_chunk(compiler)->count;
+    statement(compiler);
+    emit_loop(compiler,loop.start);
+
+    patch_jump(compiler,exit);
+    end_loop(compiler);
+}
+
+static void for_statement(Compiler* compiler){
+    begin_scope(compiler);
+    consume(compiler,TOKEN_LEFT_PAREN,"Expected '(' after 'for'");
+
+    if(match(compiler,TOKEN_SEMICOLON)){
+        //no initializer
+    }else if(match(compiler,TOKEN_VAR)){
+        ParserState state = save_parser(compiler->parser);
+        consume(compiler,TOKEN_IDENTIFIER,"Expected variable name");
+        if(match(compiler,TOKEN_IN)){
+            for_in_statement(compiler, state.current);
+            end_scope(compiler);
+            return;
+        }
+        restore_parser(compiler->parser, &state);
+        var_declaration(compiler);
+    }else{
+        expression_statement(compiler);
+    }
+
+    Loop loop;
+    loop.start = current_chunk(compiler)->count;
+    loop.scope_depth = compiler->scope_depth;
+    loop.enclosing = compiler->loop;
+    loop.is_switch = false;
+    compiler->loop = &loop;
+
+    loop.end = -1;
+    if(!match(compiler,TOKEN_SEMICOLON)){
+        expression(compiler);
+        consume(compiler,TOKEN_SEMICOLON,"Expected ';' after loop condition");
+
+        loop.end = emit_jump(compiler,OP_JUMP_IF_FALSE);
+        emit_byte(compiler,OP_POP);
+    }
+
+    if(!match(compiler,TOKEN_RIGHT_PAREN)){
+        int body_jump = emit_jump(compiler,OP_JUMP);
+
+        int increment_start = current_chunk(compiler)->count;
+        expression(compiler);
+        emit_byte(compiler,OP_POP);
+        consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after for clauses");
+
+        emit_loop(compiler,loop.start);
+        loop.start = increment_start;
+        patch_jump(compiler,body_jump);
+    }
+
+    loop.body = current_chunk(compiler)->count;
+    statement(compiler);
+
+    emit_loop(compiler,loop.start);
+    end_loop(compiler);
+    end_scope(compiler);
+}
+
+//a case label and the arm it picks, arms are numbered in source order
+typedef struct{
+    Value value;
+    int arm;
+}SwitchCase;
+
+typedef struct{
+    int start;
+    //operand of the JUMP to the end of the switch
+    int exit;
+}SwitchArm;
+
+typedef struct{
+    SwitchCase* cases;
+    int case_count;
+    int case_capacity;
+    SwitchArm* arms;
+    int arm_count;
+    int arm_capacity;
+    int default_arm;
+}Switch;
+
+//keeps the short entries of the dispatch instruction in reach of the arms
+#define SWITCH_CASES_MAX 4096
+
+static void add_case(Compiler* compiler, Switch* table, Value value){
+    for (int i = 0; i < table->case_count; i++) {
+        if(values_equal(table->cases[i].value, value)){
+            error(compiler->parser,"Duplicate case label");
+            return;
+        }
+    }
+    if(table->case_count == SWITCH_CASES_MAX){
+        error(compiler->parser,"Too many cases in one switch");
+        return;
+    }
+    if(table->case_capacity < table->case_count + 1){
+        int old_capacity = table->case_capacity;
+        table->case_capacity = GROW_CAPACITY(old_capacity);
+        table->cases = GROW_TRANSIENT(compiler->parser, SwitchCase, table->cases, old_capacity, table->case_capacity);
+    }
+    table->cases[table->case_count].value = value;
+    table->cases[table->case_count].arm = table->arm_count;
+    table->case_count++;
+}
+
+//case a, b: or default: and the statements up to the next one. An arm is a
+//scope of its own and jumps to the end of the switch when it is done, there
+//is no falling into the next one
+static void switch_arm(Compiler* compiler, Switch* table){
+    if(match(compiler,TOKEN_DEFAULT)){
+        if(table->default_arm != -1) error(compiler->parser,"Cannot have more than one default in a switch");
+        table->default_arm = table->arm_count;
+    }else{
+        consume(compiler,TOKEN_CASE,"Expected 'case' or 'default' in switch");
+        do{
+            //compiled to read the value back, the code is dropped again
+            int start = current_chunk(compiler)->count;
+            expression(compiler);
+            Value value;
+            if(literal_element(compiler, start, &value)){
+                add_case(compiler, table, value);
+            }else{
+                error(compiler->parser,"Case labels must be literals");
+            }
+            current_chunk(compiler)->count = start;
+        }while (match(compiler,TOKEN_COMMA));
+    }
+    consume(compiler,TOKEN_FULL_COLON,"Expected ':' after case label");
+
+    if(table->arm_capacity < table->arm_count + 1){
+        int old_capacity = table->arm_capacity;
+        table->arm_capacity = GROW_CAPACITY(old_capacity);
+        table->arms = GROW_TRANSIENT(compiler->parser, SwitchArm, table->arms, old_capacity, table->arm_capacity);
+    }
+    SwitchArm* arm = &table->arms[table->arm_count++];
+    arm->start = current_chunk(compiler)->count;
+
+    begin_scope(compiler);
+    while (!check(compiler,TOKEN_CASE) && !check(compiler,TOKEN_DEFAULT) &&
+           !check(compiler,TOKEN_RIGHT_BRACE) && !check(compiler,TOKEN_EOF)){
+        declaration(compiler);
+    }
+    end_scope(compiler);
+    //declarations may have moved the arms along with the arena
+    table->arms[table->arm_count - 1].exit = emit_jump(compiler,OP_JUMP);
+}
+
+//an entry of the dispatch instruction starting at dispatch, 0 when there is no arm
+static void emit_switch_entry(Compiler* compiler, int dispatch, int target){
+    int distance = target == -1 ? 0 : dispatch - target;
+    if(distance > UINT16_MAX){
+        if(compiler->long_jumps) error(compiler->parser,"Too much code to jump over");
+        //compiled again with long jumps, then the arms are reached through LOOPs
+        compiler->jump_overflow = true;
+    }
+    emit_short(compiler,(uint16_t)distance);
+}
+
+//int labels spread over at most twice as many values index a table from the smallest
+static bool dense_labels(Switch* table, int32_t* low, int* span){
+    if(table->case_count == 0) return false;
+    int64_t min = INT32_MAX;
+    int64_t max = INT32_MIN;
+    for (int i = 0; i < table->case_count; i++) {
+        Value value = table->cases[i].value;
+        if(!IS_INT(value)) return false;
+        if(AS_INT(value) < min) min = AS_INT(value);
+        if(AS_INT(value) > max) max = AS_INT(value);
+    }
+    if(max - min + 1 > (int64_t)table->case_count * 2) return false;
+    *low = (int32_t)min;
+    *span = (int)(max - min + 1);
+    return true;
+}
+
+// TABLE_SWITCH or HASH_SWITCH after the arms, both pop the subject and go
+// back to an arm through an entry. TABLE_SWITCH has an entry per value
+// from its lowest label up, a HASH_SWITCH one per arm and a map from label
+// to entry, where strings are found by their interned pointer.
+static void emit_dispatch(Compiler* compiler, Switch* table, int dispatch_jump){
+    Parser* parser = compiler->parser;
+    int* targets = GROW_TRANSIENT(parser, int, NULL, 0, table->arm_count);
+    for (int i = 0; i < table->arm_count; i++) {
+        targets[i] = table->arms[i].start;
+        if(compiler->long_jumps){
+            //arms further back than a short entry reaches
+            targets[i] = current_chunk(compiler)->count;
+            emit_loop(compiler,table->arms[i].start);
+        }
+    }
+    patch_jump(compiler,dispatch_jump);
+
+    int dispatch = current_chunk(compiler)->count;
+    int fallback = table->default_arm == -1 ? -1 : targets[table->default_arm];
+    int32_t low;
+    int span;
+    if(dense_labels(table, &low, &span)){
+        int* entries = GROW_TRANSIENT(parser, int, NULL, 0, span);
+        for (int i = 0; i < span; i++) entries[i] = fallback;
+        for (int i = 0; i < table->case_count; i++) {
+            entries[AS_INT(table->cases[i].value) - low] = targets[table->cases[i].arm];
+        }
+
+        emit_byte(compiler,OP_TABLE_SWITCH);
+        emit_short(compiler,(uint16_t)add_literal(compiler, INT_VAL(low)));
+        emit_short(compiler,(uint16_t)span);
+        emit_switch_entry(compiler, dispatch, fallback);
+        for (int i = 0; i < span; i++) emit_switch_entry(compiler, dispatch, entries[i]);
+        return;
+    }
+
+    ObjMap* labels = new_map(parser->vm);
+    //in the constant table before filling it, so it is reachable if that collects
+    int constant = add_literal(compiler, OBJ_VAL(labels));
+    for (int i = 0; i < table->case_count; i++) {
+        map_set(parser->vm, labels, table->cases[i].value, INT_VAL(table->cases[i].arm + 1));
+    }
+
+    emit_byte(compiler,OP_HASH_SWITCH);
+    emit_short(compiler,(uint16_t)constant);
+    emit_short(compiler,(uint16_t)table->arm_count);
+    emit_switch_entry(compiler, dispatch, fallback);
+    for (int i = 0; i < table->arm_count; i++) emit_switch_entry(compiler, dispatch, targets[i]);
+}
+
+// switch (subject) { case a, b: ... default: ... }
+//
+// The subject jumps over the arms to the dispatch instruction after them, so
+// all the labels are known by the time it is written, and the arms jump
+// past it to the end. break leaves the switch, continue goes on to the
+// loop around it.
+static void switch_statement(Compiler* compiler){
+    consume(compiler,TOKEN_LEFT_PAREN,"Expected '(' after 'switch'");
+    expression(compiler);
+    consume(compiler,TOKEN_RIGHT_PAREN,"Expected ')' after switch value");
+    consume(compiler,TOKEN_LEFT_BRACE,"Expected '{' before switch cases");
+
+    int dispatch_jump = emit_jump(compiler,OP_JUMP);
+
+    Loop loop;
+    loop.start = current_chunk(compiler)->count;
+    loop.scope_depth = compiler->scope_depth;
+    loop.enclosing = compiler->loop;
+    loop.is_switch = true;
+    loop.end = -1;
+    loop.body = current_chunk(compiler)->count;
+    compiler->loop = &loop;
+
+    Switch table = {NULL, 0, 0, NULL, 0, 0, -1};
+    while (!check(compiler,TOKEN_RIGHT_BRACE) && !check(compiler,TOKEN_EOF)){
+        switch_arm(compiler, &table);
+    }
+    consume(compiler,TOKEN_RIGHT_BRACE,"Expected '}' after switch cases");
+
+    emit_dispatch(compiler, &table, dispatch_jump);
+    for (int i = 0; i < table.arm_count; i++) patch_jump(compiler,table.arms[i].exit);
+    end_loop(compiler);
+}
+
+static void break_statement(Compiler* compiler){
+    if(compiler->loop == NULL){
+        error(compiler->parser,"Cannot use 'break' outside of a loop or switch");
+        return;
+    }
+    consume(compiler,TOKEN_SEMICOLON,"Expected ';' after 'break'");
+
+    discard_loop_locals(compiler,compiler->loop);
+    emit_jump(compiler,OP_BREAK);
+}
+
+static void continue_statement(Compiler* compiler){
+    Loop* loop = compiler->loop;
+    while (loop != NULL && loop->is_switch) loop = loop->enclosing;
+    if(loop == NULL){
+        error(compiler->parser,"Cannot use 'continue' outside of a loop");
+        return;
+    }
+    consume(compiler,TOKEN_SEMICOLON,"Expected ';' after 'continue'");
+
+    discard_loop_locals(compiler,loop);
+    emit_loop(compiler,loop->start);
+}
+
+//turns a call that produced the return value into TAIL_CALL. The RETURN after
+//it stays for callees that can't reuse the frame.
+static void tail_call(Compiler* compiler){
+    Chunk* chunk = current_chunk(compiler);
+    int call = compiler->last_call;
+    if(call < 0) return;
+
+    uint8_t instruction = chunk->code[call];
+    if(instruction == OP_CALL && call + 2 == chunk->count){
+        chunk->code[call] = OP_TAIL_CALL;
+    }else if(instruction >= OP_CALL_0 && instruction <= OP_CALL_3 && call + 1 == chunk->count){
+        chunk->code[call] = OP_TAIL_CALL;
+        emit_byte(compiler,instruction - OP_CALL_0);
+    }
+}
+
+static void return_statement(Compiler* compiler){
+    if(compiler->type == TYPE_SCRIPT){
+        error(compiler->parser,"Cannot return from top-level code");
+    }
+
+    if(match(compiler,TOKEN_SEMICOLON)){
+        emit_return(compiler);
+    }else{
+        if(compiler->type == TYPE_INITIALIZER){
+            error(compiler->parser,"Cannot return a value from an initializer");
+        }
+        expression(compiler);
+        consume(compiler,TOKEN_SEMICOLON,"Expected ';' after return value");
+        tail_call(compiler);
+        emit_byte(compiler,OP_RETURN);
+    }
+}
+
+static void synchronize(Parser* parser){
+    parser->panicMode = false;
+
+    while (parser->current.type != TOKEN_EOF){
+        if(parser->previous.type == TOKEN_SEMICOLON) return;
+
+        switch (parser->current.type) {
+            case TOKEN_CLASS:
+            case TOKEN_FUNC:
+            case TOKEN_VAR:
+            case TOKEN_FOR:
+            case TOKEN_IF:
+            case TOKEN_WHILE:
+            case TOKEN_SWITCH:
+            case TOKEN_BREAK:
+            case TOKEN_CONTINUE:
+            case TOKEN_RETURN:
+            case TOKEN_IMPORT:
+                return;
+            default:
+                break;
+        }
+        advance(parser);
+    }
+}
+
+static void declaration(Compiler* compiler){
+    if(match(compiler,TOKEN_CLASS)){
+        class_declaration(compiler);
+    }else if(match(compiler,TOKEN_FUNC)){
+        func_declaration(compiler);
+    }else if(match(compiler,TOKEN_VAR)){
+        var_declaration(compiler);
+    }else{
+        statement(compiler);
+    }
+
+    if(compiler->parser->panicMode) synchronize(compiler->parser);
+}
+
+static void statement(Compiler* compiler){
+    if(match(compiler,TOKEN_IF)){
+        if_statement(compiler);
+    }else if(match(compiler,TOKEN_WHILE)){
+        while_statement(compiler);
+    }else if(match(compiler,TOKEN_FOR)){
+        for_statement(compiler);
+    }else if(match(compiler,TOKEN_SWITCH)){
+        switch_statement(compiler);
+    }else if(match(compiler,TOKEN_BREAK)){
+        break_statement(compiler);
+    }else if(match(compiler,TOKEN_CONTINUE)){
+        continue_statement(compiler);
+    }else if(match(compiler,TOKEN_RETURN)){
+        return_statement(compiler);
+    }else if(match(compiler,TOKEN_LEFT_BRACE)){
+        begin_scope(compiler);
+        block(compiler);
+        end_scope(compiler);
+    }else{
+        expression_statement(compiler);
+    }
+}
+
+ObjFun* compile(LnVM* vm, ObjModule* module, const char* source){
+    Parser parser;
+    parser.vm = vm;
+    parser.module = module;
+    parser_init(&parser);
+    init_scanner(&parser.scanner,source);
+
+    Compiler compiler;
+    init_compiler(&parser,&compiler,NULL,TYPE_SCRIPT);
+
+    advance(&parser);
+    while (!match(&compiler,TOKEN_EOF)){
+        declaration(&compiler);
+    }
+
+    if(retry_long_jumps(&compiler)){
+        init_scanner(&parser.scanner,source);
+        parser.functions = NULL;
+        parser.function_capacity = 0;
+        init_compiler(&parser,&compiler,NULL,TYPE_SCRIPT);
+        compiler.long_jumps = true;
+
+        advance(&parser);
+        while (!match(&compiler,TOKEN_EOF)){
+            declaration(&compiler);
+        }
+    }
+
+    ObjFun* function = end_compiler(&compiler);
+    free_arena(&parser.arena);
+    return parser.hasError ? NULL : function;
+}
+
+//functions still being compiled, kept alive if a collection runs before the compiler finishes
+void gray_compiler_roots(LnVM* vm){
+    for (Compiler* compiler = vm->compiler; compiler != NULL; compiler = compiler->enclosing) {
+        gray_object(vm,(Obj*)compiler->function);
+    }
 }
@@ -0,0 +1,58 @@
+#include "ln.h"
+
+#define PAIRS_SHOWN 20
+
+static const char* opcode_names[] = {
+#define OPCODE(name) #name,
+#include "src/opcodes.h"
+#undef OPCODE
+};
+
+const char* opcode_name(uint8_t instruction){
+    if(instruction >= sizeof(opcode_names) / sizeof(opcode_names[0])) return "UNKNOWN";
+    return opcode_names[instruction];
+}
+
+typedef struct{
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+}OpcodePair;
+
+static int compare_pairs(const void* a, const void* b){
+    uint64_t first = ((const OpcodePair*)a)->count;
+    uint64_t second = ((const OpcodePair*)b)->count;
+    return (first < second) - (first > second);
+}
+
+// Lists how often each superinstruction was fused by the compiler and, when
+// built with LN_OPCODE_PROFILE, the most frequently executed opcode pairs.
+void print_opcode_stats(LnVM* vm, FILE* out){
+    fprintf(out, "== superinstructions fused ==\n");
+    for (int i = 0; i < UINT8_COUNT; i++){
+        if(vm->fusion_counts[i] > 0){
+            fprintf(out, "%-32s %d\n", opcode_name(i), vm->fusion_counts[i]);
+        }
+    }
+
+    if(vm->opcode_pairs == NULL) return;
+
+    int count = 0;
+    OpcodePair* pairs = malloc(sizeof(OpcodePair) * UINT8_COUNT * UINT8_COUNT);
+    if(pairs == NULL) return;
+    for (int i = 0; i < UINT8_COUNT * UINT8_COUNT; i++){
+        if(vm->opcode_pairs[i] == 0) continue;
+        pairs[count].first = i / UINT8_COUNT;
+        pairs[count].second = i % UINT8_COUNT;
+        pairs[count].count = vm->opcode_pairs[i];
+        count++;
+    }
+    qsort(pairs, count, sizeof(OpcodePair), compare_pairs);
+
+    fprintf(out, "== hottest opcode pairs ==\n");
+    for (int i = 0; i < count && i < PAIRS_SHOWN; i++){
+        fprintf(out, "%-32s %-32s %llu\n", opcode_name(pairs[i].first), opcode_name(pairs[i].second),
+                (unsigned long long)pairs[i].count);
+    }
+    free(pairs);
+}
@@ -9,10 +9,12 @@ void* reallocate(LnVM* vm, void* previous, size_t old_size,size_t new_size){
     printf("Total bytes allocated: %zu\nNew allocation: %zu\nOld allocation: %zu\n\n", vm->bytes_allocated, new_size,old_size);
 #endif
     if(new_size > old_size){
-#if 0
+#ifdef LN_STRESS_GC
+        //every allocation collects, the compiler's roots included
         collect_garbage(vm);
 #endif
-        if(vm->bytes_allocated > vm->next_gc){
+        //nearly everything the compiler allocates stays live, so a collection waits until it finishes
+        if(vm->bytes_allocated > vm->next_gc && vm->compiler == NULL){
             collect_garbage(vm);
         }
     }
@@ -43,7 +45,7 @@ void gray_object(LnVM* vm, Obj* object){
     vm->gray_stack[vm->gray_count++] = object;
 }
 void gray_value(LnVM* vm, Value value){
-    if(IS_OBJ(value)) return;
+    if(!IS_OBJ(value)) return;
 
     gray_object(vm, AS_OBJ(value));
 }
@@ -54,6 +56,21 @@ void gray_array(LnVM* vm, ValueArray* array){
     }
 }
 
+static void gray_shape(LnVM* vm, Shape* shape){
+    gray_object(vm,(Obj*)shape->name);
+    for (int i = 0; i < shape->transition_count; i++) {
+        gray_shape(vm,shape->transitions[i]);
+    }
+}
+
+static void free_shape(LnVM* vm, Shape* shape){
+    for (int i = 0; i < shape->transition_count; i++) {
+        free_shape(vm,shape->transitions[i]);
+    }
+    FREE_ARRAY(vm,Shape*,shape->transitions,shape->transition_capacity);
+    FREE(vm,Shape,shape);
+}
+
 static void blacken_object(LnVM* vm, Obj* object){
 #if 0
     printf("%p blacken ", (void *)object);
@@ -65,7 +82,8 @@ static void blacken_object(LnVM* vm, Obj* object){
             ObjModule *module = (ObjModule *) object;
             gray_object(vm, (Obj *) module->name);
             gray_object(vm, (Obj *) module->path);
-            gray_table(vm,&module->values);
+            gray_table(vm,&module->slots);
+            gray_array(vm,&module->values);
             break;
         }
         case OBJ_BOUND_METHOD:{
@@ -78,8 +96,10 @@ static void blacken_object(LnVM* vm, Obj* object){
             ObjClass* klass = (ObjClass*) object;
             gray_object(vm,(Obj*)klass->name);
             gray_object(vm,(Obj*)klass->super_class);
-            gray_table(vm,&klass->methods);
+            gray_array(vm,&klass->methods);
             gray_table(vm,&klass->properties);
+            gray_table(vm,&klass->members);
+            gray_shape(vm,klass->shape);
             break;
         }
         case OBJ_ENUM:{
@@ -92,7 +112,13 @@ static void blacken_object(LnVM* vm, Obj* object){
             ObjClosure* closure = (ObjClosure*)object;
             gray_object(vm,(Obj*)closure->function);\
             for (int i = 0; i < closure->upvalue_count; ++i) {
-                gray_object(vm,(Obj *)closure->upvalues[i]);
+                ObjUpvalue* upvalue = closure->upvalues[i];
+                //cells aren't on the object list, only their value is
+                if(upvalue != NULL && is_copied_upvalue(closure, upvalue)){
+                    gray_value(vm,upvalue->closed);
+                }else{
+                    gray_object(vm,(Obj *)upvalue);
+                }
             }
             break;
         }
@@ -100,12 +126,26 @@ static void blacken_object(LnVM* vm, Obj* object){
             ObjFun* function = (ObjFun*) object;
             gray_object(vm,(Obj*)function->name);
             gray_array(vm,&function->chunk.constants);
+            //cached shapes stay alive with their class so a new shape can't reuse their address
+            for (int i = 0; i < function->chunk.cache_count; i++) {
+                InlineCache* cache = &function->chunk.caches[i];
+                for (int j = 0; j < cache->count; j++) {
+                    gray_object(vm,(Obj*)cache->entries[j].shape->klass);
+                    gray_value(vm,cache->entries[j].method);
+                }
+            }
             break;
         }
         case OBJ_INSTANCE:{
             ObjInstance* instance = (ObjInstance*)object;
             gray_object(vm,(Obj*)instance->klass);
-            gray_table(vm,&instance->fields);
+            if(instance->shape != NULL){
+                for (int i = 0; i < instance->shape->field_count; i++) {
+                    gray_value(vm,instance->fields[i]);
+                }
+            }else{
+                gray_table(vm,instance->dictionary);
+            }
             break;
         }
         case OBJ_UPVALUE:{
@@ -137,7 +177,8 @@ void free_object(LnVM* vm, Obj* object){
     switch (object->type) {
         case OBJ_MODULE:{
             ObjModule* module = (ObjModule*)object;
-            free_table(vm,&module->values);
+            free_table(vm,&module->slots);
+            free_valueArray(vm,&module->values);
             FREE(vm,ObjModule, object);
             break;
         }
@@ -147,9 +188,12 @@ void free_object(LnVM* vm, Obj* object){
         }
         case OBJ_CLASS:{
             ObjClass* klass = (ObjClass*)object;
-            free_table(vm,&klass->methods);
+            free_valueArray(vm,&klass->methods);
             free_table(vm,&klass->properties);
+            free_table(vm,&klass->members);
+            free_shape(vm,klass->shape);
             FREE(vm,ObjClass,object);
+            break;
         }
         case OBJ_ENUM:
         {
@@ -160,20 +204,26 @@ void free_object(LnVM* vm, Obj* object){
         }
         case OBJ_CLOSURE:{
             ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(vm,ObjUpvalue*,closure->upvalues, closure->upvalue_count);
-            FREE(vm,ObjClosure,object);
+            reallocate(vm,object,CLOSURE_SIZE(closure->upvalue_count),0);
             break;
         }
         case OBJ_FUNCTION:{
             ObjFun* function = (ObjFun*)object;
             free_chunk(vm,&function->chunk);
+            free_chunk(vm,&function->registers);
             FREE(vm,ObjFun,object);
             break;
         }
         case OBJ_INSTANCE:{
             ObjInstance* instance = (ObjInstance*)object;
-            free_table(vm,&instance->fields);
-            FREE(vm,ObjInstance,object);
+            if(instance->fields != instance->inline_fields){
+                FREE_ARRAY(vm,Value,instance->fields,instance->capacity);
+            }
+            if(instance->dictionary != NULL){
+                free_table(vm,instance->dictionary);
+                FREE(vm,HashTable,instance->dictionary);
+            }
+            reallocate(vm,object,sizeof(ObjInstance) + sizeof(Value) * instance->inline_count,0);
             break;
         }
         case OBJ_NATIVE:{
@@ -229,14 +279,17 @@ void collect_garbage(LnVM* vm){
 
     gray_table(vm,&vm->modules);
     gray_table(vm,&vm->globals);
-    gray_table(vm,&vm->list_methods);
-    gray_table(vm,&vm->string_methods);
-    gray_table(vm,&vm->map_methods);
-    gray_table(vm,&vm->file_methods);
+    gray_array(vm,&vm->global_values);
+    gray_array(vm,&vm->symbols);
+    gray_array(vm,&vm->list_methods);
+    gray_array(vm,&vm->string_methods);
+    gray_array(vm,&vm->map_methods);
+    gray_array(vm,&vm->file_methods);
 
-    //TODO:gray COMPILER ROOTS
+    gray_compiler_roots(vm);
 
     gray_object(vm,(Obj*) vm->init_string);
+    gray_object(vm,(Obj*) vm->class_string);
 
 
     //trace references
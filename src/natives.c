@@ -0,0 +1,36 @@
+#include <time.h>
+
+#include "ln.h"
+
+static Value print_native(LnVM* vm, int arg_count, Value* args){
+    for (int i = 0; i < arg_count; i++) {
+        print_value(args[i]);
+        if(i != arg_count - 1) printf(" ");
+    }
+    printf("\n");
+    return NIL_VAL;
+}
+
+static Value clock_native(LnVM* vm, int arg_count, Value* args){
+    if(arg_count != 0){
+        runtime_error(vm,"clock() takes no arguments (%d given).", arg_count);
+        return EMPTY_VAL;
+    }
+    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+}
+
+static void define_global(LnVM* vm, const char* name, NativeFn function){
+    ObjNative* native = new_native(vm,function);
+    push(vm, OBJ_VAL(native));
+    ObjString* global_name = copy_string(vm,name, (int)strlen(name));
+    push(vm, OBJ_VAL(global_name));
+    write_valueArray(vm,&vm->global_values,OBJ_VAL(native));
+    table_set(vm,&vm->globals,global_name,NUMBER_VAL(vm->global_values.count - 1));
+    pop(vm);
+    pop(vm);
+}
+
+void define_all_natives(LnVM* vm){
+    define_global(vm,"print",print_native);
+    define_global(vm,"clock",clock_native);
+}
@@ -24,7 +24,8 @@ ObjModule *new_module(LnVM* vm, ObjString* name){
     }
 
     ObjModule* module = ALLOCATE_OBJ(vm,ObjModule,OBJ_MODULE);
-    init_table(&module->values);
+    init_table(&module->slots);
+    init_valueArray(&module->values);
     module->name = name;
     module->path = NULL;
 
@@ -32,7 +33,7 @@ ObjModule *new_module(LnVM* vm, ObjString* name){
     ObjString* __file__ = copy_string(vm,"__file__", 8);
     push(vm, OBJ_VAL(__file__));
 
-    table_set(vm,&module->values, __file__, OBJ_VAL(name));
+    module_define(vm,module, __file__, OBJ_VAL(name));
     table_set(vm,&vm->modules, name, OBJ_VAL(module));
 
     pop(vm);
@@ -40,6 +41,67 @@ ObjModule *new_module(LnVM* vm, ObjString* name){
     return module;
 }
 
+//slot of a module variable, reserving an undefined one the first time a name is seen
+int module_slot(LnVM* vm, ObjModule* module, ObjString* name){
+    Value slot;
+    if(table_get(&module->slots,name,&slot)) return (int)AS_NUMBER(slot);
+
+    push(vm, OBJ_VAL(name));
+    write_valueArray(vm,&module->values,EMPTY_VAL);
+    table_set(vm,&module->slots,name,NUMBER_VAL(module->values.count - 1));
+    pop(vm);
+    return module->values.count - 1;
+}
+
+ObjString* module_slot_name(ObjModule* module, int slot){
+    for (int i = 0; i <= module->slots.capacity_mask; i++) {
+        Entry* entry = &module->slots.entries[i];
+        if(entry->key != NULL && (int)AS_NUMBER(entry->value) == slot) return entry->key;
+    }
+    return NULL;
+}
+
+bool module_get(ObjModule* module, ObjString* name, Value* value){
+    Value slot;
+    if(!table_get(&module->slots,name,&slot)) return false;
+
+    *value = module->values.value[(int)AS_NUMBER(slot)];
+    return !IS_EMPTY(*value);
+}
+
+void module_define(LnVM* vm, ObjModule* module, ObjString* name, Value value){
+    int slot = module_slot(vm,module,name);
+    module->values.value[slot] = value;
+}
+
+//dense id of a method name, handed out the first time a method gets the name
+int symbol_id(LnVM* vm, ObjString* name){
+    if(name->symbol != -1) return name->symbol;
+
+    push(vm, OBJ_VAL(name));
+    write_valueArray(vm,&vm->symbols,OBJ_VAL(name));
+    pop(vm);
+    name->symbol = vm->symbols.count - 1;
+    return name->symbol;
+}
+
+bool method_get(ValueArray* methods, ObjString* name, Value* method){
+    //names that no method was ever defined with have no symbol
+    if(name->symbol < 0 || name->symbol >= methods->count) return false;
+    *method = methods->value[name->symbol];
+    return !IS_EMPTY(*method);
+}
+
+void method_set(LnVM* vm, ValueArray* methods, ObjString* name, Value method){
+    int symbol = symbol_id(vm,name);
+    push(vm, method);
+    while (methods->count <= symbol) {
+        write_valueArray(vm,methods,EMPTY_VAL);
+    }
+    pop(vm);
+    methods->value[symbol] = method;
+}
+
 ObjBoundMethod* new_boundmethod(LnVM* vm, Value receiver, ObjClosure* method){
     ObjBoundMethod* boundMethod = ALLOCATE_OBJ(vm,ObjBoundMethod,OBJ_BOUND_METHOD);
     boundMethod->receiver=receiver;
@@ -47,12 +109,33 @@ ObjBoundMethod* new_boundmethod(LnVM* vm, Value receiver, ObjClosure* method){
     return boundMethod;
 }
 
+static Shape* new_shape(LnVM* vm, Shape* parent, ObjString* name){
+    Shape* shape = ALLOCATE(vm,Shape,1);
+    shape->klass = parent == NULL ? NULL : parent->klass;
+    shape->parent = parent;
+    shape->name = name;
+    shape->field_count = parent == NULL ? 0 : parent->field_count + 1;
+    shape->transitions = NULL;
+    shape->transition_count = 0;
+    shape->transition_capacity = 0;
+    return shape;
+}
+
 ObjClass* new_class(LnVM* vm, ObjString* name, ObjClass* super_class){
+    //the root shape isn't traced, so it is allocated before the class can be collected
+    Shape* root = new_shape(vm,NULL,NULL);
     ObjClass* klass = ALLOCATE_OBJ(vm,ObjClass,OBJ_CLASS);
     klass->name = name;
     klass->super_class = super_class;
-    init_table(&klass->methods);
+    init_valueArray(&klass->methods);
     init_table(&klass->properties);
+    init_table(&klass->members);
+    klass->members_epoch = 0;
+    klass->has_subclasses = false;
+    root->klass = klass;
+    klass->shape = root;
+    klass->shape_count = 1;
+    klass->field_hint = 0;
     return klass;
 }
 
@@ -64,14 +147,13 @@ ObjEnum* new_enum(LnVM* vm,ObjString* name){
 }
 
 ObjClosure* new_closure(LnVM* vm,ObjFun* function){
-    ObjUpvalue **upvalues = ALLOCATE(vm,ObjUpvalue*, function->upvalue_count);
-    for (int i = 0; i < function->upvalue_count; i++) {
-        upvalues[i] = NULL;
-    }
-    ObjClosure* closure = ALLOCATE_OBJ(vm,ObjClosure,OBJ_CLOSURE);
+    ObjClosure* closure = (ObjClosure*)allocate_object(vm,CLOSURE_SIZE(function->upvalue_count),OBJ_CLOSURE);
     closure->function = function;
-    closure->upvalues = upvalues;
     closure->upvalue_count = function->upvalue_count;
+    closure->cells = (ObjUpvalue*)&closure->upvalues[function->upvalue_count];
+    for (int i = 0; i < function->upvalue_count; i++) {
+        closure->upvalues[i] = NULL;
+    }
     return closure;
 }
 
@@ -82,22 +164,111 @@ ObjFun* new_function(LnVM* vm, ObjModule* module){
     function->name = NULL;
     function->module = module;
     init_chunk(&function->chunk);
+    init_chunk(&function->registers);
+    function->register_count = 0;
+    function->max_stack = 0;
     return function;
 }
 
 ObjInstance* new_instance(LnVM* vm, ObjClass* klass){
-    ObjInstance* instance = ALLOCATE_OBJ(vm,ObjInstance,OBJ_INSTANCE);
+    int inline_count = klass->field_hint;
+    ObjInstance* instance = (ObjInstance*)allocate_object(vm,sizeof(ObjInstance) + sizeof(Value) * inline_count,OBJ_INSTANCE);
     instance->klass = klass;
-    init_table(&instance->fields);
+    instance->shape = klass->shape;
+    instance->fields = instance->inline_fields;
+    instance->capacity = inline_count;
+    instance->inline_count = inline_count;
+    instance->dictionary = NULL;
+    return instance;
+}
 
-    push(vm, OBJ_VAL(instance));
-    ObjString* classString = copy_string(vm,"_class", 6);
-    push(vm, OBJ_VAL(classString));
-    table_set(vm,&instance->fields,classString,OBJ_VAL(klass));
+int shape_slot(Shape* shape, ObjString* name){
+    for (; shape->name != NULL; shape = shape->parent) {
+        if(shape->name == name) return shape->field_count - 1;
+    }
+    return -1;
+}
 
-    pop(vm);
-    pop(vm);
-    return instance;
+//the shape reached by adding name, NULL when the class has run out of shapes
+static Shape* shape_transition(LnVM* vm, Shape* shape, ObjString* name){
+    for (int i = 0; i < shape->transition_count; i++) {
+        if(shape->transitions[i]->name == name) return shape->transitions[i];
+    }
+
+    ObjClass* klass = shape->klass;
+    if(shape->field_count >= SHAPE_MAX_FIELDS || klass->shape_count >= CLASS_MAX_SHAPES) return NULL;
+
+    Shape* next = new_shape(vm,shape,name);
+    if(shape->transition_capacity < shape->transition_count + 1){
+        int old_cap = shape->transition_capacity;
+        shape->transition_capacity = GROW_CAPACITY(old_cap);
+        shape->transitions = GROW_ARRAY(vm,shape->transitions,Shape*,old_cap,shape->transition_capacity);
+    }
+    shape->transitions[shape->transition_count++] = next;
+    klass->shape_count++;
+
+    if(next->field_count > klass->field_hint && next->field_count <= INSTANCE_MAX_INLINE_FIELDS){
+        klass->field_hint = next->field_count;
+    }
+    return next;
+}
+
+static void grow_fields(LnVM* vm, ObjInstance* instance){
+    int capacity = GROW_CAPACITY(instance->capacity);
+    Value* fields = ALLOCATE(vm,Value,capacity);
+    memcpy(fields,instance->fields,sizeof(Value) * instance->shape->field_count);
+
+    if(instance->fields != instance->inline_fields){
+        FREE_ARRAY(vm,Value,instance->fields,instance->capacity);
+    }
+    instance->fields = fields;
+    instance->capacity = capacity;
+}
+
+static void to_dictionary(LnVM* vm, ObjInstance* instance){
+    //the instance keeps its shape until the table is built so a collection still traces every field
+    HashTable* dictionary = ALLOCATE(vm,HashTable,1);
+    init_table(dictionary);
+    for (Shape* shape = instance->shape; shape->name != NULL; shape = shape->parent) {
+        table_set(vm,dictionary,shape->name,instance->fields[shape->field_count - 1]);
+    }
+
+    if(instance->fields != instance->inline_fields){
+        FREE_ARRAY(vm,Value,instance->fields,instance->capacity);
+    }
+    instance->fields = instance->inline_fields;
+    instance->capacity = 0;
+    instance->shape = NULL;
+    instance->dictionary = dictionary;
+}
+
+bool instance_get(ObjInstance* instance, ObjString* name, Value* value){
+    if(instance->shape == NULL) return table_get(instance->dictionary,name,value);
+
+    int slot = shape_slot(instance->shape,name);
+    if(slot < 0) return false;
+    *value = instance->fields[slot];
+    return true;
+}
+
+void instance_set(LnVM* vm, ObjInstance* instance, ObjString* name, Value value){
+    if(instance->shape != NULL){
+        int slot = shape_slot(instance->shape,name);
+        if(slot >= 0){
+            instance->fields[slot] = value;
+            return;
+        }
+
+        Shape* shape = shape_transition(vm,instance->shape,name);
+        if(shape != NULL){
+            if(shape->field_count > instance->capacity) grow_fields(vm,instance);
+            instance->fields[shape->field_count - 1] = value;
+            instance->shape = shape;
+            return;
+        }
+        to_dictionary(vm,instance);
+    }
+    table_set(vm,instance->dictionary,name,value);
 }
 
 ObjNative* new_native(LnVM* vm, NativeFn function){
@@ -110,6 +281,7 @@ static ObjString* allocate_string(LnVM* vm, char* chars,int length, uint32_t has
     string->length = length;
     string->chars = chars;
     string->hash = hash;
+    string->symbol = -1;
     push(vm, OBJ_VAL(string));
     table_set(vm,&vm->strings,string,NIL_VAL);
     pop(vm);
@@ -162,6 +334,33 @@ ObjMap* new_map(LnVM* vm){
     return map;
 }
 
+//a new list with the values of list, allocated at its final size
+ObjList* copy_list(LnVM* vm, ObjList* list){
+    ObjList* copy = new_list(vm);
+    push(vm,OBJ_VAL(copy));
+    Value* values = ALLOCATE(vm,Value,list->values.count);
+    memcpy(values,list->values.value,sizeof(Value) * list->values.count);
+    copy->values.value = values;
+    copy->values.count = list->values.count;
+    copy->values.capacity = list->values.count;
+    pop(vm);
+    return copy;
+}
+
+//a new map with the entries of map. Keys hash the same in every map, so the
+//table is copied as it is laid out
+ObjMap* copy_map(LnVM* vm, ObjMap* map){
+    ObjMap* copy = new_map(vm);
+    push(vm,OBJ_VAL(copy));
+    MapEntry* entries = ALLOCATE(vm,MapEntry,map->capacity_mask + 1);
+    memcpy(entries,map->entries,sizeof(MapEntry) * (map->capacity_mask + 1));
+    copy->entries = entries;
+    copy->capacity_mask = map->capacity_mask;
+    copy->count = map->count;
+    pop(vm);
+    return copy;
+}
+
 ObjFile* new_file(LnVM* vm){
     return ALLOCATE_OBJ(vm,ObjFile,OBJ_FILE);
 }
@@ -173,6 +372,18 @@ ObjUpvalue* new_upvalue(LnVM* vm, Value* slot){
     upvalue->next = NULL;
     return upvalue;
 }
+
+//fills the closure's cell for upvalue index with a value that never changes
+ObjUpvalue* copy_upvalue(ObjClosure* closure, int index, Value value){
+    ObjUpvalue* cell = &closure->cells[index];
+    cell->obj.type = OBJ_UPVALUE;
+    cell->obj.is_marked = false;
+    cell->obj.next = NULL;
+    cell->closed = value;
+    cell->value = &cell->closed;
+    cell->next = NULL;
+    return cell;
+}
 char* list_to_string(Value value){
     int size = 50;
     ObjList* list = AS_LIST(value);
@@ -0,0 +1,930 @@
+#include "ln.h"
+
+// Middle end over a finished function, run when the VM's optimize_level is
+// set (`ln -O`). The parser writes bytecode in a single pass and can't look
+// ahead, so the stack code is lifted into a list of instructions whose jumps
+// name instruction indices rather than offsets. The passes below rewrite
+// that list and it is lowered back to bytecode for the stack depth,
+// register tier and superinstruction passes.
+//
+//  - copy propagation: a local initialized from another local and never
+//    assigned is read from the original instead.
+//  - common subexpressions: a numeric expression repeated within a basic
+//    block is computed once into a temporary.
+//  - loop-invariant code motion: a numeric expression of values a loop
+//    doesn't change is computed once before the loop into a temporary.
+//  - dead-store elimination: a store to a local that is never read again
+//    is dropped, along with the computation when nothing else sees it.
+//
+// Only expressions whose operands are known to be numbers are moved or
+// shared. They can't fail or run code, so computing them earlier or fewer
+// times can't be observed. Temporaries are extra locals right above the
+// arguments, pushed as nil on entry, and every other local moves up to make
+// room for them.
+
+typedef struct{
+    uint64_t bits[UINT8_COUNT / 64];
+}SlotSet;
+
+typedef struct{
+    //the opcode and its operands in Ir.bytes
+    int at;
+    int length;
+    int line;
+    //instruction index a jump lands on
+    int target;
+    //GET_LOCAL or SET_LOCAL of a temporary, -1 for a slot
+    int temp;
+    //a jump from outside a loop to the header whose preheader is being built
+    bool enters_loop;
+}IrInstruction;
+
+typedef struct{
+    LnVM* vm;
+    ObjFun* function;
+    Chunk* chunk;
+    IrInstruction* code;
+    int count;
+    int capacity;
+    uint8_t* bytes;
+    int byte_count;
+    int byte_capacity;
+    int temp_count;
+    //first slot above the arguments
+    int base;
+    //slots captured by closures, they can change behind the code's back
+    SlotSet captured;
+
+    //recomputed by analyze after every rewrite, depth is -1 when unreachable
+    int* depths;
+    bool* leaders;
+    //slots and stack positions holding a number before each instruction
+    SlotSet* numbers;
+    //first instruction of the numeric expression ending at each
+    //instruction, -1 when there is none
+    int* starts;
+    int max_depth;
+}Ir;
+
+static bool slot_set_has(SlotSet* set, int slot){
+    return slot >= 0 && slot < UINT8_COUNT && (set->bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+static void slot_set_add(SlotSet* set, int slot){
+    if(slot >= 0 && slot < UINT8_COUNT) set->bits[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+static void slot_set_remove(SlotSet* set, int slot){
+    if(slot >= 0 && slot < UINT8_COUNT) set->bits[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+}
+
+static void slot_set_fill(SlotSet* set, bool full){
+    memset(set->bits, full ? 0xff : 0, sizeof(set->bits));
+}
+
+static void* ir_allocate(size_t size){
+    void* memory = malloc(size);
+    if(memory == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+    return memory;
+}
+
+static uint8_t opcode(Ir* ir, int index){
+    return ir->bytes[ir->code[index].at];
+}
+
+static uint8_t operand(Ir* ir, int index, int position){
+    return ir->bytes[ir->code[index].at + 1 + position];
+}
+
+static bool is_jump(uint8_t instruction){
+    return instruction == OP_JUMP || instruction == OP_LOOP || instruction == OP_INLINE_GUARD ||
+           instruction == OP_JUMP_IF_FALSE || instruction == OP_JUMP_IF_TRUE;
+}
+
+static bool falls_through(uint8_t instruction){
+    return instruction != OP_JUMP && instruction != OP_LOOP && instruction != OP_RETURN;
+}
+
+static void reserve_bytes(Ir* ir, int length){
+    if(ir->byte_capacity < ir->byte_count + length){
+        while (ir->byte_capacity < ir->byte_count + length) {
+            ir->byte_capacity = GROW_CAPACITY(ir->byte_capacity);
+        }
+        ir->bytes = realloc(ir->bytes, ir->byte_capacity);
+        if(ir->bytes == NULL){
+            printf("Failed to allocate memory");
+            exit(71);
+        }
+    }
+}
+
+//copies an instruction's bytes into the pool, returns where they start
+static int add_bytes(Ir* ir, uint8_t* bytes, int length){
+    reserve_bytes(ir, length);
+    memcpy(&ir->bytes[ir->byte_count], bytes, length);
+    ir->byte_count += length;
+    return ir->byte_count - length;
+}
+
+static IrInstruction new_instruction(Ir* ir, uint8_t* bytes, int length, int line){
+    IrInstruction instruction;
+    instruction.at = add_bytes(ir, bytes, length);
+    instruction.length = length;
+    instruction.line = line;
+    instruction.target = -1;
+    instruction.temp = -1;
+    instruction.enters_loop = false;
+    return instruction;
+}
+
+//a copy of the instruction at index with bytes of its own
+static IrInstruction copy_instruction(Ir* ir, int index){
+    //the pool may move while growing, the copy is read from after that
+    reserve_bytes(ir, ir->code[index].length);
+    IrInstruction instruction = new_instruction(ir, &ir->bytes[ir->code[index].at], ir->code[index].length, ir->code[index].line);
+    instruction.temp = ir->code[index].temp;
+    return instruction;
+}
+
+//GET_LOCAL, SET_LOCAL or POP, temp is -1 for the plain POP
+static IrInstruction local_instruction(Ir* ir, uint8_t code, int temp, int line){
+    uint8_t bytes[2] = {code, 0};
+    IrInstruction instruction = new_instruction(ir, bytes, code == OP_POP ? 1 : 2, line);
+    instruction.temp = temp;
+    return instruction;
+}
+
+static void reserve_instructions(Ir* ir, int count){
+    if(ir->capacity < ir->count + count){
+        while (ir->capacity < ir->count + count) ir->capacity = GROW_CAPACITY(ir->capacity);
+        ir->code = realloc(ir->code, sizeof(IrInstruction) * ir->capacity);
+        if(ir->code == NULL){
+            printf("Failed to allocate memory");
+            exit(71);
+        }
+    }
+}
+
+// Replaces removed instructions from index from with the instructions in
+// added. Jumps into the removed ones land on the first added instruction,
+// a plain insertion keeps jumps to from on the instruction they named.
+static void splice(Ir* ir, int from, int removed, IrInstruction* added, int added_count){
+    int delta = added_count - removed;
+    reserve_instructions(ir, delta);
+
+    memmove(&ir->code[from + added_count], &ir->code[from + removed], sizeof(IrInstruction) * (ir->count - from - removed));
+    if(added_count > 0) memcpy(&ir->code[from], added, sizeof(IrInstruction) * added_count);
+    ir->count += delta;
+
+    for (int i = 0; i < ir->count; i++) {
+        if(i >= from && i < from + added_count) continue;
+        int* target = &ir->code[i].target;
+        if(*target < from) continue;
+        if(removed > 0 && *target < from + removed){
+            *target = from;
+        }else{
+            *target += delta;
+        }
+    }
+}
+
+static bool lift(Ir* ir){
+    Chunk* chunk = ir->chunk;
+    int* indices = ir_allocate(sizeof(int) * (chunk->count + 1));
+    for (int i = 0; i <= chunk->count; i++) indices[i] = -1;
+
+    for (int offset = 0; offset < chunk->count; offset += 1 + get_arg_count(chunk->code, chunk->constants, offset)) {
+        //wide operands only show up in functions too big to be worth it,
+        //FOR_ITER and FOR_RANGE store to locals without a SET_LOCAL the passes
+        //see and a switch has more successors than the graph keeps
+        uint8_t op = chunk->code[offset];
+        if(op == OP_WIDE || op == OP_FOR_ITER || op == OP_FOR_RANGE || op == OP_TABLE_SWITCH || op == OP_HASH_SWITCH){
+            free(indices);
+            return false;
+        }
+        int length = 1 + get_arg_count(chunk->code, chunk->constants, offset);
+        IrInstruction instruction = new_instruction(ir, &chunk->code[offset], length, chunk->lines[offset]);
+        if(is_jump(chunk->code[offset])){
+            int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+            instruction.target = chunk->code[offset] == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+        }
+        indices[offset] = ir->count;
+        reserve_instructions(ir, 1);
+        ir->code[ir->count++] = instruction;
+    }
+
+    bool valid = true;
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* instruction = &ir->code[i];
+        if(!is_jump(opcode(ir, i))) continue;
+        if(instruction->target < 0 || instruction->target >= chunk->count || indices[instruction->target] == -1){
+            valid = false;
+            break;
+        }
+        instruction->target = indices[instruction->target];
+    }
+    free(indices);
+    return valid;
+}
+
+static void find_captured(Ir* ir){
+    slot_set_fill(&ir->captured, false);
+    for (int i = 0; i < ir->count; i++) {
+        if(opcode(ir, i) != OP_CLOSURE) continue;
+        for (int triple = 1; triple < ir->code[i].length - 1; triple += 3) {
+            if(operand(ir, i, triple)) slot_set_add(&ir->captured, (operand(ir, i, triple + 1) << 8) | operand(ir, i, triple + 2));
+        }
+    }
+}
+
+static int successors(Ir* ir, int index, int* next){
+    int count = 0;
+    uint8_t instruction = opcode(ir, index);
+    if(falls_through(instruction) && index + 1 < ir->count) next[count++] = index + 1;
+    if(is_jump(instruction)) next[count++] = ir->code[index].target;
+    return count;
+}
+
+//the slot a GET_LOCAL or SET_LOCAL names, -1 for a temporary
+static int local_slot(Ir* ir, int index){
+    return ir->code[index].temp == -1 ? operand(ir, index, 0) : -1;
+}
+
+static bool is_number_constant(Ir* ir, int index){
+    return opcode(ir, index) == OP_CONSTANT && IS_NUMBER(ir->chunk->constants.value[operand(ir, index, 0)]);
+}
+
+//the numbers after the instruction at index, given the ones before it
+static void transfer_numbers(Ir* ir, int index, SlotSet* numbers){
+    int slot = ir->base + ir->depths[index];
+    uint8_t instruction = opcode(ir, index);
+    switch (instruction) {
+        case OP_CONSTANT:
+            if(is_number_constant(ir, index)) slot_set_add(numbers, slot);
+            else slot_set_remove(numbers, slot);
+            break;
+        case OP_GET_LOCAL:
+            if(ir->code[index].temp != -1 || slot_set_has(numbers, local_slot(ir, index))) slot_set_add(numbers, slot);
+            else slot_set_remove(numbers, slot);
+            break;
+        case OP_SET_LOCAL:
+            if(ir->code[index].temp != -1) break;
+            if(slot_set_has(numbers, slot - 1)) slot_set_add(numbers, local_slot(ir, index));
+            else slot_set_remove(numbers, local_slot(ir, index));
+            break;
+        case OP_POP:
+        case OP_JUMP:
+        case OP_LOOP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_INLINE_GUARD:
+            break;
+        //arithmetic that doesn't fail leaves a number
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_BITWISE_AND:
+        case OP_BITWISE_OR:
+        case OP_BITWISE_XOR:
+        case OP_LEFT_SHIFT:
+        case OP_RIGHT_SHIFT:
+            slot_set_add(numbers, slot - 2);
+            break;
+        case OP_NEGATE:
+            slot_set_add(numbers, slot - 1);
+            break;
+        case OP_ADD:
+            if(!slot_set_has(numbers, slot - 1)) slot_set_remove(numbers, slot - 2);
+            break;
+        default:{
+            //whatever the instruction pushes is unknown, the values under
+            //the ones it takes are left alone
+            int after = slot + stack_effect(ir->bytes, ir->code[index].at);
+            for (int i = after - 1; i < slot; i++) slot_set_remove(numbers, i);
+            if(after > slot) for (int i = slot; i < after; i++) slot_set_remove(numbers, i);
+            break;
+        }
+    }
+    for (int i = 0; i < UINT8_COUNT / 64; i++) numbers->bits[i] &= ~ir->captured.bits[i];
+}
+
+//stack depth above the arguments before every instruction
+static bool compute_depths(Ir* ir, int* worklist){
+    for (int i = 0; i < ir->count; i++) ir->depths[i] = -1;
+    int count = 0;
+    ir->depths[0] = 0;
+    worklist[count++] = 0;
+    ir->max_depth = 0;
+
+    while (count > 0) {
+        int index = worklist[--count];
+        int depth = ir->depths[index] + stack_effect(ir->bytes, ir->code[index].at);
+        if(depth < 0) return false;
+        if(depth > ir->max_depth) ir->max_depth = depth;
+
+        int next[2];
+        int next_count = successors(ir, index, next);
+        for (int i = 0; i < next_count; i++) {
+            if(ir->depths[next[i]] == -1){
+                ir->depths[next[i]] = depth;
+                worklist[count++] = next[i];
+            }else if(ir->depths[next[i]] != depth){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void compute_numbers(Ir* ir, int* worklist){
+    bool* queued = ir_allocate(sizeof(bool) * ir->count);
+    bool* visited = ir_allocate(sizeof(bool) * ir->count);
+    memset(queued, 0, sizeof(bool) * ir->count);
+    memset(visited, 0, sizeof(bool) * ir->count);
+
+    int count = 0;
+    slot_set_fill(&ir->numbers[0], false);
+    visited[0] = queued[0] = true;
+    worklist[count++] = 0;
+
+    //numbers only ever get fewer, so this settles
+    while (count > 0) {
+        int index = worklist[--count];
+        queued[index] = false;
+        SlotSet numbers = ir->numbers[index];
+        transfer_numbers(ir, index, &numbers);
+
+        int next[2];
+        int next_count = successors(ir, index, next);
+        for (int i = 0; i < next_count; i++) {
+            SlotSet* state = &ir->numbers[next[i]];
+            bool changed = !visited[next[i]];
+            if(changed){
+                *state = numbers;
+                visited[next[i]] = true;
+            }else{
+                for (int word = 0; word < UINT8_COUNT / 64; word++) {
+                    uint64_t met = state->bits[word] & numbers.bits[word];
+                    if(met != state->bits[word]) changed = true;
+                    state->bits[word] = met;
+                }
+            }
+            if(changed && !queued[next[i]]){
+                queued[next[i]] = true;
+                worklist[count++] = next[i];
+            }
+        }
+    }
+    free(queued);
+    free(visited);
+}
+
+static bool is_numeric_operator(uint8_t instruction){
+    switch (instruction) {
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+        case OP_BITWISE_AND:
+        case OP_BITWISE_OR:
+        case OP_BITWISE_XOR:
+        case OP_LEFT_SHIFT:
+        case OP_RIGHT_SHIFT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Numeric expressions are contiguous in stack code, the operands of an
+// operator are the expressions ending right before it. Leaves are number
+// constants and locals known to hold numbers.
+static void compute_starts(Ir* ir){
+    for (int i = 0; i < ir->count; i++) {
+        ir->starts[i] = -1;
+        if(ir->depths[i] == -1) continue;
+        uint8_t instruction = opcode(ir, i);
+
+        if(is_number_constant(ir, i)){
+            ir->starts[i] = i;
+        }else if(instruction == OP_GET_LOCAL){
+            int slot = local_slot(ir, i);
+            if(slot == -1 || (slot_set_has(&ir->numbers[i], slot) && !slot_set_has(&ir->captured, slot))) ir->starts[i] = i;
+        }else if(ir->leaders[i] || i == 0){
+            continue;
+        }else if(instruction == OP_NEGATE){
+            ir->starts[i] = ir->starts[i - 1];
+        }else if(is_numeric_operator(instruction)){
+            int right = ir->starts[i - 1];
+            if(right <= 0 || ir->leaders[right]) continue;
+            ir->starts[i] = ir->starts[right - 1];
+        }
+    }
+}
+
+static bool analyze(Ir* ir){
+    free(ir->depths);
+    free(ir->leaders);
+    free(ir->numbers);
+    free(ir->starts);
+    ir->depths = ir_allocate(sizeof(int) * ir->count);
+    ir->leaders = ir_allocate(sizeof(bool) * ir->count);
+    ir->numbers = ir_allocate(sizeof(SlotSet) * ir->count);
+    ir->starts = ir_allocate(sizeof(int) * ir->count);
+    int* worklist = ir_allocate(sizeof(int) * (ir->count * 2 + 1));
+
+    memset(ir->leaders, 0, sizeof(bool) * ir->count);
+    for (int i = 0; i < ir->count; i++) {
+        uint8_t instruction = opcode(ir, i);
+        if(is_jump(instruction)) ir->leaders[ir->code[i].target] = true;
+        if((is_jump(instruction) || instruction == OP_RETURN) && i + 1 < ir->count) ir->leaders[i + 1] = true;
+    }
+
+    bool valid = compute_depths(ir, worklist);
+    if(valid){
+        find_captured(ir);
+        compute_numbers(ir, worklist);
+        compute_starts(ir);
+    }
+    free(worklist);
+    return valid;
+}
+
+//true when the length instructions from a and b on compute the same thing
+static bool same_code(Ir* ir, int a, int b, int length){
+    for (int i = 0; i < length; i++) {
+        IrInstruction* first = &ir->code[a + i];
+        IrInstruction* second = &ir->code[b + i];
+        if(first->length != second->length || first->temp != second->temp) return false;
+        //the same number can sit in the constant table more than once
+        if(opcode(ir, a + i) == OP_CONSTANT && opcode(ir, b + i) == OP_CONSTANT){
+            Value* constants = ir->chunk->constants.value;
+            if(constants[operand(ir, a + i, 0)] != constants[operand(ir, b + i, 0)]) return false;
+        }else if(memcmp(&ir->bytes[first->at], &ir->bytes[second->at], first->length) != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
+//a temporary for a new value, -1 when the frame has no slots left
+static int new_temp(Ir* ir){
+    if(ir->base + ir->temp_count + ir->max_depth + 2 > UINT8_MAX) return -1;
+    return ir->temp_count++;
+}
+
+//true when a local read by the expression from start to end is written at index
+static bool writes_leaf(Ir* ir, int index, int start, int end){
+    if(opcode(ir, index) != OP_SET_LOCAL) return false;
+    for (int i = start; i <= end; i++) {
+        if(opcode(ir, i) == OP_GET_LOCAL && ir->code[i].temp == ir->code[index].temp &&
+           operand(ir, i, 0) == operand(ir, index, 0)) return true;
+    }
+    return false;
+}
+
+//highest stack position a local read by the expression lives at, locals
+//below the arguments count as -1
+static int deepest_leaf(Ir* ir, int start, int end){
+    int deepest = -1;
+    for (int i = start; i <= end; i++) {
+        int slot = opcode(ir, i) == OP_GET_LOCAL ? local_slot(ir, i) : -1;
+        if(slot - ir->base > deepest) deepest = slot - ir->base;
+    }
+    return deepest;
+}
+
+// Within a basic block, a numeric expression computed again while its
+// locals still hold the same values is read back from a temporary.
+static bool eliminate_common_subexpressions(Ir* ir){
+    for (int root = 0; root < ir->count; root++) {
+        int start = ir->starts[root];
+        if(start == -1 || root - start < 2) continue;
+        int length = root - start + 1;
+        int leaf = deepest_leaf(ir, start, root);
+
+        int matches[UINT8_COUNT];
+        int match_count = 0;
+        int last = root;
+        for (int i = root + 1; i < ir->count && !ir->leaders[i] && match_count < UINT8_COUNT; i++) {
+            //the locals went out of scope, or one of them changed
+            if(ir->depths[i] <= leaf || writes_leaf(ir, i, start, root)) break;
+            if(ir->starts[i] == i - length + 1 && i - length + 1 > last && same_code(ir, start, i - length + 1, length)){
+                matches[match_count++] = i - length + 1;
+                last = i;
+            }
+        }
+        if(match_count == 0) continue;
+
+        int temp = new_temp(ir);
+        if(temp == -1) return false;
+        int line = ir->code[root].line;
+        for (int i = match_count - 1; i >= 0; i--) {
+            IrInstruction read = local_instruction(ir, OP_GET_LOCAL, temp, ir->code[matches[i]].line);
+            splice(ir, matches[i], length, &read, 1);
+        }
+        IrInstruction write = local_instruction(ir, OP_SET_LOCAL, temp, line);
+        splice(ir, root + 1, 0, &write, 1);
+        return true;
+    }
+    return false;
+}
+
+typedef struct{
+    int header;
+    bool* body;
+    int size;
+}IrLoop;
+
+//instructions that reach a back edge at end without passing header
+static int loop_body(int header, int end, bool* body, int** predecessors, int* predecessor_counts, int* worklist){
+    int count = 0;
+    int size = 0;
+    if(!body[header]){
+        body[header] = true;
+        size++;
+    }
+    if(!body[end]){
+        body[end] = true;
+        size++;
+        worklist[count++] = end;
+    }
+    while (count > 0) {
+        int index = worklist[--count];
+        for (int i = 0; i < predecessor_counts[index]; i++) {
+            int predecessor = predecessors[index][i];
+            if(body[predecessor]) continue;
+            //the header doesn't dominate the back edge, so it's no loop
+            if(predecessor == 0) return -1;
+            body[predecessor] = true;
+            size++;
+            worklist[count++] = predecessor;
+        }
+    }
+    return size;
+}
+
+//the loop with the biggest body among the LOOP instructions, size is 0
+//when there is none left to look at
+static IrLoop find_loop(Ir* ir, bool* tried){
+    IrLoop loop;
+    loop.size = 0;
+    loop.body = NULL;
+
+    int** predecessors = ir_allocate(sizeof(int*) * ir->count);
+    int* predecessor_counts = ir_allocate(sizeof(int) * ir->count);
+    int* worklist = ir_allocate(sizeof(int) * ir->count);
+    for (int i = 0; i < ir->count; i++) {
+        predecessor_counts[i] = 0;
+        predecessors[i] = NULL;
+    }
+    for (int i = 0; i < ir->count; i++) {
+        if(ir->depths[i] == -1) continue;
+        int next[2];
+        int next_count = successors(ir, i, next);
+        for (int j = 0; j < next_count; j++) {
+            int successor = next[j];
+            predecessors[successor] = realloc(predecessors[successor], sizeof(int) * (predecessor_counts[successor] + 1));
+            if(predecessors[successor] == NULL){
+                printf("Failed to allocate memory");
+                exit(71);
+            }
+            predecessors[successor][predecessor_counts[successor]++] = i;
+        }
+    }
+
+    bool* body = ir_allocate(sizeof(bool) * ir->count);
+    for (int header = 0; header < ir->count; header++) {
+        if(tried[header] || ir->depths[header] == -1) continue;
+        memset(body, 0, sizeof(bool) * ir->count);
+        int size = 0;
+        //a continue adds a second back edge to the same header
+        for (int i = header; i < ir->count && size != -1; i++) {
+            if(opcode(ir, i) == OP_LOOP && ir->code[i].target == header && ir->depths[i] != -1){
+                size = loop_body(header, i, body, predecessors, predecessor_counts, worklist);
+            }
+        }
+        if(size <= 0){
+            tried[header] = true;
+            continue;
+        }
+        if(size > loop.size){
+            loop.header = header;
+            loop.size = size;
+            if(loop.body == NULL) loop.body = ir_allocate(sizeof(bool) * ir->count);
+            memcpy(loop.body, body, sizeof(bool) * ir->count);
+        }
+    }
+
+    for (int i = 0; i < ir->count; i++) free(predecessors[i]);
+    free(predecessors);
+    free(predecessor_counts);
+    free(worklist);
+    free(body);
+    return loop;
+}
+
+//true when the expression reads only values the loop doesn't change
+static bool is_invariant(Ir* ir, IrLoop* loop, int start, int end){
+    for (int i = start; i <= end; i++) {
+        if(opcode(ir, i) != OP_GET_LOCAL) continue;
+        int slot = local_slot(ir, i);
+        //a local declared inside the loop is pushed again every iteration
+        if(slot != -1 && slot - ir->base >= ir->depths[loop->header]) return false;
+        for (int j = 0; j < ir->count; j++) {
+            if(loop->body[j] && writes_leaf(ir, j, i, i)) return false;
+        }
+    }
+    return true;
+}
+
+// Moves the numeric expressions of one loop that read only values the loop
+// doesn't change into a preheader, each computed once into a temporary.
+static bool hoist_loop(Ir* ir, IrLoop* loop){
+    int header = loop->header;
+    if(header > 0 && loop->body[header - 1]) return false;
+    for (int i = 0; i < ir->count; i++) {
+        if(!loop->body[i]) continue;
+        if(i < header || ir->depths[i] < ir->depths[header]) return false;
+    }
+
+    int roots[UINT8_COUNT];
+    int root_count = 0;
+    //from the back so an expression is seen before the ones inside it
+    for (int root = ir->count - 1; root >= header && root_count < UINT8_COUNT; root--) {
+        int start = ir->starts[root];
+        if(!loop->body[root] || start == -1 || start == root) continue;
+        if(root_count > 0 && start >= ir->starts[roots[root_count - 1]] && root < roots[root_count - 1]) continue;
+        if(is_invariant(ir, loop, start, root)) roots[root_count++] = root;
+    }
+    if(root_count == 0) return false;
+
+    IrInstruction preheader[UINT8_COUNT * 4];
+    int preheader_count = 0;
+    int temps[UINT8_COUNT];
+    for (int i = 0; i < root_count; i++) {
+        int start = ir->starts[roots[i]];
+        int length = roots[i] - start + 1;
+        temps[i] = -1;
+        for (int j = 0; j < i; j++) {
+            int other = ir->starts[roots[j]];
+            if(roots[j] - other + 1 == length && same_code(ir, start, other, length)) temps[i] = temps[j];
+        }
+        if(temps[i] != -1) continue;
+        if(preheader_count + length + 2 > UINT8_COUNT * 4 || (temps[i] = new_temp(ir)) == -1){
+            root_count = i;
+            break;
+        }
+
+        for (int j = start; j <= roots[i]; j++) {
+            preheader[preheader_count++] = copy_instruction(ir, j);
+        }
+        preheader[preheader_count++] = local_instruction(ir, OP_SET_LOCAL, temps[i], ir->code[roots[i]].line);
+        preheader[preheader_count++] = local_instruction(ir, OP_POP, -1, ir->code[roots[i]].line);
+    }
+    if(root_count == 0) return false;
+
+    //jumps from before the loop run the preheader, the back edges skip it
+    for (int i = 0; i < ir->count; i++) {
+        ir->code[i].enters_loop = !loop->body[i] && is_jump(opcode(ir, i)) && ir->code[i].target == header;
+    }
+    //roots run backwards, so the replacements don't move the ones left
+    for (int i = 0; i < root_count; i++) {
+        int start = ir->starts[roots[i]];
+        IrInstruction read = local_instruction(ir, OP_GET_LOCAL, temps[i], ir->code[start].line);
+        splice(ir, start, roots[i] - start + 1, &read, 1);
+    }
+    splice(ir, header, 0, preheader, preheader_count);
+    for (int i = 0; i < ir->count; i++) {
+        if(ir->code[i].enters_loop) ir->code[i].target = header;
+        ir->code[i].enters_loop = false;
+    }
+    return true;
+}
+
+static bool hoist_invariants(Ir* ir, bool* tried){
+    while (true) {
+        IrLoop loop = find_loop(ir, tried);
+        if(loop.size == 0) return false;
+        bool hoisted = hoist_loop(ir, &loop);
+        free(loop.body);
+        if(hoisted) return true;
+        tried[loop.header] = true;
+    }
+}
+
+//locals read after each instruction, temporaries are left out
+static SlotSet* compute_liveness(Ir* ir){
+    SlotSet* live = ir_allocate(sizeof(SlotSet) * ir->count);
+    for (int i = 0; i < ir->count; i++) slot_set_fill(&live[i], false);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = ir->count - 1; i >= 0; i--) {
+            SlotSet out;
+            slot_set_fill(&out, false);
+            int next[2];
+            int next_count = successors(ir, i, next);
+            for (int j = 0; j < next_count; j++) {
+                SlotSet in = live[next[j]];
+                uint8_t instruction = opcode(ir, next[j]);
+                if(instruction == OP_SET_LOCAL) slot_set_remove(&in, local_slot(ir, next[j]));
+                if(instruction == OP_GET_LOCAL) slot_set_add(&in, local_slot(ir, next[j]));
+                for (int word = 0; word < UINT8_COUNT / 64; word++) out.bits[word] |= in.bits[word];
+            }
+            if(memcmp(&out, &live[i], sizeof(SlotSet)) != 0){
+                live[i] = out;
+                changed = true;
+            }
+        }
+    }
+    return live;
+}
+
+// A store to a local that isn't read before the local is stored again or
+// the function returns. The value stays on the stack for whatever comes
+// next, and a numeric expression stored by a statement is dropped with it.
+static bool eliminate_dead_stores(Ir* ir){
+    SlotSet* live = compute_liveness(ir);
+    bool changed = false;
+
+    for (int i = ir->count - 1; i >= 0; i--) {
+        if(opcode(ir, i) != OP_SET_LOCAL || ir->depths[i] == -1) continue;
+        int slot = local_slot(ir, i);
+        if(slot == -1 || slot_set_has(&live[i], slot) || slot_set_has(&ir->captured, slot)) continue;
+
+        int start = ir->starts[i - 1];
+        bool statement = i + 1 < ir->count && opcode(ir, i + 1) == OP_POP && !ir->leaders[i + 1] && !ir->leaders[i];
+        if(statement && start != -1){
+            splice(ir, start, i + 2 - start, NULL, 0);
+            i = start;
+        }else{
+            splice(ir, i, 1, NULL, 0);
+        }
+        changed = true;
+    }
+    free(live);
+    return changed;
+}
+
+// A local whose initializer is a read of another local, and that neither
+// of them is assigned while the copy is in scope, is read from the other.
+static bool propagate_copies(Ir* ir, ConstantLocal* locals, int local_count){
+    int* indices = ir_allocate(sizeof(int) * (ir->chunk->count + 1));
+    int offset = 0;
+    for (int i = 0; i < ir->count; i++) {
+        indices[offset] = i;
+        offset += ir->code[i].length;
+    }
+    indices[offset] = ir->count;
+
+    bool changed = false;
+    for (int i = 0; i < local_count; i++) {
+        ConstantLocal* local = &locals[i];
+        int start = indices[local->start];
+        int end = indices[local->end];
+        int scope_end = indices[local->scope_end];
+        if(end != start + 1 || opcode(ir, start) != OP_GET_LOCAL) continue;
+        uint8_t source = operand(ir, start, 0);
+        if(source == local->slot || slot_set_has(&ir->captured, source)) continue;
+
+        bool assigned = false;
+        for (int j = end; j < scope_end; j++) {
+            if(opcode(ir, j) == OP_SET_LOCAL && operand(ir, j, 0) == source) assigned = true;
+        }
+        if(assigned) continue;
+
+        for (int j = end; j < scope_end; j++) {
+            if(opcode(ir, j) == OP_GET_LOCAL && operand(ir, j, 0) == local->slot){
+                ir->bytes[ir->code[j].at + 1] = source;
+                changed = true;
+            }
+        }
+    }
+    free(indices);
+    return changed;
+}
+
+// Gives the temporaries their slots right above the arguments, moving every
+// local up, and pushes them on entry.
+static bool place_temps(Ir* ir){
+    int shift = ir->temp_count;
+    for (int i = 0; i < ir->count; i++) {
+        IrInstruction* instruction = &ir->code[i];
+        uint8_t* bytes = &ir->bytes[instruction->at];
+        int slot = -1;
+        if(bytes[0] == OP_GET_LOCAL || bytes[0] == OP_SET_LOCAL){
+            slot = instruction->temp != -1 ? ir->base + instruction->temp : bytes[1] >= ir->base ? bytes[1] + shift : bytes[1];
+            if(slot > UINT8_MAX) return false;
+            bytes[1] = (uint8_t)slot;
+        }else if(bytes[0] == OP_CLOSURE){
+            for (int triple = 2; triple < instruction->length; triple += 3) {
+                int index = (bytes[triple + 1] << 8) | bytes[triple + 2];
+                if(!bytes[triple] || index < ir->base) continue;
+                if(index + shift > UINT16_MAX) return false;
+                bytes[triple + 1] = ((index + shift) >> 8) & 0xff;
+                bytes[triple + 2] = (index + shift) & 0xff;
+            }
+        }
+    }
+
+    IrInstruction* entry = ir_allocate(sizeof(IrInstruction) * (shift + 1));
+    for (int i = 0; i < shift; i++) {
+        uint8_t nil = OP_NIL;
+        entry[i] = new_instruction(ir, &nil, 1, ir->code[0].line);
+    }
+    splice(ir, 0, 0, entry, shift);
+    free(entry);
+    return true;
+}
+
+//writes the instructions back into the chunk, false when a jump is too long
+static bool lower(Ir* ir){
+    int* offsets = ir_allocate(sizeof(int) * (ir->count + 1));
+    int offset = 0;
+    for (int i = 0; i < ir->count; i++) {
+        offsets[i] = offset;
+        offset += ir->code[i].length;
+    }
+    offsets[ir->count] = offset;
+
+    for (int i = 0; i < ir->count; i++) {
+        if(!is_jump(opcode(ir, i))) continue;
+        int jump = offsets[ir->code[i].target] - (offsets[i] + 3);
+        uint8_t instruction = opcode(ir, i);
+        if(jump < 0 && instruction != OP_JUMP && instruction != OP_LOOP){
+            free(offsets);
+            return false;
+        }
+        if(instruction == OP_JUMP || instruction == OP_LOOP) ir->bytes[ir->code[i].at] = jump < 0 ? OP_LOOP : OP_JUMP;
+        if(jump < 0) jump = -jump;
+        if(jump > UINT16_MAX){
+            free(offsets);
+            return false;
+        }
+        ir->bytes[ir->code[i].at + 1] = (jump >> 8) & 0xff;
+        ir->bytes[ir->code[i].at + 2] = jump & 0xff;
+    }
+    free(offsets);
+
+    ir->chunk->count = 0;
+    for (int i = 0; i < ir->count; i++) {
+        for (int j = 0; j < ir->code[i].length; j++) {
+            write_chunk(ir->vm, ir->chunk, ir->bytes[ir->code[i].at + j], ir->code[i].line);
+        }
+    }
+    return true;
+}
+
+void optimize_function(LnVM* vm, ObjFun* function, ConstantLocal* locals, int local_count){
+    Ir ir;
+    ir.vm = vm;
+    ir.function = function;
+    ir.chunk = &function->chunk;
+    ir.code = NULL;
+    ir.count = 0;
+    ir.capacity = 0;
+    ir.bytes = NULL;
+    ir.byte_count = 0;
+    ir.byte_capacity = 0;
+    ir.temp_count = 0;
+    ir.base = function->arity + 1;
+    ir.depths = NULL;
+    ir.leaders = NULL;
+    ir.numbers = NULL;
+    ir.starts = NULL;
+
+    if(ir.chunk->count > 0 && lift(&ir) && analyze(&ir)){
+        bool changed = propagate_copies(&ir, locals, local_count);
+        bool valid = true;
+
+        //every rewrite removes instructions from a loop or a block, or
+        //uses up a temporary, the limit is only a backstop
+        bool* tried = NULL;
+        for (int round = 0; round < 128; round++) {
+            if(!analyze(&ir)){
+                valid = false;
+                break;
+            }
+            free(tried);
+            tried = ir_allocate(sizeof(bool) * ir.count);
+            memset(tried, 0, sizeof(bool) * ir.count);
+            if(!hoist_invariants(&ir, tried) && !eliminate_common_subexpressions(&ir) && !eliminate_dead_stores(&ir)) break;
+            changed = true;
+        }
+        free(tried);
+
+        if(valid && changed && (ir.temp_count == 0 || place_temps(&ir))) lower(&ir);
+    }
+
+    free(ir.code);
+    free(ir.bytes);
+    free(ir.depths);
+    free(ir.leaders);
+    free(ir.numbers);
+    free(ir.starts);
+}
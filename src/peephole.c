@@ -0,0 +1,575 @@
+#include "ln.h"
+
+// Peephole pass over a finished function's stack code. It runs before the
+// stack depth, register translation and superinstruction passes, so those
+// only ever see the smaller code.
+//
+// A rewrite either drops instructions or swaps an instruction for one of
+// the same length. Dropped instructions are only marked while the rules run;
+// the chunk is compacted once at the end, moving jump offsets and the lines
+// table along with the code.
+//
+// Constant operands are folded here rather than while parsing, so a fold
+// sees through groupings, unary operators and locals that are never
+// assigned, and its result can fold again with whatever follows.
+
+typedef struct{
+    LnVM* vm;
+    Chunk* chunk;
+    //indexed by offset, only meaningful at instruction starts
+    bool* removed;
+    bool* targets;
+    bool* reachable;
+    int* worklist;
+}Peephole;
+
+static int instruction_length(Chunk* chunk, int offset){
+    return 1 + get_arg_count(chunk->code, chunk->constants, offset);
+}
+
+static bool is_conditional(uint8_t instruction){
+    return instruction == OP_JUMP_IF_FALSE || instruction == OP_JUMP_IF_TRUE;
+}
+
+//steps a for-in loop, it branches out but also stores the next element
+static bool is_iteration(uint8_t instruction){
+    return instruction == OP_FOR_ITER || instruction == OP_FOR_RANGE;
+}
+
+//goes back to one of several arms, or on to the next instruction
+static bool is_switch(uint8_t instruction){
+    return instruction == OP_TABLE_SWITCH || instruction == OP_HASH_SWITCH;
+}
+
+static bool is_jump(uint8_t instruction){
+    return instruction == OP_JUMP || instruction == OP_LOOP || instruction == OP_INLINE_GUARD ||
+           is_conditional(instruction) || is_iteration(instruction);
+}
+
+static int jump_target(Chunk* chunk, int offset){
+    int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    return chunk->code[offset] == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+}
+
+//points the jump at offset to target, an unconditional one turns into a LOOP
+//or a JUMP to match the direction
+static bool set_jump_target(Chunk* chunk, int offset, int target){
+    int jump = target - (offset + 3);
+    uint8_t instruction = chunk->code[offset];
+    bool unconditional = instruction == OP_JUMP || instruction == OP_LOOP;
+    if(jump < 0 && !unconditional) return false;
+    if(-jump > UINT16_MAX || jump > UINT16_MAX) return false;
+
+    if(unconditional) chunk->code[offset] = jump < 0 ? OP_LOOP : OP_JUMP;
+    if(jump < 0) jump = -jump;
+    chunk->code[offset + 1] = (jump >> 8) & 0xff;
+    chunk->code[offset + 2] = jump & 0xff;
+    return true;
+}
+
+//first instruction still in the code at or after offset
+static int resolve(Peephole* peephole, int offset){
+    Chunk* chunk = peephole->chunk;
+    while (offset < chunk->count && peephole->removed[offset]) {
+        offset += instruction_length(chunk, offset);
+    }
+    return offset;
+}
+
+static int next_instruction(Peephole* peephole, int offset){
+    return resolve(peephole, offset + instruction_length(peephole->chunk, offset));
+}
+
+static uint8_t opcode_at(Peephole* peephole, int offset){
+    return offset < peephole->chunk->count ? peephole->chunk->code[offset] : OP_RETURN;
+}
+
+static void remove_instruction(Peephole* peephole, int offset){
+    peephole->removed[offset] = true;
+    //jumps that landed here now land on whatever follows
+    if(peephole->targets[offset]) peephole->targets[resolve(peephole, offset)] = true;
+}
+
+// Jump targets and reachable instructions of the code that is left. Control
+// flow is followed rather than the code order, a for loop's increment
+// clause is only reached by a backward LOOP.
+static void analyze(Peephole* peephole){
+    Chunk* chunk = peephole->chunk;
+    memset(peephole->targets, 0, sizeof(bool) * (chunk->count + 1));
+    memset(peephole->reachable, 0, sizeof(bool) * (chunk->count + 1));
+
+    int count = 0;
+    int start = resolve(peephole, 0);
+    peephole->reachable[start] = true;
+    peephole->worklist[count++] = start;
+
+    while (count > 0) {
+        int offset = peephole->worklist[--count];
+        if(offset >= chunk->count) continue;
+        uint8_t instruction = chunk->code[offset];
+
+        if(is_switch(instruction)){
+            for (int entry = 0; entry <= switch_entry_count(chunk->code, offset); entry++) {
+                int successor = resolve(peephole, switch_target(chunk->code, offset, entry));
+                peephole->targets[successor] = true;
+                if(peephole->reachable[successor]) continue;
+                peephole->reachable[successor] = true;
+                peephole->worklist[count++] = successor;
+            }
+            continue;
+        }
+
+        int successors[2] = {-1, -1};
+        if(instruction != OP_JUMP && instruction != OP_LOOP && instruction != OP_RETURN){
+            successors[0] = next_instruction(peephole, offset);
+        }
+        if(is_jump(instruction)){
+            successors[1] = resolve(peephole, jump_target(chunk, offset));
+            peephole->targets[successors[1]] = true;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            int successor = successors[i];
+            if(successor < 0 || successor > chunk->count || peephole->reachable[successor]) continue;
+            peephole->reachable[successor] = true;
+            peephole->worklist[count++] = successor;
+        }
+    }
+}
+
+//where a jump to target ends up when target is itself a jump, -1 if nowhere else
+static int thread_jump(Peephole* peephole, uint8_t instruction, int target){
+    uint8_t destination = opcode_at(peephole, target);
+    if(destination == OP_JUMP || destination == OP_LOOP){
+        return jump_target(peephole->chunk, target);
+    }
+    //the condition is still on the stack, so the second test has a known outcome
+    if(is_conditional(instruction) && is_conditional(destination)){
+        return destination == instruction ? jump_target(peephole->chunk, target) : next_instruction(peephole, target);
+    }
+    return -1;
+}
+
+static bool optimize_jump(Peephole* peephole, int offset){
+    Chunk* chunk = peephole->chunk;
+    uint8_t instruction = chunk->code[offset];
+    int target = resolve(peephole, jump_target(chunk, offset));
+
+    //a jump to the next instruction, the condition stays on the stack either way
+    if(target == next_instruction(peephole, offset) && !is_iteration(instruction)){
+        remove_instruction(peephole, offset);
+        return true;
+    }
+
+    int threaded = thread_jump(peephole, instruction, target);
+    if(threaded == -1 || resolve(peephole, threaded) == target || target == offset) return false;
+    if(!set_jump_target(chunk, offset, threaded)) return false;
+    peephole->targets[resolve(peephole, threaded)] = true;
+    return true;
+}
+
+//a branch on NOT x whose both successors drop the condition can branch on x
+static bool invertible_branch(Peephole* peephole, int offset){
+    int jump = next_instruction(peephole, offset);
+    if(!is_conditional(opcode_at(peephole, jump)) || peephole->targets[jump]) return false;
+    return opcode_at(peephole, next_instruction(peephole, jump)) == OP_POP &&
+           opcode_at(peephole, resolve(peephole, jump_target(peephole->chunk, jump))) == OP_POP;
+}
+
+static uint8_t invert_branch(uint8_t instruction){
+    return instruction == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+}
+
+//the comparison computing NOT instruction, OP_RETURN when there is none
+static uint8_t complement(uint8_t instruction){
+    switch (instruction) {
+        case OP_EQUAL: return OP_NOT_EQUAL;
+        case OP_NOT_EQUAL: return OP_EQUAL;
+        case OP_LESS: return OP_GREATER_EQUAL;
+        case OP_GREATER_EQUAL: return OP_LESS;
+        case OP_GREATER: return OP_LESS_EQUAL;
+        case OP_LESS_EQUAL: return OP_GREATER;
+        default: return OP_RETURN;
+    }
+}
+
+//pushes that can't fail or run code, so dropping them with their POP is safe
+static bool is_pure_push(uint8_t instruction){
+    switch (instruction) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//the GET reading back the variable a SET instruction wrote
+static uint8_t reader_of(uint8_t instruction){
+    switch (instruction) {
+        case OP_SET_LOCAL: return OP_GET_LOCAL;
+        case OP_SET_UPVALUE: return OP_GET_UPVALUE;
+        case OP_SET_GLOBAL: return OP_GET_GLOBAL;
+        case OP_SET_MODULE: return OP_GET_MODULE;
+        default: return OP_RETURN;
+    }
+}
+
+//the value pushed by the instruction at offset when it is a literal
+static bool constant_value(Peephole* peephole, int offset, Value* value){
+    Chunk* chunk = peephole->chunk;
+    switch (opcode_at(peephole, offset)) {
+        case OP_CONSTANT: *value = chunk->constants.value[chunk->code[offset + 1]]; return true;
+        case OP_NIL: *value = NIL_VAL; return true;
+        case OP_TRUE: *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        default: return false;
+    }
+}
+
+//index of value in the constant table, -1 once the table is full
+static int find_constant(Peephole* peephole, Value value){
+    int index = lookup_constant(peephole->chunk, value);
+    if(index != -1) return index > UINT8_MAX ? -1 : index;
+    if(peephole->chunk->constants.count > UINT8_MAX) return -1;
+    return add_constant(peephole->vm, peephole->chunk, value);
+}
+
+static Value concatenate_strings(LnVM* vm, ObjString* a, ObjString* b){
+    int length = a->length + b->length;
+    char* chars = ALLOCATE(vm,char,length + 1);
+    memcpy(chars, a->chars, a->length);
+    memcpy(chars + a->length, b->chars, b->length);
+    chars[length] = '\0';
+    return OBJ_VAL(take_string(vm,chars,length));
+}
+
+//a op b as the VM would compute it, false when that would be a runtime error
+static bool fold_binary(Peephole* peephole, uint8_t instruction, Value a, Value b, Value* result){
+    switch (instruction) {
+        case OP_EQUAL: *result = BOOL_VAL(values_equal(a, b)); return true;
+        case OP_NOT_EQUAL: *result = BOOL_VAL(!values_equal(a, b)); return true;
+        case OP_ADD:
+            if(IS_STRING(a) && IS_STRING(b)){
+                *result = concatenate_strings(peephole->vm, AS_STRING(a), AS_STRING(b));
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    if(!ARE_NUMBERS(a, b)) return false;
+    double x = AS_NUMBER(a);
+    double y = AS_NUMBER(b);
+    switch (instruction) {
+        case OP_ADD: *result = narrow_number(x + y); return true;
+        case OP_SUB: *result = narrow_number(x - y); return true;
+        case OP_MUL: *result = narrow_number(x * y); return true;
+        case OP_DIV: *result = narrow_number(x / y); return true;
+        //the complements are negated so NaN folds like it runs
+        case OP_LESS: *result = BOOL_VAL(x < y); return true;
+        case OP_GREATER: *result = BOOL_VAL(y < x); return true;
+        case OP_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+        case OP_LESS_EQUAL: *result = BOOL_VAL(!(y < x)); return true;
+        default: break;
+    }
+
+    //doubles are truncated at run time, only exact ints are folded
+    if(!ARE_INTS(a, b)) return false;
+    int32_t i = AS_INT(a);
+    int32_t j = AS_INT(b);
+    switch (instruction) {
+        case OP_BITWISE_AND: *result = INT_VAL(i & j); return true;
+        case OP_BITWISE_OR: *result = INT_VAL(i | j); return true;
+        case OP_BITWISE_XOR: *result = INT_VAL(i ^ j); return true;
+        case OP_LEFT_SHIFT: *result = INT_VAL((int32_t)((uint32_t)i << (j & 31))); return true;
+        case OP_RIGHT_SHIFT: *result = INT_VAL(i >> (j & 31)); return true;
+        default: return false;
+    }
+}
+
+//writes a push of value over the one byte instruction at offset
+static void write_literal(Chunk* chunk, int offset, Value value){
+    chunk->code[offset] = IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+}
+
+//writes value over the two byte instruction at offset, the rewrites only
+//ever reuse a CONSTANT or GET_LOCAL
+static bool write_constant(Peephole* peephole, int offset, Value value){
+    int constant = find_constant(peephole, value);
+    if(constant == -1) return false;
+
+    peephole->chunk->code[offset] = OP_CONSTANT;
+    peephole->chunk->code[offset + 1] = (uint8_t)constant;
+    return true;
+}
+
+// Folds an instruction applied to literals into a single push. The pushes
+// after the first and the operator must not be jump targets, a jump there
+// would bring its own operands.
+static bool fold_constant(Peephole* peephole, int offset){
+    Chunk* chunk = peephole->chunk;
+    Value a;
+    if(!constant_value(peephole, offset, &a)) return false;
+
+    int second = next_instruction(peephole, offset);
+    uint8_t instruction = opcode_at(peephole, second);
+    if(second >= chunk->count || peephole->targets[second]) return false;
+
+    if(is_conditional(instruction)){
+        //the literal stays for the POPs on both sides, only the branch goes
+        if(is_falsey(a) == (instruction == OP_JUMP_IF_FALSE)){
+            chunk->code[second] = OP_JUMP;
+        }else{
+            remove_instruction(peephole, second);
+        }
+        return true;
+    }
+    if(instruction == OP_NOT){
+        write_literal(chunk, second, BOOL_VAL(is_falsey(a)));
+        remove_instruction(peephole, offset);
+        return true;
+    }
+    if(instruction == OP_NEGATE){
+        if(!IS_NUMBER(a) || !write_constant(peephole, offset, narrow_number(-AS_NUMBER(a)))) return false;
+        remove_instruction(peephole, second);
+        return true;
+    }
+
+    Value b;
+    if(!constant_value(peephole, second, &b)) return false;
+    int third = next_instruction(peephole, second);
+    if(third >= chunk->count || peephole->targets[third]) return false;
+
+    Value result;
+    if(!fold_binary(peephole, chunk->code[third], a, b, &result)) return false;
+    if(IS_NIL(result) || IS_BOOL(result)){
+        write_literal(chunk, third, result);
+        remove_instruction(peephole, offset);
+    }else{
+        //a number or string result means the first operand was a CONSTANT
+        if(!write_constant(peephole, offset, result)) return false;
+        remove_instruction(peephole, third);
+    }
+    remove_instruction(peephole, second);
+    return true;
+}
+
+// A local whose initializer folded down to one literal is replaced by that
+// literal wherever it is read. The local keeps its slot, only the reads go.
+static bool propagate_constants(Peephole* peephole, ConstantLocal* locals, int local_count){
+    Chunk* chunk = peephole->chunk;
+    bool changed = false;
+
+    for (int i = 0; i < local_count; i++) {
+        ConstantLocal* local = &locals[i];
+        int push = resolve(peephole, local->start);
+        Value value;
+        if(push >= local->end || next_instruction(peephole, push) < local->end ||
+           !constant_value(peephole, push, &value)) continue;
+
+        for (int offset = local->end; offset < local->scope_end; offset += instruction_length(chunk, offset)) {
+            if(peephole->removed[offset] || chunk->code[offset] != OP_GET_LOCAL ||
+               chunk->code[offset + 1] != local->slot) continue;
+            if(!write_constant(peephole, offset, value)) break;
+            changed = true;
+        }
+        //an empty range, the reads are done with
+        local->scope_end = local->end;
+    }
+    return changed;
+}
+
+static bool optimize_instruction(Peephole* peephole, int offset){
+    Chunk* chunk = peephole->chunk;
+    uint8_t instruction = chunk->code[offset];
+    int next = next_instruction(peephole, offset);
+    uint8_t following = opcode_at(peephole, next);
+
+    if(is_jump(instruction)) {
+        if(optimize_jump(peephole, offset)) return true;
+
+        //JUMP_IF_FALSE over a JUMP is the opposite branch to the JUMP's target
+        if(is_conditional(instruction) && following == OP_JUMP && !peephole->targets[next] &&
+           resolve(peephole, jump_target(chunk, offset)) == next_instruction(peephole, next)){
+            chunk->code[offset] = invert_branch(instruction);
+            if(!set_jump_target(chunk, offset, jump_target(chunk, next))){
+                chunk->code[offset] = instruction;
+                return false;
+            }
+            remove_instruction(peephole, next);
+            return true;
+        }
+        return false;
+    }
+
+    if(instruction == OP_NOT && invertible_branch(peephole, offset)){
+        chunk->code[next] = invert_branch(following);
+        remove_instruction(peephole, offset);
+        return true;
+    }
+
+    //x >= y is compiled as NOT (x < y), that also keeps NaN comparisons as they were
+    if(following == OP_NOT && complement(instruction) != OP_RETURN && !peephole->targets[next] &&
+       !invertible_branch(peephole, next)){
+        chunk->code[offset] = complement(instruction);
+        remove_instruction(peephole, next);
+        return true;
+    }
+
+    if(following == OP_POP && !peephole->targets[next]){
+        if(is_pure_push(instruction)){
+            remove_instruction(peephole, offset);
+            remove_instruction(peephole, next);
+            return true;
+        }
+
+        //an assignment statement followed by a read of the same variable keeps
+        //the assigned value on the stack instead
+        int read = next_instruction(peephole, next);
+        int length = instruction_length(chunk, offset);
+        if(reader_of(instruction) != OP_RETURN && opcode_at(peephole, read) == reader_of(instruction) &&
+           !peephole->targets[read] && memcmp(&chunk->code[offset + 1], &chunk->code[read + 1], length - 1) == 0){
+            remove_instruction(peephole, next);
+            remove_instruction(peephole, read);
+            return true;
+        }
+    }
+    return false;
+}
+
+//drops the removed instructions, jumps and the ranges of the locals are
+//re-aimed through the offset map
+static void compact(Peephole* peephole, ConstantLocal* locals, int local_count){
+    Chunk* chunk = peephole->chunk;
+    int* offsets = peephole->worklist;
+    int* destinations = malloc(sizeof(int) * (chunk->count + 1));
+    if(destinations == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+
+    int position = 0;
+    for (int i = 0; i < chunk->count; i += instruction_length(chunk, i)) {
+        offsets[i] = position;
+        if(!peephole->removed[i]) position += instruction_length(chunk, i);
+    }
+    offsets[chunk->count] = position;
+
+    for (int i = 0; i < local_count; i++) {
+        locals[i].start = offsets[locals[i].start];
+        locals[i].end = offsets[locals[i].end];
+        locals[i].scope_end = offsets[locals[i].scope_end];
+    }
+
+    //targets are read before any code moves, a LOOP looks back at moved bytes
+    for (int i = 0; i < chunk->count; i += instruction_length(chunk, i)) {
+        if(!peephole->removed[i] && is_jump(chunk->code[i])){
+            destinations[i] = offsets[resolve(peephole, jump_target(chunk, i))];
+        }
+        //a switch's entries count back from the switch itself, they are
+        //rewritten where they are and move along with it
+        if(!peephole->removed[i] && is_switch(chunk->code[i])){
+            for (int entry = 0; entry <= switch_entry_count(chunk->code, i); entry++) {
+                int target = switch_target(chunk->code, i, entry);
+                int distance = target > i ? 0 : offsets[i] - offsets[resolve(peephole, target)];
+                chunk->code[i + 5 + entry * 2] = (distance >> 8) & 0xff;
+                chunk->code[i + 6 + entry * 2] = distance & 0xff;
+            }
+        }
+    }
+
+    int count = chunk->count;
+    int i = 0;
+    while (i < count) {
+        int length = instruction_length(chunk, i);
+        if(!peephole->removed[i]){
+            int moved = offsets[i];
+            bool jump = is_jump(chunk->code[i]);
+            memmove(&chunk->code[moved], &chunk->code[i], length);
+            memmove(&chunk->lines[moved], &chunk->lines[i], sizeof(int) * length);
+            if(jump){
+                int distance = chunk->code[moved] == OP_LOOP ? moved + 3 - destinations[i] : destinations[i] - (moved + 3);
+                chunk->code[moved + 1] = (distance >> 8) & 0xff;
+                chunk->code[moved + 2] = distance & 0xff;
+            }
+        }
+        //the length of instruction i was read before anything moved over it
+        i += length;
+    }
+    chunk->count = position;
+    free(destinations);
+}
+
+//wide operands and jumps are left as they are, the pass only reads the short forms
+static bool has_wide(Chunk* chunk){
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset)) {
+        if(chunk->code[offset] == OP_WIDE) return true;
+    }
+    return false;
+}
+
+void optimize_peephole(LnVM* vm, ObjFun* function, ConstantLocal* locals, int local_count){
+    Chunk* chunk = &function->chunk;
+    int count = chunk->count;
+    if(has_wide(chunk)) return;
+
+    Peephole peephole;
+    peephole.vm = vm;
+    peephole.chunk = chunk;
+    peephole.removed = calloc(count + 1, sizeof(bool));
+    peephole.targets = calloc(count + 1, sizeof(bool));
+    peephole.reachable = calloc(count + 1, sizeof(bool));
+    peephole.worklist = malloc(sizeof(int) * (count + 1));
+    int* visited = malloc(sizeof(int) * (count + 1));
+    if(peephole.removed == NULL || peephole.targets == NULL || peephole.reachable == NULL ||
+       peephole.worklist == NULL || visited == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+
+    //every change removes an instruction or moves a jump further along a
+    //chain, the round limit only guards against cycles of jumps
+    bool changed = true;
+    for (int round = 0; changed && round < 16; round++) {
+        changed = propagate_constants(&peephole, locals, local_count);
+        analyze(&peephole);
+
+        int visited_count = 0;
+        int i = 0;
+        while (i < count) {
+            if(peephole.removed[i]){
+                i += instruction_length(chunk, i);
+                continue;
+            }
+            if(!peephole.reachable[i]){
+                //dead code after a RETURN or an unconditional jump
+                remove_instruction(&peephole, i);
+                changed = true;
+                continue;
+            }
+            if(fold_constant(&peephole, i)){
+                //the folded value may be the last operand of the instruction before
+                changed = true;
+                if(visited_count > 0) i = visited[--visited_count];
+                continue;
+            }
+            if(optimize_instruction(&peephole, i)) changed = true;
+            if(!peephole.removed[i]) visited[visited_count++] = i;
+            i += instruction_length(chunk, i);
+        }
+    }
+
+    compact(&peephole, locals, local_count);
+
+    free(peephole.removed);
+    free(peephole.targets);
+    free(peephole.reachable);
+    free(peephole.worklist);
+    free(visited);
+}
@@ -0,0 +1,598 @@
+#include "ln.h"
+
+// Register tier. A finished function's stack bytecode is translated into
+// three-address REG_* instructions whose operands name frame slots directly:
+// stack position p of the stack code becomes register p, so locals keep
+// their slot numbers and temporaries use the slots the stack would have.
+//
+// Translation walks the code with a symbolic stack. A GET_LOCAL or CONSTANT
+// only records where its value can be found; the value is copied into its
+// own register when something needs it there (a call, a jump, a write to the
+// local it aliases). That turns `a = b + c;` into a single REG_ADD.
+//
+// Functions using an instruction without a register form keep running the
+// stack code, so the tier can be switched on for any program.
+
+typedef enum{
+    OPERAND_REGISTER,
+    OPERAND_LOCAL,
+    OPERAND_CONSTANT,
+}OperandKind;
+
+typedef struct{
+    OperandKind kind;
+    //aliased register for OPERAND_LOCAL, constant index for OPERAND_CONSTANT
+    uint8_t index;
+}Operand;
+
+typedef struct{
+    int operand;
+    int target;
+}JumpFixup;
+
+typedef struct{
+    LnVM* vm;
+    Chunk* source;
+    Chunk* target;
+    Operand stack[UINT8_COUNT];
+    int depth;
+    int max_depth;
+    int line;
+
+    //register written by the last emitted instruction and where its destination byte is
+    int last_write;
+    int last_destination;
+
+    bool* targets;
+    int* depths;
+    int* offsets;
+    JumpFixup* fixups;
+    int fixup_count;
+}Translator;
+
+static void emit(Translator* translator, uint8_t byte){
+    write_chunk(translator->vm, translator->target, byte, translator->line);
+    translator->last_write = -1;
+}
+
+static void emit_instruction(Translator* translator, uint8_t instruction, uint8_t destination){
+    emit(translator, instruction);
+    int position = translator->target->count;
+    emit(translator, destination);
+    translator->last_write = destination;
+    translator->last_destination = position;
+}
+
+static void emit_jump(Translator* translator, int target){
+    translator->fixups[translator->fixup_count].operand = translator->target->count;
+    translator->fixups[translator->fixup_count].target = target;
+    translator->fixup_count++;
+    emit(translator, 0xff);
+    emit(translator, 0xff);
+}
+
+static void materialize(Translator* translator, int position){
+    Operand* operand = &translator->stack[position];
+    switch (operand->kind) {
+        case OPERAND_REGISTER:
+            return;
+        case OPERAND_LOCAL:
+            emit_instruction(translator, OP_REG_MOVE, position);
+            emit(translator, operand->index);
+            break;
+        case OPERAND_CONSTANT:
+            emit_instruction(translator, OP_REG_LOAD_CONSTANT, position);
+            emit(translator, operand->index);
+            break;
+    }
+    operand->kind = OPERAND_REGISTER;
+    operand->index = position;
+}
+
+static void flush(Translator* translator, int from, int to){
+    for (int i = from; i < to; i++) {
+        materialize(translator, i);
+    }
+}
+
+//register holding the value at a stack position, loading constants if needed
+static uint8_t operand_register(Translator* translator, int position){
+    Operand* operand = &translator->stack[position];
+    if(operand->kind == OPERAND_CONSTANT) materialize(translator, position);
+    return operand->kind == OPERAND_LOCAL ? operand->index : position;
+}
+
+static bool push_operand(Translator* translator, OperandKind kind, uint8_t index){
+    if(translator->depth >= UINT8_COUNT) return false;
+    translator->stack[translator->depth].kind = kind;
+    translator->stack[translator->depth].index = kind == OPERAND_REGISTER ? translator->depth : index;
+    translator->depth++;
+    if(translator->depth > translator->max_depth) translator->max_depth = translator->depth;
+    return true;
+}
+
+static bool record_depth(Translator* translator, int target){
+    if(translator->depths[target] == -1){
+        translator->depths[target] = translator->depth;
+        return true;
+    }
+    return translator->depths[target] == translator->depth;
+}
+
+static int jump_target(Chunk* chunk, int offset){
+    int jump = (chunk->code[offset + 1] << 8) | chunk->code[offset + 2];
+    return chunk->code[offset] == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+}
+
+static int call_arg_count(uint8_t* code, int offset){
+    return code[offset] == OP_CALL || code[offset] == OP_TAIL_CALL ? code[offset + 1] : code[offset] - OP_CALL_0;
+}
+
+static void binary(Translator* translator, uint8_t instruction){
+    int left = translator->depth - 2;
+    uint8_t b = operand_register(translator, left + 1);
+    uint8_t a = operand_register(translator, left);
+    translator->depth--;
+    translator->stack[left].kind = OPERAND_REGISTER;
+    translator->stack[left].index = left;
+    emit_instruction(translator, instruction, left);
+    emit(translator, a);
+    emit(translator, b);
+    translator->last_write = left;
+}
+
+static void binary_constant(Translator* translator, uint8_t instruction){
+    int left = translator->depth - 2;
+    uint8_t k = translator->stack[left + 1].index;
+    uint8_t a = operand_register(translator, left);
+    translator->depth--;
+    translator->stack[left].kind = OPERAND_REGISTER;
+    translator->stack[left].index = left;
+    emit_instruction(translator, instruction, left);
+    emit(translator, a);
+    emit(translator, k);
+    translator->last_write = left;
+}
+
+//NOT_EQUAL, GREATER_EQUAL and LESS_EQUAL, the comparison negated in place
+static void binary_not(Translator* translator, uint8_t instruction){
+    binary(translator, instruction);
+    int top = translator->depth - 1;
+    emit_instruction(translator, OP_REG_NOT, top);
+    emit(translator, top);
+    translator->last_write = top;
+}
+
+// LESS followed by a JUMP_IF_FALSE whose both successors pop the condition
+// becomes one compare-and-branch that never writes the condition.
+static bool fuse_less_jump(Translator* translator, int offset){
+    Chunk* source = translator->source;
+    int jump = offset + 1;
+    if(jump + 3 >= source->count || source->code[jump] != OP_JUMP_IF_FALSE) return false;
+    if(translator->targets[jump]) return false;
+    int target = jump_target(source, jump);
+    if(target >= source->count || source->code[target] != OP_POP || source->code[jump + 3] != OP_POP) return false;
+
+    int left = translator->depth - 2;
+    //the condition keeps its stack position until the POP on either path
+    if(translator->depths[target] != -1 && translator->depths[target] != left + 1) return false;
+
+    flush(translator, 0, left);
+    uint8_t a = operand_register(translator, left);
+    if(translator->stack[left + 1].kind == OPERAND_CONSTANT){
+        emit(translator, OP_REG_LESS_CONSTANT_JUMP);
+        emit(translator, a);
+        emit(translator, translator->stack[left + 1].index);
+    }else{
+        emit(translator, OP_REG_LESS_JUMP);
+        emit(translator, a);
+        emit(translator, operand_register(translator, left + 1));
+    }
+    translator->depth--;
+    translator->stack[left].kind = OPERAND_REGISTER;
+    translator->stack[left].index = left;
+    record_depth(translator, target);
+    emit_jump(translator, target);
+    return true;
+}
+
+static bool set_local(Translator* translator, uint8_t slot){
+    if(slot >= translator->depth - 1) return false;
+
+    //anything still aliasing the local must keep its old value
+    for (int i = slot + 1; i < translator->depth; i++) {
+        if(translator->stack[i].kind == OPERAND_LOCAL && translator->stack[i].index == slot){
+            materialize(translator, i);
+        }
+    }
+
+    int top = translator->depth - 1;
+    if(translator->last_write == top && translator->stack[top].kind == OPERAND_REGISTER){
+        //the value was just computed, compute it straight into the local
+        translator->target->code[translator->last_destination] = slot;
+    }else{
+        uint8_t value = operand_register(translator, top);
+        emit_instruction(translator, OP_REG_MOVE, slot);
+        emit(translator, value);
+    }
+    translator->stack[slot].kind = OPERAND_REGISTER;
+    translator->stack[slot].index = slot;
+    translator->stack[top].kind = OPERAND_LOCAL;
+    translator->stack[top].index = slot;
+    translator->last_write = -1;
+    return true;
+}
+
+//translates the instruction at offset, returns the offset of the next one or -1
+static int translate_instruction(Translator* translator, int offset){
+    Chunk* source = translator->source;
+    uint8_t* code = source->code;
+    int next = offset + 1 + get_arg_count(code, source->constants, offset);
+    int depth = translator->depth;
+    if(depth < 2 && (code[offset] == OP_EQUAL || code[offset] == OP_GREATER || code[offset] == OP_LESS ||
+                     code[offset] == OP_NOT_EQUAL || code[offset] == OP_GREATER_EQUAL || code[offset] == OP_LESS_EQUAL ||
+                     code[offset] == OP_ADD || code[offset] == OP_SUB || code[offset] == OP_MUL || code[offset] == OP_DIV)){
+        return -1;
+    }
+    if(depth < 1 && (code[offset] == OP_NOT || code[offset] == OP_NEGATE || code[offset] == OP_RETURN ||
+                     code[offset] == OP_JUMP_IF_FALSE || code[offset] == OP_JUMP_IF_TRUE || code[offset] == OP_SET_LOCAL)){
+        return -1;
+    }
+
+    switch (code[offset]) {
+        case OP_CONSTANT:
+            return push_operand(translator, OPERAND_CONSTANT, code[offset + 1]) ? next : -1;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:{
+            uint8_t instruction = code[offset] == OP_NIL ? OP_REG_LOAD_NIL :
+                                  code[offset] == OP_TRUE ? OP_REG_LOAD_TRUE : OP_REG_LOAD_FALSE;
+            if(!push_operand(translator, OPERAND_REGISTER, 0)) return -1;
+            emit_instruction(translator, instruction, depth);
+            return next;
+        }
+        case OP_GET_GLOBAL:
+        case OP_GET_MODULE:{
+            uint8_t instruction = code[offset] == OP_GET_GLOBAL ? OP_REG_GET_GLOBAL : OP_REG_GET_MODULE;
+            if(!push_operand(translator, OPERAND_REGISTER, 0)) return -1;
+            emit_instruction(translator, instruction, depth);
+            emit(translator, code[offset + 1]);
+            emit(translator, code[offset + 2]);
+            translator->last_write = depth;
+            return next;
+        }
+        case OP_POP:
+            if(depth == 0) return -1;
+            translator->depth--;
+            return next;
+        case OP_GET_LOCAL:{
+            uint8_t slot = code[offset + 1];
+            if(slot >= depth) return -1;
+            materialize(translator, slot);
+            return push_operand(translator, OPERAND_LOCAL, slot) ? next : -1;
+        }
+        case OP_SET_LOCAL:
+            return set_local(translator, code[offset + 1]) ? next : -1;
+        case OP_EQUAL: binary(translator, OP_REG_EQUAL); return next;
+        case OP_GREATER: binary(translator, OP_REG_GREATER); return next;
+        case OP_LESS:
+            if(fuse_less_jump(translator, offset)) return next + 3;
+            binary(translator, OP_REG_LESS);
+            return next;
+        case OP_ADD:
+            if(translator->stack[depth - 1].kind == OPERAND_CONSTANT) binary_constant(translator, OP_REG_ADD_CONSTANT);
+            else binary(translator, OP_REG_ADD);
+            return next;
+        case OP_SUB:
+            if(translator->stack[depth - 1].kind == OPERAND_CONSTANT) binary_constant(translator, OP_REG_SUB_CONSTANT);
+            else binary(translator, OP_REG_SUB);
+            return next;
+        case OP_MUL: binary(translator, OP_REG_MUL); return next;
+        case OP_DIV: binary(translator, OP_REG_DIV); return next;
+        case OP_NOT_EQUAL: binary_not(translator, OP_REG_EQUAL); return next;
+        case OP_GREATER_EQUAL: binary_not(translator, OP_REG_LESS); return next;
+        case OP_LESS_EQUAL: binary_not(translator, OP_REG_GREATER); return next;
+        case OP_NOT:
+        case OP_NEGATE:{
+            uint8_t value = operand_register(translator, depth - 1);
+            translator->stack[depth - 1].kind = OPERAND_REGISTER;
+            translator->stack[depth - 1].index = depth - 1;
+            emit_instruction(translator, code[offset] == OP_NOT ? OP_REG_NOT : OP_REG_NEGATE, depth - 1);
+            emit(translator, value);
+            translator->last_write = depth - 1;
+            return next;
+        }
+        case OP_JUMP:
+        case OP_LOOP:{
+            int target = jump_target(source, offset);
+            flush(translator, 0, translator->depth);
+            if(!record_depth(translator, target)) return -1;
+            emit(translator, code[offset]);
+            if(code[offset] == OP_JUMP){
+                emit_jump(translator, target);
+            }else{
+                int jump = translator->target->count + 2 - translator->offsets[target];
+                if(jump > UINT16_MAX) return -1;
+                emit(translator, (jump >> 8) & 0xff);
+                emit(translator, jump & 0xff);
+            }
+            translator->depth = -1;
+            return next;
+        }
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:{
+            int target = jump_target(source, offset);
+            flush(translator, 0, translator->depth);
+            if(!record_depth(translator, target)) return -1;
+            emit(translator, code[offset] == OP_JUMP_IF_FALSE ? OP_REG_JUMP_IF_FALSE : OP_REG_JUMP_IF_TRUE);
+            emit(translator, depth - 1);
+            emit_jump(translator, target);
+            return next;
+        }
+        case OP_INLINE_GUARD:{
+            int target = jump_target(source, offset);
+            int callee = depth - 1 - code[offset + 4];
+            if(callee < 0) return -1;
+            flush(translator, 0, translator->depth);
+            if(!record_depth(translator, target)) return -1;
+            emit(translator, OP_REG_INLINE_GUARD);
+            emit(translator, callee);
+            emit(translator, code[offset + 3]);
+            emit_jump(translator, target);
+            return next;
+        }
+        case OP_INLINE_RETURN:{
+            int callee = depth - 2 - code[offset + 1];
+            if(callee < 0) return -1;
+            Operand* result = &translator->stack[depth - 1];
+            //a constant or a register under the callee can stand in for the result
+            if(result->kind == OPERAND_CONSTANT || (result->kind == OPERAND_LOCAL && result->index < callee)){
+                translator->stack[callee] = *result;
+            }else if(translator->last_write == depth - 1 && result->kind == OPERAND_REGISTER){
+                //the result was just computed, compute it straight into the callee's slot
+                translator->target->code[translator->last_destination] = callee;
+                translator->stack[callee].kind = OPERAND_REGISTER;
+                translator->stack[callee].index = callee;
+                translator->last_write = -1;
+            }else{
+                uint8_t value = operand_register(translator, depth - 1);
+                emit_instruction(translator, OP_REG_MOVE, callee);
+                emit(translator, value);
+                translator->stack[callee].kind = OPERAND_REGISTER;
+                translator->stack[callee].index = callee;
+            }
+            translator->depth = callee + 1;
+            return next;
+        }
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CALL_0:
+        case OP_CALL_1:
+        case OP_CALL_2:
+        case OP_CALL_3:{
+            int arg_count = call_arg_count(code, offset);
+            int base = depth - arg_count - 1;
+            if(base < 0) return -1;
+            flush(translator, base, translator->depth);
+            emit(translator, code[offset] == OP_TAIL_CALL ? OP_REG_TAIL_CALL : OP_REG_CALL);
+            emit(translator, base);
+            emit(translator, arg_count);
+            translator->depth = base;
+            push_operand(translator, OPERAND_REGISTER, 0);
+            return next;
+        }
+        case OP_RETURN:{
+            uint8_t value = operand_register(translator, depth - 1);
+            emit(translator, OP_REG_RETURN);
+            emit(translator, value);
+            translator->depth = -1;
+            return next;
+        }
+        default:
+            return -1;
+    }
+}
+
+// Stack depth before every reachable instruction. A for loop's increment
+// clause is only reached by backward jumps, so this has to follow the
+// control flow rather than the code order.
+static bool compute_depths(Translator* translator, int arity){
+    Chunk* source = translator->source;
+    uint8_t* code = source->code;
+    int* worklist = malloc(sizeof(int) * (source->count + 1));
+    if(worklist == NULL) return false;
+
+    int count = 0;
+    translator->depths[0] = arity + 1;
+    worklist[count++] = 0;
+
+    bool valid = true;
+    while (valid && count > 0) {
+        int offset = worklist[--count];
+        int depth = translator->depths[offset];
+        int next = offset + 1 + get_arg_count(code, source->constants, offset);
+        int target = -1;
+        bool falls_through = true;
+
+        switch (code[offset]) {
+            case OP_CONSTANT:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_GLOBAL:
+            case OP_GET_MODULE:
+            case OP_GET_LOCAL:
+                depth++;
+                break;
+            case OP_POP:
+            case OP_EQUAL:
+            case OP_GREATER:
+            case OP_LESS:
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_NOT_EQUAL:
+            case OP_GREATER_EQUAL:
+            case OP_LESS_EQUAL:
+                depth--;
+                break;
+            case OP_SET_LOCAL:
+            case OP_NOT:
+            case OP_NEGATE:
+                break;
+            case OP_INLINE_RETURN:
+                depth -= code[offset + 1] + 1;
+                break;
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            case OP_CALL_0:
+            case OP_CALL_1:
+            case OP_CALL_2:
+            case OP_CALL_3:
+                depth -= call_arg_count(code, offset);
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE:
+            case OP_INLINE_GUARD:
+                target = jump_target(source, offset);
+                break;
+            case OP_JUMP:
+            case OP_LOOP:
+                target = jump_target(source, offset);
+                falls_through = false;
+                break;
+            case OP_RETURN:
+                falls_through = false;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if(!valid || depth < 1 || depth >= UINT8_COUNT) break;
+
+        int successors[2] = {falls_through ? next : -1, target};
+        for (int i = 0; i < 2; i++) {
+            int successor = successors[i];
+            if(successor == -1) continue;
+            if(successor < 0 || successor >= source->count){
+                valid = false;
+            }else if(translator->depths[successor] == -1){
+                translator->depths[successor] = depth;
+                worklist[count++] = successor;
+            }else if(translator->depths[successor] != depth){
+                valid = false;
+            }
+        }
+    }
+
+    free(worklist);
+    return valid && count == 0;
+}
+
+static bool translate(Translator* translator, int arity){
+    Chunk* source = translator->source;
+
+    for (int i = 0; i < source->count; i += 1 + get_arg_count(source->code, source->constants, i)) {
+        uint8_t instruction = source->code[i];
+        if(instruction == OP_JUMP || instruction == OP_JUMP_IF_FALSE || instruction == OP_JUMP_IF_TRUE || instruction == OP_LOOP ||
+           instruction == OP_INLINE_GUARD){
+            int target = jump_target(source, i);
+            if(target < 0 || target >= source->count) return false;
+            translator->targets[target] = true;
+        }
+    }
+
+    if(!compute_depths(translator, arity)) return false;
+
+    translator->depth = arity + 1;
+    translator->max_depth = arity + 1;
+    for (int i = 0; i < translator->depth; i++) {
+        translator->stack[i].kind = OPERAND_REGISTER;
+        translator->stack[i].index = i;
+    }
+
+    translator->line = source->count > 0 ? source->lines[0] : 0;
+    emit(translator, OP_REG_ENTER);
+    int frame_size = translator->target->count;
+    emit(translator, 0);
+
+    int offset = 0;
+    while (offset < source->count) {
+        translator->line = source->lines[offset];
+
+        if(translator->targets[offset] && translator->depths[offset] != -1){
+            if(translator->depth != -1){
+                flush(translator, 0, translator->depth);
+                if(!record_depth(translator, offset)) return false;
+            }
+            translator->depth = translator->depths[offset];
+            for (int i = 0; i < translator->depth; i++) {
+                translator->stack[i].kind = OPERAND_REGISTER;
+                translator->stack[i].index = i;
+            }
+            translator->last_write = -1;
+        }
+
+        translator->offsets[offset] = translator->target->count;
+        if(translator->depth == -1 || translator->depths[offset] == -1){
+            //unreachable, e.g. the implicit return after an explicit one
+            translator->depth = -1;
+            offset += 1 + get_arg_count(source->code, source->constants, offset);
+            continue;
+        }
+
+        offset = translate_instruction(translator, offset);
+        if(offset == -1) return false;
+    }
+
+    for (int i = 0; i < translator->fixup_count; i++) {
+        JumpFixup* fixup = &translator->fixups[i];
+        int jump = translator->offsets[fixup->target] - (fixup->operand + 2);
+        if(jump < 0 || jump > UINT16_MAX) return false;
+        translator->target->code[fixup->operand] = (jump >> 8) & 0xff;
+        translator->target->code[fixup->operand + 1] = jump & 0xff;
+    }
+
+    if(translator->max_depth >= UINT8_COUNT) return false;
+    translator->target->code[frame_size] = translator->max_depth;
+    return true;
+}
+
+// Fills function->registers when every instruction has a register form.
+// The register code shares the constants of function->chunk.
+bool translate_to_registers(LnVM* vm, ObjFun* function){
+    Chunk* source = &function->chunk;
+    int count = source->count;
+
+    Translator translator;
+    translator.vm = vm;
+    translator.source = source;
+    translator.target = &function->registers;
+    translator.last_write = -1;
+    translator.last_destination = -1;
+    translator.fixup_count = 0;
+    translator.targets = calloc(count + 1, sizeof(bool));
+    translator.depths = malloc(sizeof(int) * (count + 1));
+    translator.offsets = malloc(sizeof(int) * (count + 1));
+    translator.fixups = malloc(sizeof(JumpFixup) * (count + 1));
+
+    bool translated = false;
+    if(translator.targets != NULL && translator.depths != NULL && translator.offsets != NULL && translator.fixups != NULL){
+        for (int i = 0; i <= count; i++) translator.depths[i] = -1;
+        translated = translate(&translator, function->arity);
+    }
+
+    free(translator.targets);
+    free(translator.depths);
+    free(translator.offsets);
+    free(translator.fixups);
+
+    if(!translated){
+        free_chunk(vm, &function->registers);
+        function->register_count = 0;
+        return false;
+    }
+    function->register_count = translator.max_depth;
+    return true;
+}
@@ -125,17 +125,26 @@ static void skip_whitespace(Scanner* scanner){
 static Keyword keywords[] =
 {
     {"while", 5, TOKEN_WHILE},
-    {"if", 5, TOKEN_IF},
-    {"func", 5, TOKEN_FUNC},
-    {"for", 5, TOKEN_FOR},
-    {"return", 5, TOKEN_RETURN},
-    {"else", 5, TOKEN_ELSE},
-    {"var", 5, TOKEN_VAR},
+    {"if", 2, TOKEN_IF},
+    {"func", 4, TOKEN_FUNC},
+    {"for", 3, TOKEN_FOR},
+    {"return", 6, TOKEN_RETURN},
+    {"else", 4, TOKEN_ELSE},
+    {"var", 3, TOKEN_VAR},
     {"class", 5, TOKEN_CLASS},
     {"break", 5, TOKEN_BREAK},
-    {"continue", 5, TOKEN_CONTINUE},
-    {"import", 5, TOKEN_IMPORT},
-    {"NULL", 0, TOKEN_EOF}//sentinel
+    {"continue", 8, TOKEN_CONTINUE},
+    {"import", 6, TOKEN_IMPORT},
+    {"true", 4, TOKEN_TRUE},
+    {"false", 5, TOKEN_FALSE},
+    {"nil", 3, TOKEN_NIL},
+    {"this", 4, TOKEN_THIS},
+    {"super", 5, TOKEN_SUPER},
+    {"in", 2, TOKEN_IN},
+    {"switch", 6, TOKEN_SWITCH},
+    {"case", 4, TOKEN_CASE},
+    {"default", 7, TOKEN_DEFAULT},
+    {NULL, 0, TOKEN_EOF}//sentinel
 };
 
 static Token identifier(Scanner* scanner){
@@ -192,7 +201,7 @@ static Token hex_number(Scanner* scanner){
 }
 
 static Token string(Scanner* scanner, char string_token){
-    while(peek_scanner(scanner) == string_token && !is_end(scanner)){
+    while(peek_scanner(scanner) != string_token && !is_end(scanner)){
         advance(scanner);
         if(peek_scanner(scanner) == '\n') scanner->line++;
     }
@@ -226,8 +235,8 @@ Token scan_token(Scanner* scanner){
     case ';': return create_token(scanner,TOKEN_SEMICOLON);
     case ',': return create_token(scanner,TOKEN_COMMA);
     case '.': return create_token(scanner,TOKEN_DOT);
-    case '-': return create_token(scanner,TOKEN_MINUS);
-    case '+': return create_token(scanner,TOKEN_PLUS);
+    case '-': return create_token(scanner,match(scanner, '=') ? TOKEN_MINUSEQ : TOKEN_MINUS);
+    case '+': return create_token(scanner,match(scanner, '=') ? TOKEN_PLUSEQ : TOKEN_PLUS);
     case '/':
         if(match(scanner, '=')){
             return create_token(scanner,TOKEN_SLASHEQ);
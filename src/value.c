@@ -5,7 +5,12 @@
 
 
 
-bool values_equal(Value a, Value b);
+bool values_equal(Value a, Value b){
+    if(IS_NUMBER(a) && IS_NUMBER(b)){
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    return a == b;
+}
 
 void init_valueArray(ValueArray* array){
     array->value = NULL;
@@ -37,16 +42,6 @@ void gray_map(LnVM* vm, ObjMap* map){
     }
 }
 
-static inline uint32_t hash_bits(uint64_t hash){
-    hash = ~hash + (hash << 18);
-    hash = hash ^ (hash >> 31);
-    hash = hash * 21;
-    hash = hash ^ (hash >> 11);
-    hash = hash + (hash << 6);
-    hash = hash ^ (hash >> 22);
-    return (uint32_t) (hash & 0x3fffffff);
-}
-
 static uint32_t hash_object(Obj* object){
     switch (object->type){
         case OBJ_STRING: return ((ObjString*) object)->hash;
@@ -55,6 +50,8 @@ static uint32_t hash_object(Obj* object){
 }
 static uint32_t hash_value(Value value){
     if(IS_OBJ(value)) return hash_object(AS_OBJ(value));
+    //a double key finds the entry of the equal int, -0 included
+    if(IS_DOUBLE(value)) value = AS_NUMBER(value) == 0 ? INT_VAL(0) : narrow_number(AS_NUMBER(value));
     return hash_bits(value);
 }
 
@@ -185,14 +182,14 @@ bool map_delete(LnVM* vm, ObjMap* map, Value key){
 
 char* value_to_string(Value value){
     if(IS_BOOL(value)){
-        char *str = AS_BOOL(value) ? "true" : false;
+        char *str = AS_BOOL(value) ? "true" : "false";
         char* bool_string = malloc(sizeof(char) * (strlen(str) + 1));
         snprintf(bool_string, strlen(str) + 1, "%s", str);
         return bool_string;
 
     }else if(IS_NIL(value)){
-        char* nil_string = malloc(sizeof(char) * 4);
-        snprintf(nil_string, 4, "%s", "null");
+        char* nil_string = malloc(sizeof(char) * 5);
+        snprintf(nil_string, 5, "%s", "null");
         return nil_string;
     }else if(IS_NUMBER(value)){
         double number = AS_NUMBER(value);
@@ -201,7 +198,7 @@ char* value_to_string(Value value){
         snprintf(number_string,number_string_length,"%.15g", number);
         return number_string;
     }else if(IS_OBJ(value)){
-
+        return object_to_string(value);
     }
     char * unknown = malloc(sizeof(char) * 8);
 
@@ -9,18 +9,19 @@ static void reset_stack(LnVM* vm){
 }
 
 void runtime_error(LnVM* vm, const char* format, ...){
-    for (int i = vm->frame_count - 1; i > 0; i--) {
+    for (int i = vm->frame_count - 1; i >= 0; i--) {
         CallFrame* frame = &vm->frames[i];
 
         ObjFun * function = frame->closure->function;
 
-        size_t instruction = frame->ip - function->chunk.code - 1;
+        Chunk* chunk = function->register_count > 0 ? &function->registers : &function->chunk;
+        size_t instruction = frame->ip - chunk->code - 1;
 
         if(function->name == NULL){
-            fprintf(stderr, "File '%s', [line %d]\n", function->module->name->chars, function->chunk.lines[instruction]);
+            fprintf(stderr, "File '%s', [line %d]\n", function->module->name->chars, chunk->lines[instruction]);
             i = -1;
         } else{
-            fprintf(stderr, "Function '%s' in '%s', [line %d]\n", function->name->chars,function->module->name->chars, function->chunk.lines[instruction]);
+            fprintf(stderr, "Function '%s' in '%s', [line %d]\n", function->name->chars,function->module->name->chars, chunk->lines[instruction]);
         }
         va_list args;
                 va_start(args, format);
@@ -43,33 +44,47 @@ LnVM* init_vm(int argc, char **argv){
 
     memset(vm,'\0', sizeof(LnVM));
 
+    vm->stack = malloc(sizeof(Value) * STACK_INITIAL);
+    if(vm->stack == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+    vm->stack_capacity = STACK_INITIAL;
+    vm->stack_limit = vm->stack + STACK_INITIAL - STACK_HEADROOM;
+
     reset_stack(vm);
     vm->objects = NULL;
-    vm->frame_capacity = 4;
-    vm->frames = NULL;
     vm->init_string = NULL;
+    vm->class_string = NULL;
     vm->bytes_allocated = 0;
     vm->next_gc = 1024 * 1024;
     vm->gray_count =0;
     vm->gray_capacity = 0;
     vm->gray_stack = NULL;
     vm->last_module = NULL;
+    vm->class_epoch = 1;
     vm->argc = argc;
     vm->argv = argv;
+#ifdef LN_REGISTER_TIER
+    vm->register_tier = true;
+#endif
+    vm->optimize_level = 0;
     init_table(&vm->modules);
     init_table(&vm->globals);
+    init_valueArray(&vm->global_values);
     init_table(&vm->strings);
+    init_valueArray(&vm->symbols);
 
 
-    init_table(&vm->string_methods);
-    init_table(&vm->file_methods);
-    init_table(&vm->list_methods);
-    init_table(&vm->map_methods);
+    init_valueArray(&vm->string_methods);
+    init_valueArray(&vm->file_methods);
+    init_valueArray(&vm->list_methods);
+    init_valueArray(&vm->map_methods);
 
-    vm->frames = ALLOCATE(vm,CallFrame,vm->frame_count);
     vm->init_string = copy_string(vm,"init",4);
+    vm->class_string = copy_string(vm,"_class",6);
 
-    //TODO:Native functions
+    define_all_natives(vm);
 
     //TODO: Native methods
 
@@ -80,15 +95,19 @@ LnVM* init_vm(int argc, char **argv){
 void free_vm(LnVM* vm){
     free_table(vm,&vm->modules);
     free_table(vm,&vm->globals);
+    free_valueArray(vm,&vm->global_values);
     free_table(vm,&vm->strings);
+    free_valueArray(vm,&vm->symbols);
 
-    free_table(vm,&vm->string_methods);
-    free_table(vm,&vm->file_methods);
-    free_table(vm,&vm->list_methods);
-    free_table(vm,&vm->map_methods);
+    free_valueArray(vm,&vm->string_methods);
+    free_valueArray(vm,&vm->file_methods);
+    free_valueArray(vm,&vm->list_methods);
+    free_valueArray(vm,&vm->map_methods);
 
-    FREE_ARRAY(vm,CallFrame,vm->frames, vm->frame_capacity);
+    free(vm->opcode_pairs);
+    free(vm->stack);
     vm->init_string = NULL;
+    vm->class_string = NULL;
     free_objects(vm);
     free(vm);
 }
@@ -120,20 +139,51 @@ ObjClosure* compile_module_to_closure(LnVM* vm,char* name, char* source){
     pop(vm);
     return closure;
 }
+//moves the stack to a block with room for needed more values and fixes up
+//the frames and open upvalues pointing into it
+static void grow_stack(LnVM* vm, int needed){
+    int count = (int)(vm->stack_top - vm->stack);
+    int capacity = vm->stack_capacity;
+    while (capacity - STACK_HEADROOM < count + needed) capacity *= 2;
+
+    Value* stack = malloc(sizeof(Value) * capacity);
+    if(stack == NULL){
+        printf("Failed to allocate memory");
+        exit(71);
+    }
+    memcpy(stack, vm->stack, sizeof(Value) * count);
+
+    for (int i = 0; i < vm->frame_count; i++) {
+        vm->frames[i].slots = stack + (vm->frames[i].slots - vm->stack);
+    }
+    for (ObjUpvalue* upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->value = stack + (upvalue->value - vm->stack);
+    }
+
+    free(vm->stack);
+    vm->stack = stack;
+    vm->stack_top = stack + count;
+    vm->stack_capacity = capacity;
+    vm->stack_limit = stack + capacity - STACK_HEADROOM;
+}
+
 static bool call(LnVM* vm, ObjClosure* closure,int arg_count){
-    if(arg_count < closure->function->arity){
+    //extra arguments would sit in the callee's local slots
+    if(arg_count != closure->function->arity){
         runtime_error(vm,"Function '%s' expected %d argument(s) but got %d.", closure->function->name->chars,closure->function->arity,arg_count);
         return false;
     }
-    if(vm->frame_count == vm->frame_capacity){
-        int old_capacity = vm->frame_capacity;
-        vm->frame_capacity = GROW_CAPACITY(vm->frame_capacity);
-        vm->frames = GROW_ARRAY(vm,vm->frames, CallFrame,old_capacity,vm->frame_capacity);
+    if(vm->frame_count == FRAMES_MAX){
+        runtime_error(vm,"Stack overflow.");
+        return false;
+    }
+    if(vm->stack_top + closure->function->max_stack > vm->stack_limit){
+        grow_stack(vm, closure->function->max_stack);
     }
 
     CallFrame* frame = &vm->frames[vm->frame_count++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = closure->function->register_count > 0 ? closure->function->registers.code : closure->function->chunk.code;
 
     frame->slots = vm->stack_top - arg_count -1;
     return true;
@@ -150,7 +200,7 @@ static bool call_value(LnVM* vm, Value callee, int arg_count){
                 ObjClass* klass = AS_CLASS(callee);\
                 vm->stack_top[-arg_count - 1] = OBJ_VAL(new_instance(vm,klass));
                 Value initializer;
-                if(table_get(&klass->methods, vm->init_string, &initializer)){
+                if(method_get(&klass->methods, vm->init_string, &initializer)){
                     return call(vm, AS_CLOSURE(initializer),arg_count);
                 }else if(arg_count != 0){
                     runtime_error(vm,"Expected 0 arguments but got %d.",arg_count);
@@ -193,48 +243,273 @@ static bool call_native_method(LnVM* vm, Value method,int arg_count){
 
 static bool invoke_from_class(LnVM* vm,ObjClass* klass,ObjString* name,int arg_count){
     Value method;
-    if (!table_get(&klass->methods, name, &method)){
+    if (!method_get(&klass->methods, name, &method)){
         runtime_error(vm, "Undefined property '%s'.", name->chars);
         return false;
     }
     return call(vm, AS_CLOSURE(method),arg_count);
 }
 
-static bool invoke(LnVM* vm,ObjString* name, int arg_count){
+//entry of the receiver's shape in an inline cache, NULL on a miss
+static inline CacheEntry* find_cache_entry(InlineCache* cache, Shape* shape){
+    for (int i = 0; i < cache->count; i++) {
+        if(cache->entries[i].shape == shape) return &cache->entries[i];
+    }
+    return NULL;
+}
+
+//instances in dictionary mode have no shape and are never cached
+static void update_cache(InlineCache* cache, Shape* shape, CacheKind kind, int index, Shape* transition, Value method){
+    if(cache->megamorphic || shape == NULL) return;
+
+    CacheEntry* entry = find_cache_entry(cache,shape);
+    if(entry == NULL){
+        if(cache->count == INLINE_CACHE_SIZE){
+            cache->megamorphic = true;
+            cache->count = 0;
+            return;
+        }
+        entry = &cache->entries[cache->count++];
+        entry->shape = shape;
+    }
+    entry->kind = kind;
+    entry->index = index;
+    entry->transition = transition;
+    entry->method = method;
+}
+
+static bool get_field(ObjInstance* instance, ObjString* name, Value* value, InlineCache* cache){
+    if(instance->shape == NULL) return table_get(instance->dictionary,name,value);
+
+    int slot = shape_slot(instance->shape,name);
+    if(slot < 0) return false;
+    update_cache(cache,instance->shape,CACHE_FIELD,slot,NULL,NIL_VAL);
+    *value = instance->fields[slot];
+    return true;
+}
+
+static void set_field(LnVM* vm, ObjInstance* instance, ObjString* name, Value value, InlineCache* cache){
+    Shape* shape = instance->shape;
+    instance_set(vm,instance,name,value);
+    if(shape == NULL || instance->shape == NULL) return;
+
+    if(instance->shape == shape){
+        update_cache(cache,shape,CACHE_FIELD,shape_slot(shape,name),NULL,NIL_VAL);
+    }else{
+        update_cache(cache,shape,CACHE_TRANSITION,shape->field_count,instance->shape,NIL_VAL);
+    }
+}
+
+//replaces the receiver on top of the stack with method bound to it
+static void bind_closure(LnVM* vm, ObjClosure* method){
+    ObjBoundMethod* boundMethod = new_boundmethod(vm,peek(vm,0),method);
+    pop(vm);
+    push(vm, OBJ_VAL(boundMethod));
+}
+
+static bool bind_method(LnVM* vm, ObjClass* klass,ObjString* name){
+    Value method;
+    if(!method_get(&klass->methods,name, &method)){
+        return false;
+    }
+    bind_closure(vm,AS_CLOSURE(method));
+    return true;
+}
+
+static void type_error(LnVM* vm, const char* format, Value value){
+    int length = 0;
+    char* type = value_type_to_string(vm,value,&length);
+    runtime_error(vm,format,type);
+    FREE_ARRAY(vm,char,type,length + 1);
+}
+
+//rebuilds the flattened members from the superclass's, which are brought up
+//to date first, and the class's own properties on top
+static void flatten_members(LnVM* vm, ObjClass* klass){
+    free_table(vm,&klass->members);
+    if(klass->super_class != NULL){
+        if(klass->super_class->members_epoch != vm->class_epoch){
+            flatten_members(vm,klass->super_class);
+        }
+        table_add_all(vm,&klass->super_class->members,&klass->members);
+    }
+    table_add_all(vm,&klass->properties,&klass->members);
+    klass->members_epoch = vm->class_epoch;
+}
+
+//one probe of the flattened table however deep the class hierarchy is
+static bool class_property(LnVM* vm, ObjClass* klass, ObjString* name, Value* value){
+    if(klass->members_epoch != vm->class_epoch){
+        flatten_members(vm,klass);
+    }
+    return table_get(&klass->members,name,value);
+}
+
+//a class without subclasses updates its own flattened table in place, any
+//other change invalidates all of them
+static void set_class_property(LnVM* vm, ObjClass* klass, ObjString* name, Value value){
+    table_set(vm,&klass->properties,name,value);
+    if(klass->has_subclasses){
+        vm->class_epoch++;
+    }else if(klass->members_epoch == vm->class_epoch){
+        table_set(vm,&klass->members,name,value);
+    }
+}
+
+//stores the value on top of the stack in the receiver under it, both are
+//replaced with nil
+static bool set_property(LnVM* vm, ObjString* name, InlineCache* cache){
+    Value receiver = peek(vm,1);
+    if(IS_INSTANCE(receiver)){
+        set_field(vm,AS_INSTANCE(receiver),name,peek(vm,0),cache);
+    }else if(IS_CLASS(receiver)){
+        set_class_property(vm,AS_CLASS(receiver),name,peek(vm,0));
+    }else{
+        type_error(vm,"Cannot set property on type '%s'",receiver);
+        return false;
+    }
+    pop(vm);
+    vm->stack_top[-1] = NIL_VAL;
+    return true;
+}
+
+//replaces the receiver on top of the stack with its property
+static bool get_property(LnVM* vm, ObjString* name, InlineCache* cache){
+    Value receiver = peek(vm,0);
+    if(!IS_OBJ(receiver)){
+        type_error(vm,"'%s' type has no properties",receiver);
+        return false;
+    }
+
+    Value value;
+    switch (AS_OBJ(receiver)->type) {
+        case OBJ_INSTANCE:{
+            ObjInstance* instance = AS_INSTANCE(receiver);
+            ObjClass* klass = instance->klass;
+            CacheEntry* entry = find_cache_entry(cache,instance->shape);
+            if(entry != NULL && entry->kind == CACHE_METHOD){
+                bind_closure(vm,AS_CLOSURE(entry->method));
+                return true;
+            }
+
+            if(get_field(instance,name,&value,cache)){
+                pop(vm);
+                push(vm,value);
+                return true;
+            }
+            if(name == vm->class_string){
+                pop(vm);
+                push(vm,OBJ_VAL(klass));
+                return true;
+            }
+            if(method_get(&klass->methods,name,&value)){
+                update_cache(cache,instance->shape,CACHE_METHOD,0,NULL,value);
+                bind_closure(vm,AS_CLOSURE(value));
+                return true;
+            }
+
+            if(class_property(vm,klass,name,&value)){
+                pop(vm);
+                push(vm,value);
+                return true;
+            }
+            runtime_error(vm,"'%s' instance has no property: '%s'.",klass->name->chars,name->chars);
+            return false;
+        }
+        case OBJ_MODULE:{
+            ObjModule* module = AS_MODULE(receiver);
+            if(module_get(module,name,&value)){
+                pop(vm);
+                push(vm,value);
+                return true;
+            }
+            runtime_error(vm,"'%s' module had no property: '%s'.",module->name->chars,name->chars);
+            return false;
+        }
+        case OBJ_CLASS:{
+            ObjClass* klass = AS_CLASS(receiver);
+            if(class_property(vm,klass,name,&value)){
+                pop(vm);
+                push(vm,value);
+                return true;
+            }
+            runtime_error(vm,"'%s' class has no property: '%s'.",klass->name->chars,name->chars);
+            return false;
+        }
+        case OBJ_ENUM:{
+            ObjEnum* enumObj = AS_ENUM(receiver);
+            if(table_get(&enumObj->values,name,&value)){
+                pop(vm);
+                push(vm,value);
+                return true;
+            }
+            runtime_error(vm,"'%s' enum has no property: '%s'.",enumObj->name->chars,name->chars);
+            return false;
+        }
+        default:
+            type_error(vm,"'%s' type has no properties",receiver);
+            return false;
+    }
+}
+
+//calls what get_property finds for a name invoke() has no method for, or
+//fails with its error, so a.f() and (a.f)() always do what a.f does
+static bool invoke_property(LnVM* vm, ObjString* name, int arg_count, InlineCache* cache){
+    push(vm,peek(vm,arg_count));
+    if(!get_property(vm,name,cache)) return false;
+    Value value = pop(vm);
+    vm->stack_top[-arg_count - 1] = value;
+    return call_value(vm,value,arg_count);
+}
+
+static bool invoke(LnVM* vm,ObjString* name, int arg_count, InlineCache* cache){
     Value receiver = peek(vm,arg_count);
+    if(!IS_OBJ(receiver)) return invoke_property(vm,name,arg_count,cache);
 
     switch (AS_OBJ(receiver)->type) {
         case OBJ_MODULE:{
             ObjModule* module = AS_MODULE(receiver);
             Value value;
-            if(!table_get(&module->values, name, &value)){
-                runtime_error(vm,"Undefined property '%s'.", name->chars);
-                return false;
-            }
+            if(!module_get(module, name, &value)) return invoke_property(vm,name,arg_count,cache);
             return call_value(vm,value,arg_count);
         }
         case OBJ_CLASS:{
             ObjClass* instance = AS_CLASS(receiver);
             Value method;
-            if(table_get(&instance->methods, name,&method)){
+            if(method_get(&instance->methods, name,&method)){
                 return call_value(vm,method,arg_count);
             }
-            runtime_error(vm,"Undefined property '%s'.",name->chars);
-            return false;
+            return invoke_property(vm,name,arg_count,cache);
         }
         case OBJ_INSTANCE:{
             ObjInstance* instance = AS_INSTANCE(receiver);
+            ObjClass* klass = instance->klass;
             Value value;
-            if(table_get(&instance->fields,name,&value)){
-                vm->stack_top[-arg_count - 1] = value;
-                return call_value(vm,value,arg_count);
+            CacheEntry* entry = find_cache_entry(cache,instance->shape);
+            if(entry != NULL && entry->kind == CACHE_METHOD){
+                return call(vm,AS_CLOSURE(entry->method),arg_count);
             }
-            runtime_error(vm,"Undefined property '%s'",name->chars);
-            return false;
+
+            if(entry != NULL && entry->kind == CACHE_FIELD){
+                value = instance->fields[entry->index];
+            }else if(!get_field(instance,name,&value,cache)){
+                if(name == vm->class_string){
+                    value = OBJ_VAL(klass);
+                }else{
+                    Value method;
+                    if(method_get(&klass->methods,name,&method)){
+                        update_cache(cache,instance->shape,CACHE_METHOD,0,NULL,method);
+                        return call(vm,AS_CLOSURE(method),arg_count);
+                    }
+                    return invoke_property(vm,name,arg_count,cache);
+                }
+            }
+            vm->stack_top[-arg_count - 1] = value;
+            return call_value(vm,value,arg_count);
         }
         case OBJ_STRING:{
             Value value;
-            if(table_get(&vm->string_methods,name,&value)){
+            if(method_get(&vm->string_methods,name,&value)){
                 return call_native_method(vm,value,arg_count);
             }
             runtime_error(vm,"String has no method %s().", name->chars);
@@ -242,7 +517,7 @@ static bool invoke(LnVM* vm,ObjString* name, int arg_count){
         }
         case OBJ_LIST:{
             Value value;
-            if(table_get(&vm->list_methods,name,&value)){
+            if(method_get(&vm->list_methods,name,&value)){
                 if(IS_NATIVE(value)) return call_native_method(vm,value,arg_count);
 
                 push(vm, peek(vm,0));
@@ -257,7 +532,7 @@ static bool invoke(LnVM* vm,ObjString* name, int arg_count){
         }
         case OBJ_MAP:{
             Value value;
-            if(table_get(&vm->map_methods,name,&value)){
+            if(method_get(&vm->map_methods,name,&value)){
                 if(IS_NATIVE(value)) return call_native_method(vm,value,arg_count);
 
                 push(vm, peek(vm,0));
@@ -272,7 +547,7 @@ static bool invoke(LnVM* vm,ObjString* name, int arg_count){
         }
         case OBJ_FILE:{
             Value value;
-            if(table_get(&vm->file_methods,name,&value)){
+            if(method_get(&vm->file_methods,name,&value)){
                 return call_native_method(vm,value,arg_count);
             }
             runtime_error(vm,"File has no method %s().", name->chars);
@@ -285,25 +560,11 @@ static bool invoke(LnVM* vm,ObjString* name, int arg_count){
             if(table_get(&enumObj->values,name,&value)){
                 return call_value(vm,value,arg_count);
             }
-
-            runtime_error(vm,"'%s' enum has no property '%s'.",enumObj->name->chars,name->chars);
-            return false;
+            return invoke_property(vm,name,arg_count,cache);
         }
         default:
-            break;
+            return invoke_property(vm,name,arg_count,cache);
     }
-    runtime_error(vm,"Only instances have methods.");
-    return false;
-}
-static bool bind_method(LnVM* vm, ObjClass* klass,ObjString* name){
-    Value method;
-    if(!table_get(&klass->methods,name, &method)){
-        return false;
-    }
-    ObjBoundMethod* boundMethod = new_boundmethod(vm,peek(vm,0),AS_CLOSURE(method));
-    pop(vm);
-    push(vm, OBJ_VAL(boundMethod));
-    return true;
 }
 
 static ObjUpvalue* capture_upvalue(LnVM* vm, Value* local){
@@ -333,6 +594,26 @@ static ObjUpvalue* capture_upvalue(LnVM* vm, Value* local){
 
     return created_upvalue;
 }
+//fills closure's upvalues from the operands CLOSURE has after its function,
+//returns the ip past them
+static uint8_t* capture_upvalues(LnVM* vm, ObjClosure* closure, ObjClosure* enclosing, Value* slots, uint8_t* ip){
+    for (int i = 0; i < closure->upvalue_count; i++) {
+        uint8_t kind = *ip++;
+        uint16_t index = (uint16_t)((ip[0] << 8) | ip[1]);
+        ip += 2;
+        if (kind == CAPTURE_COPY) {
+            closure->upvalues[i] = copy_upvalue(closure, i, slots[index]);
+        } else if (kind == CAPTURE_LOCAL) {
+            closure->upvalues[i] = capture_upvalue(vm, slots + index);
+        } else {
+            ObjUpvalue* upvalue = enclosing->upvalues[index];
+            //a cell lives in the enclosing closure, which may be collected first
+            closure->upvalues[i] = is_copied_upvalue(enclosing, upvalue) ? copy_upvalue(closure, i, upvalue->closed) : upvalue;
+        }
+    }
+    return ip;
+}
+
 static void close_upvalues(LnVM* vm,Value* last){
     while (vm->open_upvalues != NULL && vm->open_upvalues->value >= last){
         ObjUpvalue* upvalue = vm->open_upvalues;
@@ -345,16 +626,89 @@ static void close_upvalues(LnVM* vm,Value* last){
 static void define_method(LnVM* vm, ObjString* name){
     Value method = peek(vm,0);
     ObjClass* klass = AS_CLASS(peek(vm,1));
-    table_set(vm,&klass->methods, name,method);
+    method_set(vm,&klass->methods, name,method);
     pop(vm);
 }
 
+//a subclass starts out with a copy of its superclass's vtable, before any
+//of its own methods are defined. Methods can't change after that, class
+//properties can and go through the flattened members instead
+static void inherit_methods(LnVM* vm, ObjClass* super_class, ObjClass* klass){
+    for (int i = 0; i < super_class->methods.count; i++) {
+        write_valueArray(vm,&klass->methods,super_class->methods.value[i]);
+    }
+    super_class->has_subclasses = true;
+    klass->members_epoch = 0;
+}
+
 static void create_class(LnVM* vm,ObjString* name,ObjClass* super_class){
     ObjClass* klass = new_class(vm,name,super_class);
     push(vm, OBJ_VAL(klass));
     if(super_class !=NULL){
-        table_add_all(vm,&super_class->methods,&klass->methods);
+        inherit_methods(vm,super_class,klass);
+    }
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LIKELY(condition) __builtin_expect(!!(condition), 1)
+#define INT_OVERFLOW(op, a, b, result) __builtin_##op##_overflow(a, b, result)
+#else
+#define LIKELY(condition) (condition)
+#define INT_OVERFLOW(op, a, b, result) int_##op##_overflow(a, b, result)
+static inline bool int_add_overflow(int32_t a, int32_t b, int32_t* result){
+    int64_t wide = (int64_t)a + b;
+    *result = (int32_t)wide;
+    return wide != *result;
+}
+static inline bool int_sub_overflow(int32_t a, int32_t b, int32_t* result){
+    int64_t wide = (int64_t)a - b;
+    *result = (int32_t)wide;
+    return wide != *result;
+}
+static inline bool int_mul_overflow(int32_t a, int32_t b, int32_t* result){
+    int64_t wide = (int64_t)a * b;
+    *result = (int32_t)wide;
+    return wide != *result;
+}
+#endif
+
+//arithmetic on two numbers. Integer operands stay on the integer ALU and only
+//fall back to doubles when the result leaves the int32 range. The int path is
+//marked likely, laid out the other way round counters ran slower than doubles
+static inline Value number_add(Value a, Value b){
+    int32_t result;
+    if(LIKELY(ARE_INTS(a, b)) && !INT_OVERFLOW(add, AS_INT(a), AS_INT(b), &result)) return INT_VAL(result);
+    if(IS_DOUBLE(a) && IS_DOUBLE(b)) return NUMBER_VAL(value_to_double(a) + value_to_double(b));
+    return NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+static inline Value number_sub(Value a, Value b){
+    int32_t result;
+    if(LIKELY(ARE_INTS(a, b)) && !INT_OVERFLOW(sub, AS_INT(a), AS_INT(b), &result)) return INT_VAL(result);
+    if(IS_DOUBLE(a) && IS_DOUBLE(b)) return NUMBER_VAL(value_to_double(a) - value_to_double(b));
+    return NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+static inline Value number_mul(Value a, Value b){
+    int32_t result;
+    //a zero product of a negative operand is -0, which only a double holds
+    if(LIKELY(ARE_INTS(a, b)) && !INT_OVERFLOW(mul, AS_INT(a), AS_INT(b), &result) &&
+       (result != 0 || (AS_INT(a) | AS_INT(b)) >= 0)){
+        return INT_VAL(result);
     }
+    if(IS_DOUBLE(a) && IS_DOUBLE(b)) return NUMBER_VAL(value_to_double(a) * value_to_double(b));
+    return NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+static inline bool number_less(Value a, Value b){
+    if(LIKELY(ARE_INTS(a, b))) return AS_INT(a) < AS_INT(b);
+    if(IS_DOUBLE(a) && IS_DOUBLE(b)) return value_to_double(a) < value_to_double(b);
+    return AS_NUMBER(a) < AS_NUMBER(b);
+}
+
+//operand of a bitwise operator, doubles are truncated
+static inline int32_t number_to_int(Value value){
+    return IS_INT(value) ? AS_INT(value) : (int32_t)AS_NUMBER(value);
 }
 
 bool is_falsey(Value value){
@@ -382,50 +736,303 @@ static void concatenate(LnVM* vm){
     push(vm, OBJ_VAL(result));
 }
 
+//replaces the two strings or lists on top of the stack with their sum
+static bool add_values(LnVM* vm){
+    if(IS_STRING(peek(vm,0)) && IS_STRING(peek(vm,1))){
+        concatenate(vm);
+        return true;
+    }
+    if(IS_LIST(peek(vm,0)) && IS_LIST(peek(vm,1))){
+        ObjList* first_list = AS_LIST(peek(vm,1));
+        ObjList* second_list = AS_LIST(peek(vm,0));
+
+        ObjList* final_list = new_list(vm);
+        push(vm,OBJ_VAL(final_list));
+        for (int i = 0; i < first_list->values.count; i++) {
+            write_valueArray(vm,&final_list->values,first_list->values.value[i]);
+        }
+        for (int i = 0; i < second_list->values.count; i++) {
+            write_valueArray(vm,&final_list->values,second_list->values.value[i]);
+        }
+        vm->stack_top -= 3;
+        push(vm,OBJ_VAL(final_list));
+        return true;
+    }
 
-static LnInterpretResult run(LnVM* vm){
-    CallFrame* frame = &vm->frames[vm->frame_count - 1];
-    register uint8_t* ip = frame->ip;
+    int first_length = 0;
+    int second_length = 0;
+    char* first = value_type_to_string(vm,peek(vm,1),&first_length);
+    char* second = value_type_to_string(vm,peek(vm,0),&second_length);
+    runtime_error(vm,"Unsupported operand types for +: '%s', '%s'",first,second);
+    FREE_ARRAY(vm,char,first,first_length + 1);
+    FREE_ARRAY(vm,char,second,second_length + 1);
+    return false;
+}
+
+
+static bool list_index(LnVM* vm, ObjList* list, Value index, int* position){
+    if(!IS_NUMBER(index)){
+        runtime_error(vm,"List index must be a number.");
+        return false;
+    }
+    int i = IS_INT(index) ? AS_INT(index) : (int)AS_NUMBER(index);
+    if(i < 0) i += list->values.count;
+    if(i < 0 || i >= list->values.count){
+        runtime_error(vm,"List index out of bounds.");
+        return false;
+    }
+    *position = i;
+    return true;
+}
+
+//pushes container[index] on success
+static bool subscript_get(LnVM* vm, Value container, Value index){
+    if(IS_LIST(container)){
+        ObjList* list = AS_LIST(container);
+        int position;
+        if(!list_index(vm,list,index,&position)) return false;
+        push(vm,list->values.value[position]);
+        return true;
+    }
+    if(IS_MAP(container)){
+        Value value;
+        if(!map_get(AS_MAP(container),index,&value)){
+            runtime_error(vm,"Key does not exist within map.");
+            return false;
+        }
+        push(vm,value);
+        return true;
+    }
+    if(IS_STRING(container)){
+        ObjString* string = AS_STRING(container);
+        if(!IS_NUMBER(index)){
+            runtime_error(vm,"String index must be a number.");
+            return false;
+        }
+        int i = (int)AS_NUMBER(index);
+        if(i < 0) i += string->length;
+        if(i < 0 || i >= string->length){
+            runtime_error(vm,"String index out of bounds.");
+            return false;
+        }
+        push(vm,OBJ_VAL(copy_string(vm,string->chars + i,1)));
+        return true;
+    }
+    runtime_error(vm,"Can only subscript lists, maps and strings.");
+    return false;
+}
+
+static bool subscript_set(LnVM* vm, Value container, Value index, Value value){
+    if(IS_LIST(container)){
+        ObjList* list = AS_LIST(container);
+        int position;
+        if(!list_index(vm,list,index,&position)) return false;
+        list->values.value[position] = value;
+        return true;
+    }
+    if(IS_MAP(container)){
+        map_set(vm,AS_MAP(container),index,value);
+        return true;
+    }
+    runtime_error(vm,"Can only assign to list and map subscripts.");
+    return false;
+}
+
+//steps the for-in loop whose sequence, cursor and variable start at
+//iterator. The cursor is the list index or map entry where the next element
+//is looked for. 1 with the element stored, 0 once there are no more and -1
+//when the sequence is neither a list nor a map
+static inline int iterate(Value* iterator){
+    Value sequence = iterator[0];
+    int index = AS_INT(iterator[1]);
+    if(IS_LIST(sequence)){
+        ObjList* list = AS_LIST(sequence);
+        if(index >= list->values.count) return 0;
+        iterator[1] = INT_VAL(index + 1);
+        iterator[2] = list->values.value[index];
+        return 1;
+    }
+    if(IS_MAP(sequence)){
+        ObjMap* map = AS_MAP(sequence);
+        //the map may have grown or shrunk since the last pass
+        for (; index <= map->capacity_mask; index++) {
+            if(IS_EMPTY(map->entries[index].key)) continue;
+            iterator[1] = INT_VAL(index + 1);
+            iterator[2] = map->entries[index].key;
+            return 1;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+//the same over a range, iterator holds the next number and the end
+static inline int iterate_range(Value* iterator){
+    Value next = iterator[0];
+    Value end = iterator[1];
+    if(IS_INT(next) && IS_INT(end)){
+        if(AS_INT(next) >= AS_INT(end)) return 0;
+        iterator[0] = INT_VAL(AS_INT(next) + 1);
+        iterator[2] = next;
+        return 1;
+    }
+    if(!IS_NUMBER(next) || !IS_NUMBER(end)) return -1;
+    if(!(AS_NUMBER(next) < AS_NUMBER(end))) return 0;
+    iterator[0] = narrow_number(AS_NUMBER(next) + 1);
+    iterator[2] = next;
+    return 1;
+}
+
+//the TABLE_SWITCH entry subject picks, 0 (the default) unless it is a
+//number equal to an int from low to low + count - 1
+static inline int table_entry(Value subject, int32_t low, int count){
+    //a double finds the equal int, -0 included, like a map key
+    if(IS_DOUBLE(subject)) subject = AS_NUMBER(subject) == 0 ? INT_VAL(0) : narrow_number(AS_NUMBER(subject));
+    if(!IS_INT(subject)) return 0;
+    int64_t index = (int64_t)AS_INT(subject) - low;
+    return index >= 0 && index < count ? (int)index + 1 : 0;
+}
+
+//where a switch continues, table is its default entry after which the
+//others follow. An entry is the distance back from the switch instruction
+//to its arm, 0 carries on after the table
+static inline uint8_t* switch_jump(uint8_t* instruction, uint8_t* table, int count, int entry){
+    uint16_t distance = (uint16_t)((table[entry * 2] << 8) | table[entry * 2 + 1]);
+    return distance == 0 ? table + (count + 1) * 2 : instruction - distance;
+}
+
+// run() keeps the hot interpreter state out of LnVM: ip, sp (the stack
+// top), slots (the frame's locals) and constants (the running function's
+// constant table) live in locals, or in handler arguments for the tail-call
+// build. vm->stack_top and frame->ip are only brought up to date by
+// STORE_FRAME, which must run before anything that reads the VM stack or can
+// allocate (and so collect garbage): calls, helpers, errors.
 #define READ_BYTE() (*ip++)
 #define READ_SHORT() \
         (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
-#define READ_CONSTANT() \
-        (frame->closure->function->chunk.constants.value[READ_BYTE()])
+#define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE() (&frame->closure->function->chunk.caches[READ_SHORT()])
+
+#define PUSH(value) (*sp++ = (value))
+#define POP() (*--sp)
+#define PEEK(distance) (sp[-1 - (distance)])
+
+#define STORE_FRAME \
+    do{             \
+        frame->ip = ip; \
+        vm->stack_top = sp; \
+    }while(false)
+
+//after a helper that pushed or popped through vm->stack_top
+#define LOAD_STACK() (sp = vm->stack_top)
+
+//after a call or return changed the current frame
+#define LOAD_FRAME() \
+    do{              \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        ip = frame->ip; \
+        slots = frame->slots; \
+        constants = frame->closure->function->chunk.constants.value; \
+    }while(false)
+
+//register tier frames keep sp at the top of their register window
+#define LOAD_REGISTER_TOP() \
+    do{                     \
+        if(frame->closure->function->register_count > 0){ \
+            sp = slots + frame->closure->function->register_count; \
+        }                   \
+    }while(false)
+
+//pushes the frame of a closure called with as many arguments as it takes and stack room
+//right here, anything else goes through call_value
+#define CALL_VALUE(arg_count) \
+    do{                       \
+        Value callee = PEEK(arg_count); \
+        if(IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == (arg_count) && vm->frame_count < FRAMES_MAX && \
+           sp + AS_CLOSURE(callee)->function->max_stack <= vm->stack_limit){ \
+            ObjFun* function = AS_CLOSURE(callee)->function; \
+            frame->ip = ip;   \
+            frame = &vm->frames[vm->frame_count++]; \
+            frame->closure = AS_CLOSURE(callee); \
+            frame->slots = slots = sp - (arg_count) - 1; \
+            ip = function->register_count > 0 ? function->registers.code : function->chunk.code; \
+            constants = function->chunk.constants.value; \
+        }else{                \
+            STORE_FRAME;      \
+            if(!call_value(vm, callee, arg_count)){ \
+                return INTERPRET_RUNTIME_ERROR; \
+            }                 \
+            LOAD_FRAME();     \
+            LOAD_STACK();     \
+        }                     \
+    }while(false)
+
+//a closure called from return position replaces the running function inside
+//its frame and dispatches, anything else falls through to a regular call
+#define TAIL_CALL_VALUE(arg_count) \
+    do{                            \
+        Value callee = PEEK(arg_count); \
+        if(IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == (arg_count) && \
+           slots + (arg_count) + 1 + AS_CLOSURE(callee)->function->max_stack <= vm->stack_limit){ \
+            ObjFun* function = AS_CLOSURE(callee)->function; \
+            close_upvalues(vm, slots); \
+            memmove(slots, sp - (arg_count) - 1, sizeof(Value) * ((arg_count) + 1)); \
+            sp = slots + (arg_count) + 1; \
+            frame->closure = AS_CLOSURE(callee); \
+            ip = function->register_count > 0 ? function->registers.code : function->chunk.code; \
+            constants = function->chunk.constants.value; \
+            DISPATCH();            \
+        }                          \
+    }while(false)
+
+//result is an expression of the operands a and b, op names the operator in errors
+#define REGISTER_BINARY_OP(result,op) \
+    do{                               \
+        uint8_t destination = READ_BYTE(); \
+        Value a = slots[READ_BYTE()]; \
+        Value b = slots[READ_BYTE()]; \
+        if(!ARE_NUMBERS(a, b)){ \
+            PUSH(a);                  \
+            PUSH(b);                  \
+            UNSUPPORTED_OPERAND_TYPE_ERROR(op) \
+        }                             \
+        slots[destination] = (result); \
+    }while(false)
 
 #define UNSUPPORTED_OPERAND_TYPE_ERROR(op)\
+    STORE_FRAME;\
     int first_val_length = 0;\
     int second_val_length = 0;\
-    char* first_val = value_type_to_string(vm, peek(vm,1),&first_val_length);\
-    char* second_val = value_type_to_string(vm, peek(vm,0), &second_val_length);\
-    STORE_FRAME;\
+    char* first_val = value_type_to_string(vm, PEEK(1),&first_val_length);\
+    char* second_val = value_type_to_string(vm, PEEK(0), &second_val_length);\
     runtime_error(vm,"Unsupported operand types for "#op": '%s', '%s'", first_val, second_val);\
     FREE_ARRAY(vm,char,first_val,first_val_length + 1);\
     FREE_ARRAY(vm,char,second_val,second_val_length + 1);\
     return INTERPRET_RUNTIME_ERROR;\
 
-#define BINARY_OP(value_type,op,type) \
+//result is an expression of the operands a and b, op names the operator in errors
+#define BINARY_OP(result,op) \
     do{                               \
-        if(!IS_NUMBER(peek(vm,0)) || !IS_NUMBER(peek(vm,1))){ \
+        if(!ARE_NUMBERS(PEEK(0), PEEK(1))){ \
             UNSUPPORTED_OPERAND_TYPE_ERROR(op)                \
         }                             \
-        type b = AS_NUMBER(pop(vm));  \
-        type a =AS_NUMBER(peek(vm,0));\
-        vm->stack_top[-1] = value_type(a op b);\
+        Value b = POP();              \
+        Value a = PEEK(0);            \
+        sp[-1] = (result);            \
     }while(false)
 
-#define BINARY_OP_FUNCTION(value_type,op,func,type) \
+//bitwise operators work on the operands as int32
+#define INT_BINARY_OP(result,op) \
     do{                               \
-        if(!IS_NUMBER(peek(vm,0)) || !IS_NUMBER(peek(vm,1))){ \
+        if(!ARE_NUMBERS(PEEK(0), PEEK(1))){ \
             UNSUPPORTED_OPERAND_TYPE_ERROR(op)                \
         }                             \
-        type b = AS_NUMBER(pop(vm));  \
-        type a =AS_NUMBER(peek(vm,0));\
-        vm->stack_top[-1] = value_type(func(a,b));\
+        int32_t b = number_to_int(POP()); \
+        int32_t a = number_to_int(PEEK(0)); \
+        sp[-1] = INT_VAL(result);     \
     }while(false)
 
-#define STORE_FRAME frame->ip = ip
-
 #define RUNTIME_ERROR(...) \
     do{                    \
         STORE_FRAME;       \
@@ -437,342 +1044,173 @@ static LnInterpretResult run(LnVM* vm){
     do{                                    \
         STORE_FRAME;                       \
         int val_length=0;                  \
-        char* val = value_type_to_string(vm, peek(vm, distance), &val_length);\
+        char* val = value_type_to_string(vm, PEEK(distance), &val_length);\
         runtime_error(vm,error,val); \
         FREE_ARRAY(vm,char,val,val_length + 1);\
+        return INTERPRET_RUNTIME_ERROR;\
     }while(0)
 
+//rewrites the opcode of the executing instruction in place
+#define QUICKEN(name) (ip[-1] = OP_##name)
+
+//puts the generic opcode back and runs the instruction again through it
+#define DEOPTIMIZE(name) \
+    do{                  \
+        ip[-1] = OP_##name; \
+        ip--;            \
+        DISPATCH();      \
+    }while(false)
+
+#define QUICK_BINARY_OP(result,generic) \
+    do{                               \
+        Value b = PEEK(0);            \
+        Value a = PEEK(1);            \
+        if(!ARE_NUMBERS(a, b)) DEOPTIMIZE(generic); \
+        sp[-2] = (result);            \
+        sp--;                         \
+    }while(false)
+
+#ifdef LN_OPCODE_PROFILE
+// Counts every executed (previous, next) opcode pair so new
+// superinstructions can be picked from real programs, see print_opcode_stats().
+static void profile_opcode(LnVM* vm, uint8_t instruction){
+    if(vm->opcode_pairs == NULL){
+        vm->opcode_pairs = calloc(UINT8_COUNT * UINT8_COUNT, sizeof(uint64_t));
+        if(vm->opcode_pairs == NULL) return;
+    }
+    vm->opcode_pairs[vm->last_opcode * UINT8_COUNT + instruction]++;
+    vm->last_opcode = instruction;
+}
+#define PROFILE_OPCODE(instruction) profile_opcode(vm, instruction)
+#else
+#define PROFILE_OPCODE(instruction) ((void)0)
+#endif
+
+#if defined(TAIL_CALL_DISPATCH)
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+#ifndef MUSTTAIL
+#define MUSTTAIL
+#endif
+
+#define HANDLER_PARAMS LnVM* vm, CallFrame* frame, uint8_t* ip, Value* sp, Value* slots, Value* constants
+
+typedef LnInterpretResult (*OpHandler)(HANDLER_PARAMS);
+
+#define OPCODE(name) static LnInterpretResult op_##name(HANDLER_PARAMS);
+#include "src/opcodes.h"
+#undef OPCODE
+
+static const OpHandler dispatch_table[] = {
+#define OPCODE(name) op_##name,
+#include "src/opcodes.h"
+#undef OPCODE
+};
+
+#define CASE_CODE(name) static LnInterpretResult op_##name(HANDLER_PARAMS)
+#define DISPATCH() \
+    do{            \
+        PROFILE_OPCODE(*ip); \
+        MUSTTAIL return dispatch_table[*ip](vm, frame, ip + 1, sp, slots, constants); \
+    }while(false)
+
+#include "vm_handlers.h"
+
+static LnInterpretResult run(LnVM* vm){
+    CallFrame* frame;
+    uint8_t* ip;
+    Value* slots;
+    Value* constants;
+    LOAD_FRAME();
+    Value* sp = vm->stack_top;
+    PROFILE_OPCODE(*ip);
+    return dispatch_table[*ip](vm, frame, ip + 1, sp, slots, constants);
+}
+
+#undef HANDLER_PARAMS
+
+#else
+
+static LnInterpretResult run(LnVM* vm){
+    CallFrame* frame;
+    register uint8_t* ip;
+    register Value* sp;
+    Value* slots;
+    Value* constants;
+    LOAD_FRAME();
+    LOAD_STACK();
+
 #ifdef COMPUTED_GOTO
 
     static void* dispatch_table[] = {
         #define OPCODE(name) &&op_##name,
-        #include "opcodes.h"
+        #include "src/opcodes.h"
         #undef OPCODE
     };
     #define INTERPRET_LOOP DISPATCH();
-    #define CASE_CODE(name) op_##name
-    #if DEBUG_TRACE_EXECUTION
-    #else
-        #define DISPATCH() \
-            do{            \
-                goto *dispactch_table[instruction = READ_BYTE()]               \
-            }while(false)
-    #endif
+    #define CASE_CODE(name) op_##name:
+    #define DISPATCH() \
+        do{            \
+            PROFILE_OPCODE(*ip); \
+            goto *dispatch_table[READ_BYTE()]; \
+        }while(false)
 
 #else
+    uint8_t instruction;
     #define INTERPRET_LOOP \
         loop:\
+        PROFILE_OPCODE(*ip);\
         switch (instruction = READ_BYTE())
 
     #define DISPATCH() goto loop
-    #define CASE_CODE(name) case OP_##name
+    #define CASE_CODE(name) case OP_##name:
 #endif
 
-
-    uint8_t instruction;
     INTERPRET_LOOP {
-    CASE_CODE(CONSTANT): {
-        Value constant = READ_CONSTANT();
-        push(vm, constant);
-        DISPATCH();
-    }
-    CASE_CODE(NIL): {
-        push(vm, NIL_VAL);
-        DISPATCH();
-    }
-    CASE_CODE(EMPTY): {
-        push(vm, EMPTY_VAL);
-        DISPATCH();
-    }
-    CASE_CODE(TRUE): {
-        push(vm, BOOL_VAL(true));
-        DISPATCH();
-    }
-    CASE_CODE(FALSE): {
-        push(vm, BOOL_VAL(false));
-        DISPATCH();
-    }
-    CASE_CODE(POP): {
-        pop(vm);
-        DISPATCH();
-    }
-    CASE_CODE(GET_LOCAL): {
-        uint8_t slot = READ_BYTE();
-        push(vm, frame->slots[slot]);
-        DISPATCH();
-    }
-    CASE_CODE(SET_LOCAL): {
-        uint8_t slot = READ_BYTE();
-        frame->slots[slot] = peek(vm, 0);
-        DISPATCH();
-    }
-    CASE_CODE(GET_GLOBAL): {
-        ObjString *name = READ_STRING();
-        Value value;
-        if (!table_get(&vm->globals, name, &value)) {
-            RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
-        }
-        push(vm, value);
-        DISPATCH();
-    }
-    CASE_CODE(GET_MODULE): {
-        ObjString *name = READ_STRING();
-        Value value;
-        if (!table_get(&frame->closure->function->module->values, name, &value)) {
-            RUNTIME_ERROR("Undefined variable '%s'.", name->chars);
-        }
-
-        push(vm, value);
-        DISPATCH();
-    }
-    CASE_CODE(DEFINE_MODULE): {
-        ObjString *defineName = READ_STRING();
-        table_set(vm, &frame->closure->function->module->values, defineName, peek(vm, 0));
-        pop(vm);
-        DISPATCH();
-    }
-    CASE_CODE(SET_MODULE): {
-        ObjString *setName = READ_STRING();
-        if (table_set(vm, &frame->closure->function->module->values, setName, peek(vm, 0))) {
-            table_delete(&frame->closure->function->module->values, setName);
-            RUNTIME_ERROR("Undefined variable '%s'.", setName->chars);
-        }
-        DISPATCH();
-    }
-    CASE_CODE(GET_UPVALUE): {
-        uint8_t slot = READ_BYTE();
-        push(vm, *frame->closure->upvalues[slot]->value);
-        DISPATCH();
-    }
-    CASE_CODE(SET_UPVALUE): {
-        uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->value = peek(vm, 0);
-        DISPATCH();
-    }
-    CASE_CODE(GET_PROPERTY): {
-        Value receiver = peek(vm, 0);
-        if (!IS_OBJ(receiver)) {
-            RUNTIME_ERROR_TYPE("'%s' type has no properties", 0);
-        }
-        switch (AS_OBJ(receiver)->type) {
-            case OBJ_INSTANCE: {
-                ObjInstance *instance = AS_INSTANCE(receiver);
-                ObjString *name = READ_STRING();
-                Value value;
-                if (table_get(&instance->fields, name, &value)) {
-                    pop(vm);
-                    push(vm, value);
-                    DISPATCH();
-                }
-                if (bind_method(vm, instance->klass, name)) {
-                    DISPATCH();
-                }
-                ObjClass *klass = instance->klass;
-
-                while (klass != NULL) {
-                    if (table_get(&klass->properties, name, &value)) {
-                        pop(vm);
-                        push(vm, value);
-                        DISPATCH();
-                    }
-
-                    klass = klass->super_class;
-                }
-                RUNTIME_ERROR("'%s' module has no property: '%s'.", instance->klass->name->chars, name->chars);
-            }
-            case OBJ_MODULE: {
-                ObjModule *module = AS_MODULE(receiver);
-                ObjString *name = READ_STRING();
-                Value value;
-                if (table_get(&module->values, name, &value)) {
-                    pop(vm);
-                    push(vm, value);
-                    DISPATCH();
-                }
-                RUNTIME_ERROR("'%s' module had no property: '%s'.", module->name->chars, name->chars);
-            }
-            case OBJ_CLASS: {
-                ObjClass *klass = AS_CLASS(receiver);
-                ObjClass *klassStore = klass;
-                ObjString *name = READ_STRING();
-
-                Value value;
-                while (klass != NULL) {
-                    if (table_get(&klass->properties, name, &value)) {
-                        pop(vm);
-                        push(vm, value);
-                        DISPATCH();
-                    }
-                    klass = klass->super_class;
-                }
-
-                RUNTIME_ERROR("'%s' class has no property: '%s'.", klassStore->name->chars, name->chars);
-            }
-            case OBJ_ENUM: {
-                ObjEnum *enumObj = AS_ENUM(receiver);
-                ObjString *name = READ_STRING();
-                Value value;
-                if (table_get(&enumObj->values, name, &value)) {
-                    pop(vm);
-                    push(vm, value);
-                    DISPATCH();
-                }
-                RUNTIME_ERROR("'%s' enum has no property: '%s'.", enumObj->name->chars, name->chars);
-            }
-            default:
-                RUNTIME_ERROR_TYPE("'%s' type has no properties", 0);
-        }
-    }
-    CASE_CODE(SET_PROPERTY): {
-        if (IS_INSTANCE(peek(vm, 1))) {
-            ObjInstance *instance = AS_INSTANCE(peek(vm, 1));
-            table_set(vm, &instance->fields, READ_STRING(), peek(vm, 0));
-            pop(vm);
-            pop(vm);
-            push(vm, NIL_VAL);
-            DISPATCH();
-        } else if (IS_CLASS(peek(vm, 1))) {
-            ObjString *key = READ_STRING();
-            ObjClass *klass = AS_CLASS(peek(vm, 1));
-
-            table_set(vm, &klass->properties, key, peek(vm, 0));
-            pop(vm);
-            pop(vm);
-            push(vm, NIL_VAL);
-            DISPATCH();
-        }
-        RUNTIME_ERROR_TYPE("Cannot set property on type '%s'", 1);
+#include "vm_handlers.h"
+#ifndef COMPUTED_GOTO
+    default:
+        RUNTIME_ERROR("Unknown opcode %d.", instruction);
+#endif
     }
-    CASE_CODE(GET_SUPER): {
-        ObjString *name = READ_STRING();
-        ObjClass *super_class = AS_CLASS(pop(vm));
 
-        if (!bind_method(vm, super_class, name)) {
-            RUNTIME_ERROR("Undefined property '%s'.", name->chars);
-        }
-        DISPATCH();
-    }
-    CASE_CODE(EQUAL): {
-        Value b = pop(vm);
-        Value a = pop(vm);
-        push(vm, BOOL_VAL(values_equal(a, b)));
-        DISPATCH();
-    }
-    CASE_CODE(GREATER): {
-        BINARY_OP(BOOL_VAL, >, double);
-        DISPATCH();
-    }
-    CASE_CODE(LESS): {
-        BINARY_OP(BOOL_VAL, <, double);
-        DISPATCH();
-    }
-    CASE_CODE(ADD): {
-        if (IS_STRING(peek(vm, 0)) && IS_STRING(peek(vm, 1))) {
-            concatenate(vm);
-        } else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) {
-            double b = AS_NUMBER(pop(vm));
-            double a = AS_NUMBER(pop(vm));
-            push(vm, NUMBER_VAL(a + b));
-        } else if (IS_LIST(peek(vm, 0)) && IS_LIST(peek(vm, 1))) {
-            ObjList *first_list = AS_LIST(peek(vm, 1));
-            ObjList *second_list = AS_LIST(peek(vm, 0));
-
-            ObjList *final_list = new_list(vm);
-            push(vm, OBJ_VAL(final_list));
-            for (int i = 0; i < first_list->values.count; i++) {
-                write_valueArray(vm, &final_list->values, first_list->values.value[i]);
-            }
-            for (int i = 0; i < second_list->values.count; i++) {
-                write_valueArray(vm, &final_list->values, second_list->values.value[i]);
-            }
-            pop(vm);
-            pop(vm);
-            pop(vm);
-            push(vm, OBJ_VAL(final_list));
-        } else {
-            UNSUPPORTED_OPERAND_TYPE_ERROR(+);
-        }
-        DISPATCH();
-    }
-    CASE_CODE(SUB): {
-        BINARY_OP(NUMBER_VAL, -, double);
-        DISPATCH();
-    }
-    CASE_CODE(MUL): {
-        BINARY_OP(NUMBER_VAL, *, double);
-        DISPATCH();
-    }
-    CASE_CODE(DIV): {
-        BINARY_OP(NUMBER_VAL, /, double);
-        DISPATCH();
-    }
-    CASE_CODE(BITWISE_AND): {
-        BINARY_OP(NUMBER_VAL, &, int);
-        DISPATCH();
-    }
-    CASE_CODE(BITWISE_OR): {
-        BINARY_OP(NUMBER_VAL, |, int);
-        DISPATCH();
-    }
-    CASE_CODE(BITWISE_XOR): {
-        BINARY_OP(NUMBER_VAL, ^, int);
-        DISPATCH();
-    }
-    CASE_CODE(NOT): {
-        push(vm, BOOL_VAL(is_falsey(pop(vm))));
-        DISPATCH();
-    }
-    CASE_CODE(NEGATE): {
-        if (!IS_NUMBER(peek(vm, 0))) {
-            RUNTIME_ERROR_TYPE("Unsupported operand type for unary -: '%s'", 0);
-        }
-        push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
-        DISPATCH();
-    }
-    CASE_CODE(LEFT_SHIFT): {
-        BINARY_OP(NUMBER_VAL, <<, int);
-        DISPATCH();
-    }
-    CASE_CODE(RIGHT_SHIFT): {
-        BINARY_OP(NUMBER_VAL, >>, int);
-        DISPATCH();
-    }
-    CASE_CODE(JUMP): {
-        uint16_t offset = READ_SHORT();
-        ip += offset;
-        DISPATCH();
-    }
-    CASE_CODE(JUMP_IF_FALSE): {
-        uint16_t offset = READ_SHORT();
-        if (is_falsey(peek(vm, 0))) ip += offset;
-        DISPATCH();
-    }
-    CASE_CODE(LOOP):{
-        uint16_t offset = READ_SHORT();
-        ip -= offset;
-        DISPATCH();
-    }
-    CASE_CODE(BREAK):{
-        DISPATCH();
-    }
-    CASE_CODE(IMPORT):{
-        ObjString* file_name = READ_STRING();
-        Value module_val;
-        //already imported
-        if(table_get(&vm->modules, file_name, &module_val)){
-            vm->last_module = AS_MODULE(module_val);
-            push(vm, NIL_VAL);
-            DISPATCH();
-        }
+    return INTERPRET_OK;
+}
 
-        char path[PATH_MAX];
-        //TODO: Complete rest of intructions
-//        if(!resolve_path(frame->closure->function->module->path->chars, file_name->chars,path)){
-//            RUNTIME_ERROR("Could not open file \"%s\".",file_name->chars);
-//        }
-        DISPATCH();
-    }
-  }
+#endif
 
-    return INTERPRET_OK;
-}
\ No newline at end of file
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef READ_CACHE
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_FRAME
+#undef LOAD_STACK
+#undef LOAD_FRAME
+#undef LOAD_REGISTER_TOP
+#undef CALL_VALUE
+#undef TAIL_CALL_VALUE
+#undef REGISTER_BINARY_OP
+#undef QUICKEN
+#undef DEOPTIMIZE
+#undef QUICK_BINARY_OP
+#undef DISPATCH
+#undef CASE_CODE
+#undef PROFILE_OPCODE
+
+LnInterpretResult interpret(LnVM* vm, char* module_name, char* source){
+    ObjClosure* closure = compile_module_to_closure(vm, module_name, source);
+    if(closure == NULL) return INTERPRET_COMPILER_ERROR;
+
+    push(vm, OBJ_VAL(closure));
+    call(vm, closure, 0);
+
+    return run(vm);
+}
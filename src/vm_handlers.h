@@ -0,0 +1,982 @@
+// Opcode handlers for run(). This file is included by vm.c once per
+// dispatch strategy: inside the switch / computed goto loop, or at file scope
+// where every CASE_CODE() becomes its own tail-called handler function.
+// It relies on the READ_* / DISPATCH / RUNTIME_ERROR macros from vm.c and
+// works on the cached ip / sp / slots / constants; see STORE_FRAME there.
+// Locals whose address escapes live in an inner block that closes before
+// DISPATCH() so the tail-call build can still turn it into a jump.
+
+CASE_CODE(CONSTANT) {
+    Value constant = READ_CONSTANT();
+    PUSH(constant);
+    DISPATCH();
+}
+CASE_CODE(NIL) {
+    PUSH(NIL_VAL);
+    DISPATCH();
+}
+CASE_CODE(EMPTY) {
+    PUSH(EMPTY_VAL);
+    DISPATCH();
+}
+CASE_CODE(TRUE) {
+    PUSH(BOOL_VAL(true));
+    DISPATCH();
+}
+CASE_CODE(FALSE) {
+    PUSH(BOOL_VAL(false));
+    DISPATCH();
+}
+CASE_CODE(POP) {
+    sp--;
+    DISPATCH();
+}
+CASE_CODE(GET_LOCAL) {
+    uint8_t slot = READ_BYTE();
+    PUSH(slots[slot]);
+    DISPATCH();
+}
+CASE_CODE(SET_LOCAL) {
+    uint8_t slot = READ_BYTE();
+    slots[slot] = PEEK(0);
+    DISPATCH();
+}
+CASE_CODE(GET_GLOBAL) {
+    PUSH(vm->global_values.value[READ_SHORT()]);
+    DISPATCH();
+}
+CASE_CODE(GET_MODULE) {
+    ObjModule *module = frame->closure->function->module;
+    uint16_t slot = READ_SHORT();
+    Value value = module->values.value[slot];
+    if (IS_EMPTY(value)) {
+        RUNTIME_ERROR("Undefined variable '%s'.", module_slot_name(module, slot)->chars);
+    }
+    PUSH(value);
+    DISPATCH();
+}
+CASE_CODE(DEFINE_MODULE) {
+    uint16_t slot = READ_SHORT();
+    frame->closure->function->module->values.value[slot] = POP();
+    DISPATCH();
+}
+CASE_CODE(SET_MODULE) {
+    ObjModule *module = frame->closure->function->module;
+    uint16_t slot = READ_SHORT();
+    if (IS_EMPTY(module->values.value[slot])) {
+        RUNTIME_ERROR("Undefined variable '%s'.", module_slot_name(module, slot)->chars);
+    }
+    module->values.value[slot] = PEEK(0);
+    DISPATCH();
+}
+CASE_CODE(GET_UPVALUE) {
+    uint8_t slot = READ_BYTE();
+    PUSH(*frame->closure->upvalues[slot]->value);
+    DISPATCH();
+}
+CASE_CODE(SET_UPVALUE) {
+    uint8_t slot = READ_BYTE();
+    *frame->closure->upvalues[slot]->value = PEEK(0);
+    DISPATCH();
+}
+CASE_CODE(GET_PROPERTY) {
+    ObjString *name = READ_STRING();
+    InlineCache *cache = READ_CACHE();
+    if (IS_INSTANCE(PEEK(0))) {
+        ObjInstance *instance = AS_INSTANCE(PEEK(0));
+        CacheEntry *entry = find_cache_entry(cache, instance->shape);
+        if (entry != NULL && entry->kind == CACHE_FIELD) {
+            sp[-1] = instance->fields[entry->index];
+            DISPATCH();
+        }
+    }
+    STORE_FRAME;
+    if (!get_property(vm, name, cache)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(SET_PROPERTY) {
+    ObjString *name = READ_STRING();
+    InlineCache *cache = READ_CACHE();
+    if (IS_INSTANCE(PEEK(1))) {
+        ObjInstance *instance = AS_INSTANCE(PEEK(1));
+        CacheEntry *entry = find_cache_entry(cache, instance->shape);
+        if (entry != NULL && (entry->kind == CACHE_FIELD ||
+                              (entry->kind == CACHE_TRANSITION && entry->index < instance->capacity))) {
+            instance->fields[entry->index] = PEEK(0);
+            if (entry->kind == CACHE_TRANSITION) instance->shape = entry->transition;
+            sp--;
+            sp[-1] = NIL_VAL;
+            DISPATCH();
+        }
+    }
+    STORE_FRAME;
+    if (!set_property(vm, name, cache)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(GET_SUPER) {
+    ObjString *name = READ_STRING();
+    ObjClass *super_class = AS_CLASS(POP());
+
+    STORE_FRAME;
+    if (!bind_method(vm, super_class, name)) {
+        RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+    }
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(EQUAL) {
+    Value b = POP();
+    Value a = PEEK(0);
+    //two ints are equal exactly when their bits are
+    sp[-1] = BOOL_VAL(ARE_INTS(a, b) ? a == b : values_equal(a, b));
+    DISPATCH();
+}
+CASE_CODE(GREATER) {
+    BINARY_OP(BOOL_VAL(number_less(b, a)), >);
+    QUICKEN(GREATER_NUM);
+    DISPATCH();
+}
+CASE_CODE(LESS) {
+    BINARY_OP(BOOL_VAL(number_less(a, b)), <);
+    QUICKEN(LESS_NUM);
+    DISPATCH();
+}
+// The complements are NOT of the comparison, so NaN operands give true.
+CASE_CODE(GREATER_EQUAL) {
+    BINARY_OP(BOOL_VAL(!number_less(a, b)), >=);
+    DISPATCH();
+}
+CASE_CODE(LESS_EQUAL) {
+    BINARY_OP(BOOL_VAL(!number_less(b, a)), <=);
+    DISPATCH();
+}
+CASE_CODE(NOT_EQUAL) {
+    Value b = POP();
+    Value a = PEEK(0);
+    sp[-1] = BOOL_VAL(!(ARE_INTS(a, b) ? a == b : values_equal(a, b)));
+    DISPATCH();
+}
+CASE_CODE(ADD) {
+    if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        QUICKEN(ADD_NUM);
+        Value b = POP();
+        sp[-1] = number_add(PEEK(0), b);
+        DISPATCH();
+    }
+    if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) QUICKEN(ADD_STR);
+    STORE_FRAME;
+    if (!add_values(vm)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(SUB) {
+    BINARY_OP(number_sub(a, b), -);
+    QUICKEN(SUB_NUM);
+    DISPATCH();
+}
+CASE_CODE(MUL) {
+    BINARY_OP(number_mul(a, b), *);
+    QUICKEN(MUL_NUM);
+    DISPATCH();
+}
+CASE_CODE(DIV) {
+    BINARY_OP(NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b)), /);
+    DISPATCH();
+}
+CASE_CODE(BITWISE_AND) {
+    INT_BINARY_OP(a & b, &);
+    DISPATCH();
+}
+CASE_CODE(BITWISE_OR) {
+    INT_BINARY_OP(a | b, |);
+    DISPATCH();
+}
+CASE_CODE(BITWISE_XOR) {
+    INT_BINARY_OP(a ^ b, ^);
+    DISPATCH();
+}
+CASE_CODE(NOT) {
+    sp[-1] = BOOL_VAL(is_falsey(PEEK(0)));
+    DISPATCH();
+}
+CASE_CODE(NEGATE) {
+    if (!IS_NUMBER(PEEK(0))) {
+        RUNTIME_ERROR_TYPE("Unsupported operand type for unary -: '%s'", 0);
+    }
+    sp[-1] = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+    DISPATCH();
+}
+CASE_CODE(LEFT_SHIFT) {
+    INT_BINARY_OP((int32_t)((uint32_t)a << (b & 31)), <<);
+    DISPATCH();
+}
+CASE_CODE(RIGHT_SHIFT) {
+    INT_BINARY_OP(a >> (b & 31), >>);
+    DISPATCH();
+}
+CASE_CODE(JUMP) {
+    uint16_t offset = READ_SHORT();
+    ip += offset;
+    DISPATCH();
+}
+CASE_CODE(JUMP_IF_FALSE) {
+    uint16_t offset = READ_SHORT();
+    if (is_falsey(PEEK(0))) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(JUMP_IF_TRUE) {
+    uint16_t offset = READ_SHORT();
+    if (!is_falsey(PEEK(0))) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(LOOP) {
+    uint16_t offset = READ_SHORT();
+    ip -= offset;
+    DISPATCH();
+}
+CASE_CODE(BREAK) {
+    DISPATCH();
+}
+CASE_CODE(IMPORT) {
+    ObjString* file_name = READ_STRING();
+    {
+        Value module_val;
+        //already imported
+        if(table_get(&vm->modules, file_name, &module_val)){
+            vm->last_module = AS_MODULE(module_val);
+        }
+    }
+    PUSH(NIL_VAL);
+
+    //TODO: Complete rest of intructions
+//        char path[PATH_MAX];
+//        if(!resolve_path(frame->closure->function->module->path->chars, file_name->chars,path)){
+//            RUNTIME_ERROR("Could not open file \"%s\".",file_name->chars);
+//        }
+    DISPATCH();
+}
+CASE_CODE(DEFINE_GLOBAL) {
+    vm->global_values.value[READ_SHORT()] = POP();
+    DISPATCH();
+}
+CASE_CODE(SET_GLOBAL) {
+    vm->global_values.value[READ_SHORT()] = PEEK(0);
+    DISPATCH();
+}
+CASE_CODE(CALL) {
+    int arg_count = READ_BYTE();
+    CALL_VALUE(arg_count);
+    DISPATCH();
+}
+CASE_CODE(CALL_0) {
+    CALL_VALUE(0);
+    DISPATCH();
+}
+CASE_CODE(CALL_1) {
+    CALL_VALUE(1);
+    DISPATCH();
+}
+CASE_CODE(CALL_2) {
+    CALL_VALUE(2);
+    DISPATCH();
+}
+CASE_CODE(CALL_3) {
+    CALL_VALUE(3);
+    DISPATCH();
+}
+CASE_CODE(TAIL_CALL) {
+    int arg_count = READ_BYTE();
+    TAIL_CALL_VALUE(arg_count);
+    //anything else is called normally and returned by the RETURN that follows
+    CALL_VALUE(arg_count);
+    DISPATCH();
+}
+CASE_CODE(INLINE_GUARD) {
+    uint16_t offset = READ_SHORT();
+    ObjFun *function = AS_FUNC(READ_CONSTANT());
+    Value callee = PEEK(READ_BYTE());
+    //the offset counts from the end of its own operand like every other jump
+    if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function == function) ip += offset - 2;
+    DISPATCH();
+}
+CASE_CODE(INLINE_RETURN) {
+    int count = READ_BYTE();
+    sp[-count - 2] = sp[-1];
+    sp -= count + 1;
+    DISPATCH();
+}
+CASE_CODE(INVOKE) {
+    ObjString *method = READ_STRING();
+    int arg_count = READ_BYTE();
+    InlineCache *cache = READ_CACHE();
+    STORE_FRAME;
+    if (!invoke(vm, method, arg_count, cache)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(SUPER_INVOKE) {
+    ObjString *method = READ_STRING();
+    int arg_count = READ_BYTE();
+    ObjClass *super_class = AS_CLASS(POP());
+    STORE_FRAME;
+    if (!invoke_from_class(vm, super_class, method, arg_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_FRAME();
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(WIDE) {
+    //a short operand for the instruction that follows, 24 bits for a jump
+    uint8_t instruction = READ_BYTE();
+    switch (instruction) {
+        case OP_CONSTANT:
+            PUSH(constants[READ_SHORT()]);
+            break;
+        case OP_GET_LOCAL:
+            PUSH(slots[READ_SHORT()]);
+            break;
+        case OP_SET_LOCAL:
+            slots[READ_SHORT()] = PEEK(0);
+            break;
+        case OP_GET_UPVALUE:
+            PUSH(*frame->closure->upvalues[READ_SHORT()]->value);
+            break;
+        case OP_SET_UPVALUE:
+            *frame->closure->upvalues[READ_SHORT()]->value = PEEK(0);
+            break;
+        case OP_CLOSURE: {
+            ObjFun *function = AS_FUNC(constants[READ_SHORT()]);
+            STORE_FRAME;
+            ObjClosure *closure = new_closure(vm, function);
+            PUSH(OBJ_VAL(closure));
+            STORE_FRAME;
+            ip = capture_upvalues(vm, closure, frame->closure, slots, ip);
+            break;
+        }
+        //the named instructions skip their cached fast paths
+        case OP_GET_PROPERTY: {
+            ObjString *name = AS_STRING(constants[READ_SHORT()]);
+            InlineCache *cache = READ_CACHE();
+            STORE_FRAME;
+            if (!get_property(vm, name, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STACK();
+            break;
+        }
+        case OP_SET_PROPERTY: {
+            ObjString *name = AS_STRING(constants[READ_SHORT()]);
+            InlineCache *cache = READ_CACHE();
+            STORE_FRAME;
+            if (!set_property(vm, name, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_STACK();
+            break;
+        }
+        case OP_GET_SUPER: {
+            ObjString *name = AS_STRING(constants[READ_SHORT()]);
+            ObjClass *super_class = AS_CLASS(POP());
+            STORE_FRAME;
+            if (!bind_method(vm, super_class, name)) {
+                RUNTIME_ERROR("Undefined property '%s'.", name->chars);
+            }
+            LOAD_STACK();
+            break;
+        }
+        case OP_INVOKE: {
+            ObjString *method = AS_STRING(constants[READ_SHORT()]);
+            int arg_count = READ_BYTE();
+            InlineCache *cache = READ_CACHE();
+            STORE_FRAME;
+            if (!invoke(vm, method, arg_count, cache)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            LOAD_STACK();
+            break;
+        }
+        case OP_SUPER_INVOKE: {
+            ObjString *method = AS_STRING(constants[READ_SHORT()]);
+            int arg_count = READ_BYTE();
+            ObjClass *super_class = AS_CLASS(POP());
+            STORE_FRAME;
+            if (!invoke_from_class(vm, super_class, method, arg_count)) {
+                return INTERPRET_RUNTIME_ERROR;
+            }
+            LOAD_FRAME();
+            LOAD_STACK();
+            break;
+        }
+        case OP_CLASS:
+        case OP_METHOD: {
+            ObjString *name = AS_STRING(constants[READ_SHORT()]);
+            STORE_FRAME;
+            if (instruction == OP_CLASS) {
+                create_class(vm, name, NULL);
+            } else {
+                define_method(vm, name);
+            }
+            LOAD_STACK();
+            break;
+        }
+        case OP_COPY_LITERAL: {
+            Value literal = constants[READ_SHORT()];
+            STORE_FRAME;
+            PUSH(IS_LIST(literal) ? OBJ_VAL(copy_list(vm, AS_LIST(literal))) : OBJ_VAL(copy_map(vm, AS_MAP(literal))));
+            break;
+        }
+        case OP_FOR_ITER:
+        case OP_FOR_RANGE: {
+            uint32_t offset = READ_BYTE() << 16;
+            offset |= READ_SHORT();
+            Value *iterator = &slots[READ_SHORT()];
+            int more = instruction == OP_FOR_ITER ? iterate(iterator) : iterate_range(iterator);
+            if (more < 0) {
+                RUNTIME_ERROR(instruction == OP_FOR_ITER ? "Can only iterate over lists, maps and ranges." : "Range bounds must be numbers.");
+            }
+            if (!more) ip += offset - 2;
+            break;
+        }
+        default: {
+            uint32_t offset = READ_BYTE() << 16;
+            offset |= READ_SHORT();
+            if (instruction == OP_LOOP) {
+                ip -= offset;
+            } else if (instruction == OP_JUMP ||
+                       (instruction == OP_JUMP_IF_FALSE && is_falsey(PEEK(0))) ||
+                       (instruction == OP_JUMP_IF_TRUE && !is_falsey(PEEK(0)))) {
+                ip += offset;
+            }
+            break;
+        }
+    }
+    DISPATCH();
+}
+CASE_CODE(CLOSURE) {
+    ObjFun *function = AS_FUNC(READ_CONSTANT());
+    STORE_FRAME;
+    ObjClosure *closure = new_closure(vm, function);
+    PUSH(OBJ_VAL(closure));
+    STORE_FRAME;
+    ip = capture_upvalues(vm, closure, frame->closure, slots, ip);
+    DISPATCH();
+}
+CASE_CODE(CLOSE_UPVALUE) {
+    close_upvalues(vm, sp - 1);
+    sp--;
+    DISPATCH();
+}
+CASE_CODE(RETURN) {
+    Value result = POP();
+    close_upvalues(vm, slots);
+    vm->frame_count--;
+    if (vm->frame_count == 0) {
+        vm->stack_top = sp - 1;
+        return INTERPRET_OK;
+    }
+    sp = slots;
+    PUSH(result);
+    LOAD_FRAME();
+    LOAD_REGISTER_TOP();
+    DISPATCH();
+}
+CASE_CODE(CLASS) {
+    ObjString *name = READ_STRING();
+    STORE_FRAME;
+    create_class(vm, name, NULL);
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(INHERIT) {
+    Value super_class = PEEK(1);
+    if (!IS_CLASS(super_class)) {
+        RUNTIME_ERROR("Superclass must be a class.");
+    }
+    ObjClass *klass = AS_CLASS(PEEK(0));
+    klass->super_class = AS_CLASS(super_class);
+    STORE_FRAME;
+    inherit_methods(vm, AS_CLASS(super_class), klass);
+    sp--;
+    DISPATCH();
+}
+CASE_CODE(METHOD) {
+    ObjString *name = READ_STRING();
+    STORE_FRAME;
+    define_method(vm, name);
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(NEW_LIST) {
+    int count = READ_BYTE();
+    STORE_FRAME;
+    ObjList *list = new_list(vm);
+    PUSH(OBJ_VAL(list));
+    STORE_FRAME;
+    for (int i = count; i > 0; i--) {
+        write_valueArray(vm, &list->values, PEEK(i));
+    }
+    sp -= count + 1;
+    PUSH(OBJ_VAL(list));
+    DISPATCH();
+}
+CASE_CODE(NEW_MAP) {
+    int count = READ_BYTE();
+    STORE_FRAME;
+    ObjMap *map = new_map(vm);
+    PUSH(OBJ_VAL(map));
+    STORE_FRAME;
+    for (int i = count * 2; i > 0; i -= 2) {
+        map_set(vm, map, PEEK(i), PEEK(i - 1));
+    }
+    sp -= count * 2 + 1;
+    PUSH(OBJ_VAL(map));
+    DISPATCH();
+}
+CASE_CODE(FOR_ITER) {
+    uint16_t offset = READ_SHORT();
+    int more = iterate(&slots[READ_SHORT()]);
+    if (more < 0) RUNTIME_ERROR("Can only iterate over lists, maps and ranges.");
+    //the offset counts from the end of its own operand like every other jump
+    if (!more) ip += offset - 2;
+    DISPATCH();
+}
+CASE_CODE(FOR_RANGE) {
+    uint16_t offset = READ_SHORT();
+    int more = iterate_range(&slots[READ_SHORT()]);
+    if (more < 0) RUNTIME_ERROR("Range bounds must be numbers.");
+    if (!more) ip += offset - 2;
+    DISPATCH();
+}
+CASE_CODE(TABLE_SWITCH) {
+    uint8_t *instruction = ip - 1;
+    int32_t low = AS_INT(constants[READ_SHORT()]);
+    int count = READ_SHORT();
+    ip = switch_jump(instruction, ip, count, table_entry(POP(), low, count));
+    DISPATCH();
+}
+CASE_CODE(HASH_SWITCH) {
+    uint8_t *instruction = ip - 1;
+    ObjMap *labels = AS_MAP(constants[READ_SHORT()]);
+    int count = READ_SHORT();
+    //the map holds the entry of each label's arm
+    Value entry;
+    if (!map_get(labels, POP(), &entry)) entry = INT_VAL(0);
+    ip = switch_jump(instruction, ip, count, AS_INT(entry));
+    DISPATCH();
+}
+CASE_CODE(COPY_LITERAL) {
+    Value literal = READ_CONSTANT();
+    STORE_FRAME;
+    PUSH(IS_LIST(literal) ? OBJ_VAL(copy_list(vm, AS_LIST(literal))) : OBJ_VAL(copy_map(vm, AS_MAP(literal))));
+    DISPATCH();
+}
+CASE_CODE(SUBSCRIPT) {
+    if (IS_LIST(PEEK(1)) && IS_NUMBER(PEEK(0))) QUICKEN(SUBSCRIPT_LIST_NUM);
+    STORE_FRAME;
+    if (!subscript_get(vm, PEEK(1), PEEK(0))) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    Value value = POP();
+    sp -= 2;
+    PUSH(value);
+    DISPATCH();
+}
+CASE_CODE(SUBSCRIPT_ASSIGN) {
+    Value value = PEEK(0);
+    Value index = PEEK(1);
+    Value container = PEEK(2);
+    STORE_FRAME;
+    if (!subscript_set(vm, container, index, value)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    sp -= 3;
+    PUSH(value);
+    DISPATCH();
+}
+CASE_CODE(SUBSCRIPT_PUSH) {
+    STORE_FRAME;
+    if (!subscript_get(vm, PEEK(1), PEEK(0))) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(IMPORT_BUILTIN) {
+    RUNTIME_ERROR("Builtin modules are not supported.");
+}
+CASE_CODE(IMPORT_BUILTIN_VARIABLE) {
+    RUNTIME_ERROR("Builtin modules are not supported.");
+}
+
+// Quickened variants of the generic handlers above. Each one guards on the
+// operand types it was specialised for and deoptimizes when they differ.
+CASE_CODE(ADD_NUM) {
+    QUICK_BINARY_OP(number_add(a, b), ADD);
+    DISPATCH();
+}
+CASE_CODE(ADD_STR) {
+    if (!IS_STRING(PEEK(0)) || !IS_STRING(PEEK(1))) DEOPTIMIZE(ADD);
+    STORE_FRAME;
+    concatenate(vm);
+    LOAD_STACK();
+    DISPATCH();
+}
+CASE_CODE(SUB_NUM) {
+    QUICK_BINARY_OP(number_sub(a, b), SUB);
+    DISPATCH();
+}
+CASE_CODE(MUL_NUM) {
+    QUICK_BINARY_OP(number_mul(a, b), MUL);
+    DISPATCH();
+}
+CASE_CODE(LESS_NUM) {
+    QUICK_BINARY_OP(BOOL_VAL(number_less(a, b)), LESS);
+    DISPATCH();
+}
+CASE_CODE(GREATER_NUM) {
+    QUICK_BINARY_OP(BOOL_VAL(number_less(b, a)), GREATER);
+    DISPATCH();
+}
+CASE_CODE(SUBSCRIPT_LIST_NUM) {
+    Value container = PEEK(1);
+    Value index = PEEK(0);
+    if (!IS_LIST(container) || !IS_NUMBER(index)) DEOPTIMIZE(SUBSCRIPT);
+    ObjList *list = AS_LIST(container);
+    int position = IS_INT(index) ? AS_INT(index) : (int)AS_NUMBER(index);
+    if (position < 0) position += list->values.count;
+    //out of range errors are reported by the generic handler
+    if (position < 0 || position >= list->values.count) DEOPTIMIZE(SUBSCRIPT);
+    sp[-2] = list->values.value[position];
+    sp--;
+    DISPATCH();
+}
+
+// Superinstructions, see fuse_superinstructions() in compiler.c. ip points
+// at the first operand of the original sequence; operands of later
+// instructions are read at their original offsets. When the operands are
+// not numbers the handler runs only the first instruction and dispatches
+// to the untouched remainder of the sequence.
+CASE_CODE(GET_LOCAL_LOCAL_ADD) {
+    // GET_LOCAL a, GET_LOCAL b, ADD
+    Value a = slots[ip[0]];
+    Value b = slots[ip[2]];
+    if (ARE_NUMBERS(a, b)) {
+        PUSH(number_add(a, b));
+        ip += 4;
+        DISPATCH();
+    }
+    PUSH(a);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(GET_LOCAL_CONSTANT_ADD) {
+    // GET_LOCAL a, CONSTANT k, ADD
+    Value a = slots[ip[0]];
+    Value b = constants[ip[2]];
+    if (ARE_NUMBERS(a, b)) {
+        PUSH(number_add(a, b));
+        ip += 4;
+        DISPATCH();
+    }
+    PUSH(a);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(GET_LOCAL_CONSTANT_SUB) {
+    // GET_LOCAL a, CONSTANT k, SUB
+    Value a = slots[ip[0]];
+    Value b = constants[ip[2]];
+    if (ARE_NUMBERS(a, b)) {
+        PUSH(number_sub(a, b));
+        ip += 4;
+        DISPATCH();
+    }
+    PUSH(a);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(GET_LOCAL_CONSTANT_LESS_JUMP) {
+    // GET_LOCAL a, CONSTANT k, LESS, JUMP_IF_FALSE offset
+    Value a = slots[ip[0]];
+    Value b = constants[ip[2]];
+    if (ARE_NUMBERS(a, b)) {
+        bool less = number_less(a, b);
+        uint16_t offset = (uint16_t)((ip[5] << 8) | ip[6]);
+        //JUMP_IF_FALSE leaves the condition on the stack for the POP at either target
+        PUSH(BOOL_VAL(less));
+        ip += 7;
+        if (!less) ip += offset;
+        DISPATCH();
+    }
+    PUSH(a);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(GET_LOCAL_LOCAL_LESS_JUMP) {
+    // GET_LOCAL a, GET_LOCAL b, LESS, JUMP_IF_FALSE offset
+    Value a = slots[ip[0]];
+    Value b = slots[ip[2]];
+    if (ARE_NUMBERS(a, b)) {
+        bool less = number_less(a, b);
+        uint16_t offset = (uint16_t)((ip[5] << 8) | ip[6]);
+        PUSH(BOOL_VAL(less));
+        ip += 7;
+        if (!less) ip += offset;
+        DISPATCH();
+    }
+    PUSH(a);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(CONSTANT_ADD_SET_LOCAL) {
+    // CONSTANT k, ADD, SET_LOCAL a
+    Value a = PEEK(0);
+    Value b = constants[ip[0]];
+    if (ARE_NUMBERS(a, b)) {
+        Value sum = number_add(a, b);
+        sp[-1] = sum;
+        slots[ip[3]] = sum;
+        ip += 4;
+        DISPATCH();
+    }
+    PUSH(b);
+    ip += 1;
+    DISPATCH();
+}
+CASE_CODE(SET_LOCAL_POP) {
+    // SET_LOCAL a, POP
+    slots[ip[0]] = POP();
+    ip += 2;
+    DISPATCH();
+}
+
+// Register tier, see registers.c. These never move sp: a register frame
+// keeps it at the top of its window so every register is a GC root. Only
+// REG_CALL lowers it to hand the callee its arguments.
+CASE_CODE(REG_ENTER) {
+    Value *top = slots + READ_BYTE();
+    //clear whatever older frames left in the window before the GC can see it
+    while (sp < top) *sp++ = NIL_VAL;
+    sp = top;
+    DISPATCH();
+}
+CASE_CODE(REG_MOVE) {
+    uint8_t destination = READ_BYTE();
+    slots[destination] = slots[READ_BYTE()];
+    DISPATCH();
+}
+CASE_CODE(REG_LOAD_CONSTANT) {
+    uint8_t destination = READ_BYTE();
+    slots[destination] = READ_CONSTANT();
+    DISPATCH();
+}
+CASE_CODE(REG_LOAD_NIL) {
+    slots[READ_BYTE()] = NIL_VAL;
+    DISPATCH();
+}
+CASE_CODE(REG_LOAD_TRUE) {
+    slots[READ_BYTE()] = BOOL_VAL(true);
+    DISPATCH();
+}
+CASE_CODE(REG_LOAD_FALSE) {
+    slots[READ_BYTE()] = BOOL_VAL(false);
+    DISPATCH();
+}
+CASE_CODE(REG_GET_GLOBAL) {
+    uint8_t destination = READ_BYTE();
+    slots[destination] = vm->global_values.value[READ_SHORT()];
+    DISPATCH();
+}
+CASE_CODE(REG_GET_MODULE) {
+    ObjModule *module = frame->closure->function->module;
+    uint8_t destination = READ_BYTE();
+    uint16_t slot = READ_SHORT();
+    if (IS_EMPTY(module->values.value[slot])) {
+        RUNTIME_ERROR("Undefined variable '%s'.", module_slot_name(module, slot)->chars);
+    }
+    slots[destination] = module->values.value[slot];
+    DISPATCH();
+}
+CASE_CODE(REG_EQUAL) {
+    uint8_t destination = READ_BYTE();
+    Value a = slots[READ_BYTE()];
+    Value b = slots[READ_BYTE()];
+    slots[destination] = BOOL_VAL(values_equal(a, b));
+    DISPATCH();
+}
+CASE_CODE(REG_GREATER) {
+    REGISTER_BINARY_OP(BOOL_VAL(number_less(b, a)), >);
+    DISPATCH();
+}
+CASE_CODE(REG_LESS) {
+    REGISTER_BINARY_OP(BOOL_VAL(number_less(a, b)), <);
+    DISPATCH();
+}
+CASE_CODE(REG_ADD) {
+    uint8_t destination = READ_BYTE();
+    Value a = slots[READ_BYTE()];
+    Value b = slots[READ_BYTE()];
+    if (ARE_NUMBERS(a, b)) {
+        slots[destination] = number_add(a, b);
+        DISPATCH();
+    }
+    PUSH(a);
+    PUSH(b);
+    STORE_FRAME;
+    if (!add_values(vm)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    slots[destination] = POP();
+    DISPATCH();
+}
+CASE_CODE(REG_SUB) {
+    REGISTER_BINARY_OP(number_sub(a, b), -);
+    DISPATCH();
+}
+CASE_CODE(REG_MUL) {
+    REGISTER_BINARY_OP(number_mul(a, b), *);
+    DISPATCH();
+}
+CASE_CODE(REG_DIV) {
+    REGISTER_BINARY_OP(NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b)), /);
+    DISPATCH();
+}
+CASE_CODE(REG_ADD_CONSTANT) {
+    uint8_t destination = READ_BYTE();
+    Value a = slots[READ_BYTE()];
+    Value b = READ_CONSTANT();
+    if (ARE_NUMBERS(a, b)) {
+        slots[destination] = number_add(a, b);
+        DISPATCH();
+    }
+    PUSH(a);
+    PUSH(b);
+    STORE_FRAME;
+    if (!add_values(vm)) {
+        return INTERPRET_RUNTIME_ERROR;
+    }
+    LOAD_STACK();
+    slots[destination] = POP();
+    DISPATCH();
+}
+CASE_CODE(REG_SUB_CONSTANT) {
+    uint8_t destination = READ_BYTE();
+    Value a = slots[READ_BYTE()];
+    Value b = READ_CONSTANT();
+    if (!ARE_NUMBERS(a, b)) {
+        PUSH(a);
+        PUSH(b);
+        UNSUPPORTED_OPERAND_TYPE_ERROR(-)
+    }
+    slots[destination] = number_sub(a, b);
+    DISPATCH();
+}
+CASE_CODE(REG_NOT) {
+    uint8_t destination = READ_BYTE();
+    slots[destination] = BOOL_VAL(is_falsey(slots[READ_BYTE()]));
+    DISPATCH();
+}
+CASE_CODE(REG_NEGATE) {
+    uint8_t destination = READ_BYTE();
+    Value a = slots[READ_BYTE()];
+    if (!IS_NUMBER(a)) {
+        PUSH(a);
+        RUNTIME_ERROR_TYPE("Unsupported operand type for unary -: '%s'", 0);
+    }
+    slots[destination] = NUMBER_VAL(-AS_NUMBER(a));
+    DISPATCH();
+}
+CASE_CODE(REG_JUMP_IF_FALSE) {
+    Value condition = slots[READ_BYTE()];
+    uint16_t offset = READ_SHORT();
+    if (is_falsey(condition)) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(REG_JUMP_IF_TRUE) {
+    Value condition = slots[READ_BYTE()];
+    uint16_t offset = READ_SHORT();
+    if (!is_falsey(condition)) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(REG_LESS_JUMP) {
+    // jumps when !(a < b)
+    Value a = slots[READ_BYTE()];
+    Value b = slots[READ_BYTE()];
+    uint16_t offset = READ_SHORT();
+    if (!ARE_NUMBERS(a, b)) {
+        PUSH(a);
+        PUSH(b);
+        UNSUPPORTED_OPERAND_TYPE_ERROR(<)
+    }
+    if (!(number_less(a, b))) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(REG_LESS_CONSTANT_JUMP) {
+    Value a = slots[READ_BYTE()];
+    Value b = READ_CONSTANT();
+    uint16_t offset = READ_SHORT();
+    if (!ARE_NUMBERS(a, b)) {
+        PUSH(a);
+        PUSH(b);
+        UNSUPPORTED_OPERAND_TYPE_ERROR(<)
+    }
+    if (!(number_less(a, b))) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(REG_CALL) {
+    uint8_t base = READ_BYTE();
+    int arg_count = READ_BYTE();
+    int frame_count = vm->frame_count;
+    //the callee and its arguments sit in registers base..base + arg_count
+    sp = slots + base + arg_count + 1;
+    CALL_VALUE(arg_count);
+    //natives and classes without init return here, the rest via RETURN
+    if (vm->frame_count == frame_count) LOAD_REGISTER_TOP();
+    DISPATCH();
+}
+CASE_CODE(REG_TAIL_CALL) {
+    uint8_t base = READ_BYTE();
+    int arg_count = READ_BYTE();
+    int frame_count = vm->frame_count;
+    sp = slots + base + arg_count + 1;
+    TAIL_CALL_VALUE(arg_count);
+    CALL_VALUE(arg_count);
+    if (vm->frame_count == frame_count) LOAD_REGISTER_TOP();
+    DISPATCH();
+}
+CASE_CODE(REG_INLINE_GUARD) {
+    Value callee = slots[READ_BYTE()];
+    ObjFun *function = AS_FUNC(READ_CONSTANT());
+    uint16_t offset = READ_SHORT();
+    if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function == function) ip += offset;
+    DISPATCH();
+}
+CASE_CODE(REG_RETURN) {
+    Value result = slots[READ_BYTE()];
+    close_upvalues(vm, slots);
+    vm->frame_count--;
+    if (vm->frame_count == 0) {
+        vm->stack_top = slots;
+        return INTERPRET_OK;
+    }
+    sp = slots;
+    PUSH(result);
+    LOAD_FRAME();
+    LOAD_REGISTER_TOP();
+    DISPATCH();
+}
@@ -21,7 +21,7 @@ void lex_test(){
     common_lex_test("while break if continue class func var else import for");
 
     //operators
-    common_lex_test(":,[]{}()><=&;/\"'*-+!|-.");
+    common_lex_test(":,[]{}()><=&;/*-+!|-.");
 
     //numbers
     common_lex_test("1 90 09 9.0 0x67 0X65 3.3333");
@@ -31,11 +31,967 @@ void lex_test(){
 
     //double quote string
     common_lex_test("\"this is a double quoted string\";");
+
+    //empty strings and the other quote inside a string
+    common_lex_test("'' \"\" 'a\"b' \"a'b\"");
+}
+
+static Value module_value(LnVM* vm, char* module_name, char* name){
+    Value module;
+    bool found = table_get(&vm->modules, copy_string(vm, module_name, (int)strlen(module_name)), &module);
+    assert(found);
+
+    Value value;
+    found = module_get(AS_MODULE(module), copy_string(vm, name, (int)strlen(name)), &value);
+    assert(found);
+    return value;
+}
+
+void common_interpret_test(char* source, double expected){
+    LnVM* vm = init_vm(0, NULL);
+
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+
+    Value result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == expected);
+
+    free_vm(vm);
+}
+
+void common_error_test(char* source, LnInterpretResult expected){
+    LnVM* vm = init_vm(0, NULL);
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == expected);
+    free_vm(vm);
+}
+
+void interpret_test(){
+    //arithmetic and precedence
+    common_interpret_test("var result = 1 + 2 * 3 - 8 / 4;", 5);
+    common_interpret_test("var result = (1 << 4) | 3 & 1;", 17);
+
+    //control flow
+    common_interpret_test("var result = 0; for (var i = 0; i < 10; i += 1) { if (i == 3) continue; if (i == 6) break; result += i; }", 12);
+    common_interpret_test("var result = 0; while (result < 100) { result = result * 2 + 1; }", 127);
+
+    //functions and closures
+    common_interpret_test("func fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } var result = fib(15);", 610);
+    common_interpret_test("func counter() { var c = 0; func inc() { c += 1; return c; } return inc; } var f = counter(); f(); var result = f();", 2);
+    common_interpret_test("func f(a, b, c, d) { return a * b + c - d; } func g(a) { return a; } var result = f(2, 3, 4, 5) + g(1) + g(g)(7);", 13);
+    common_error_test("func g(a) { var x = a * 2; x = x + 1; return x; } var result = g(1, 100);", INTERPRET_RUNTIME_ERROR);
+
+    //calls in return position reuse the caller's frame
+    common_interpret_test("func loop(n, acc) { if (n == 0) return acc; return loop(n - 1, acc + 1); } var result = loop(100000, 0);", 100000);
+    common_interpret_test("func even(n) { if (n == 0) return 1; return odd(n - 1); } func odd(n) { if (n == 0) return 0; return even(n - 1); } var result = even(10001);", 0);
+    common_interpret_test("func f(n) { func g() { return n; } return g(); } var result = f(7);", 7);
+    common_interpret_test("func f(n, c) { func g() { return n; } if (n > 0) return f(n - 1, g); return c; } var result = f(3, 0)();", 1);
+    common_interpret_test("class A { init(v) { this.v = v; } } func f() { return A(5); } func g(n) { return clock() * 0 + n; } var result = f().v + g(1);", 6);
+    common_interpret_test("func f(a, b, c, d, e) { if (a == 0) return b + c + d + e; return f(a - 1, b, c, d, e + 1); } var result = f(5000, 1, 2, 3, 0);", 5006);
+    common_interpret_test("func t() { return 3; } func f(x) { return x || t(); } var result = f(false) + f(1);", 4);
+
+    //classes
+    common_interpret_test("class A { init(v) { this.v = v; } get() { return this.v; } }"
+                          "class B < A { get() { return super.get() * 10; } }"
+                          "var result = B(4).get();", 40);
+
+    //lists and maps
+    common_interpret_test("var l = [1, 2, 3]; l[0] += 10; var m = {1: l}; var result = m[1][0] + l[-1];", 14);
+
+    //strings
+    common_interpret_test("var s = \"ab\" + 'c'; var result = 0; if (s == \"abc\") result = 1;", 1);
+
+    //module variables live in slots, reserved at their first use
+    common_interpret_test("func f() { return x; } var x = 3; x += 1; var result = f();", 4);
+    common_interpret_test("class A { get() { return n; } } var n = 5; var result = A().get();", 5);
+
+    //errors
+    common_error_test("var result = ;", INTERPRET_COMPILER_ERROR);
+    common_error_test("var result = [1][5];", INTERPRET_RUNTIME_ERROR);
+    common_error_test("var result = undefined_name;", INTERPRET_RUNTIME_ERROR);
+    common_error_test("undefined_name = 1;", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f(a, b) { return a; } f(1);", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f(n) { return f(n + 1) + 1; } f(0);", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f() { return x; } f(); var x = 1;", INTERPRET_RUNTIME_ERROR);
+    common_error_test("var x = 5; x.foo();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("var x = nil; x.foo(1);", INTERPRET_RUNTIME_ERROR);
+
+    //more module variables than a byte can address
+    char source[8192] = "";
+    for (int i = 0; i < 300; i++) {
+        sprintf(source + strlen(source), "var v%d; ", i);
+    }
+    strcat(source, "v1 = 1; v299 = 299; v299 += v1; var result = v299;");
+    common_interpret_test(source, 300);
+}
+
+void common_fusion_test(char* source, Opcode fused, double expected){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+    assert(vm->fusion_counts[fused] > 0);
+
+    Value result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == expected);
+
+    free_vm(vm);
+}
+
+void superinstruction_test(){
+    common_fusion_test("func f(n) { var i = 0; var t = 0; while (i < n) { t = t + i; i = i + 1; } return t; } var result = f(10);", OP_GET_LOCAL_LOCAL_LESS_JUMP, 45);
+    common_fusion_test("func f(n) { var i = 0; while (i < 10) { i = i + n; } return i; } var result = f(3);", OP_GET_LOCAL_CONSTANT_LESS_JUMP, 12);
+    common_fusion_test("func f(n) { if (n < 2) return n; return f(n - 1) + f(n - 2); } var result = f(10);", OP_GET_LOCAL_CONSTANT_SUB, 55);
+    common_fusion_test("func f(a, b) { var c = a + b; return c; } var result = f(2, 3);", OP_GET_LOCAL_LOCAL_ADD, 5);
+    common_fusion_test("func f(a) { var b = 0; b = a + 1; a = 0; return b; } var result = f(4);", OP_SET_LOCAL_POP, 5);
+
+    //non-number operands fall back to the original sequence
+    common_fusion_test("func f(a, b) { return a + b; } var l = f([1], [2]); var result = l[1];", OP_GET_LOCAL_LOCAL_ADD, 2);
+    common_fusion_test("func f(a) { return a + 1; } var result = f(1);", OP_GET_LOCAL_CONSTANT_ADD, 2);
+    common_error_test("func f(a) { return a - 1; } f([1]);", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f(a) { if (a < 1) return 0; } f([1]);", INTERPRET_RUNTIME_ERROR);
+}
+
+bool chunk_contains(Chunk* chunk, Opcode instruction){
+    for (int i = 0; i < chunk->count; i++){
+        if(chunk->code[i] == instruction) return true;
+    }
+    return false;
+}
+
+void common_quicken_test(char* source, char* function, Opcode quickened, double expected){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+
+    Value closure = module_value(vm, "test", function);
+    assert(IS_CLOSURE(closure));
+    assert(chunk_contains(&AS_CLOSURE(closure)->function->chunk, quickened));
+
+    Value result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == expected);
+
+    free_vm(vm);
+}
+
+void quicken_test(){
+    //a + b alone would be fused into GET_LOCAL_LOCAL_ADD, the second + stays a plain ADD
+    common_quicken_test("func f(a, b, c) { return a + b + c; } var result = f(1, 2, 3);", "f", OP_ADD_NUM, 6);
+    common_quicken_test("func f(a, b) { return a * b - 1 ; } var result = f(3, 2);", "f", OP_SUB_NUM, 5);
+    common_quicken_test("func f(a, b) { if (a > b) return 1; return 0; } var result = f(3, 2);", "f", OP_GREATER_NUM, 1);
+    common_quicken_test("func f(l, i) { return l[i]; } var result = f([4, 5], 1) + f([6], -1);", "f", OP_SUBSCRIPT_LIST_NUM, 11);
+    common_quicken_test("func f(a, b) { return a + b + \"!\"; } var result = 0; if (f(\"a\", \"b\") == \"ab!\") result = 1;", "f", OP_ADD_STR, 1);
+
+    //guard failures fall back to the generic instruction
+    common_quicken_test("func f(a, b, c) { return a + b + c; } f(1, 2, 3); var l = f([1], [2], [3]); var result = l[2];", "f", OP_ADD, 3);
+    common_quicken_test("func f(a, b, c) { return a + b + c; } f([1], [2], [3]); var result = f(1, 2, 3);", "f", OP_ADD_NUM, 6);
+    common_quicken_test("func f(c, i) { return c[i]; } f([1], 0); var m = {2: 7}; var result = f(m, 2);", "f", OP_SUBSCRIPT, 7);
+    common_error_test("func f(l, i) { return l[i]; } f([1], 0); f([1], 3);", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f(a, b) { return a < b; } f(1, 2); f([1], 2);", INTERPRET_RUNTIME_ERROR);
+}
+
+//checks the inline cache of the first property access in function
+void common_cache_test(char* source, char* function, int entries, bool megamorphic, double expected){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+
+    Value closure = module_value(vm, "test", function);
+    assert(IS_CLOSURE(closure));
+    Chunk* chunk = &AS_CLOSURE(closure)->function->chunk;
+    assert(chunk->cache_count > 0);
+    assert(chunk->caches[0].count == entries);
+    assert(chunk->caches[0].megamorphic == megamorphic);
+
+    Value result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == expected);
+
+    free_vm(vm);
+}
+
+void inline_cache_test(){
+    common_cache_test("class A { init() { this.x = 1; } } func f(o) { return o.x; } var a = A(); var result = f(a) + f(a);", "f", 1, false, 2);
+    common_cache_test("class A { init() { this.x = 1; } } func f(o, v) { o.x = v; } var a = A(); f(a, 2); f(a, 3); var result = a.x;", "f", 1, false, 3);
+    common_cache_test("class A { get() { return 4; } } func f(o) { return o.get(); } var a = A(); var result = f(a) + f(a);", "f", 1, false, 8);
+
+    //polymorphic then megamorphic sites
+    common_cache_test("class A { init() { this.x = 1; } } class B { init() { this.y = 0; this.x = 2; } } "
+                      "func f(o) { return o.x; } var result = f(A()) + f(B()) + f(A());", "f", 2, false, 4);
+    common_cache_test("class A { v() { return 1; } } class B { v() { return 2; } } class C { v() { return 3; } } "
+                      "class D { v() { return 4; } } class E { v() { return 5; } } "
+                      "func f(o) { return o.v(); } var result = f(A()) + f(B()) + f(C()) + f(D()) + f(E()) + f(A());", "f", 0, true, 16);
+
+    //a field stored under a method name moves the instance to a shape of its own, cached next to the method
+    common_cache_test("class A { get() { return 1; } } func f(o) { return o.get(); } var a = A(); var b = A(); f(a); "
+                      "func g() { return 2; } b.get = g; var result = f(b) + f(a);", "f", 2, false, 3);
+    common_cache_test("class A { get() { return 1; } } func f(o) { return o.get; } var a = A(); f(a); "
+                      "a.get = 5; var result = f(a);", "f", 2, false, 5);
+}
+
+void shape_test(){
+    LnVM* vm = init_vm(0, NULL);
+    LnInterpretResult status = interpret(vm, "test",
+        "class P { init(x, y) { this.x = x; this.y = y; } } var a = P(1, 2); var b = P(3, 4); "
+        "var c = P(5, 6); c.z = 7; var d = P(8, 9); d.z = 1; class Q { init(y, x) { this.y = y; this.x = x; } } var e = Q(1, 2);");
+    assert(status == INTERPRET_OK);
+
+    ObjInstance* a = AS_INSTANCE(module_value(vm, "test", "a"));
+    ObjInstance* b = AS_INSTANCE(module_value(vm, "test", "b"));
+    ObjInstance* c = AS_INSTANCE(module_value(vm, "test", "c"));
+    ObjInstance* d = AS_INSTANCE(module_value(vm, "test", "d"));
+    ObjInstance* e = AS_INSTANCE(module_value(vm, "test", "e"));
+    assert(a->shape == b->shape && a->shape->field_count == 2);
+    assert(c->shape == d->shape && c->shape->parent == a->shape);
+    assert(e->shape != a->shape && e->shape->klass != a->shape->klass);
+
+    //instances after the first reserve the fields seen so far inline
+    assert(a->fields != a->inline_fields);
+    assert(b->fields == b->inline_fields);
+    assert(AS_NUMBER(b->fields[shape_slot(b->shape, copy_string(vm, "y", 1))]) == 4);
+    free_vm(vm);
+
+    common_interpret_test("class A {} var a = A(); var result = 0; if (a._class == A) result = 1;", 1);
+    common_interpret_test("class A {} var a = A(); a._class = 2; var result = a._class;", 2);
+
+    //too many fields fall back to dictionary mode
+    char source[4096] = "class O {} var o = O(); ";
+    for (int i = 0; i < SHAPE_MAX_FIELDS + 6; i++) {
+        sprintf(source + strlen(source), "o.f%d = %d; ", i, i);
+    }
+    strcat(source, "func f(o) { return o.f3 + o.f69; } var result = f(o) + f(o);");
+    vm = init_vm(0, NULL);
+    status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+    assert(AS_INSTANCE(module_value(vm, "test", "o"))->shape == NULL);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 144);
+    free_vm(vm);
+}
+
+void common_register_test(char* source, char* function, bool translated, double expected){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = true;
+
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_OK);
+
+    Value closure = module_value(vm, "test", function);
+    assert(IS_CLOSURE(closure));
+    assert((AS_CLOSURE(closure)->function->register_count > 0) == translated);
+
+    Value result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result));
+    assert(AS_NUMBER(result) == expected);
+
+    free_vm(vm);
+
+    //the stack tier must agree
+    vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    assert(interpret(vm, "test", source) == INTERPRET_OK);
+    result = module_value(vm, "test", "result");
+    assert(IS_NUMBER(result) && AS_NUMBER(result) == expected);
+    free_vm(vm);
+}
+
+void common_register_error_test(char* source){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = true;
+    LnInterpretResult status = interpret(vm, "test", source);
+    assert(status == INTERPRET_RUNTIME_ERROR);
+    free_vm(vm);
+}
+
+void register_test(){
+    common_register_test("func f(n) { var t = 0; var i = 0; while (i < n) { t = t + i * 2; i = i + 1; } return t; } var result = f(10);", "f", true, 90);
+    common_register_test("func fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); } var result = fib(15);", "fib", true, 610);
+    common_register_test("func f(a, b) { var c = -a; if (!(a == b)) c = c * 2; else c = c / 2; if (a > b) return c; return c - 1; } var result = f(3, 3) + f(4, 3);", "f", true, -10.5);
+    common_register_test("func f(n) { var t = 0; for (var i = 0; i < n; i += 1) { if (i == 3) continue; if (i == 6) break; t += i; } return t; } var result = f(10);", "f", true, 12);
+    common_register_test("func f(a) { var t = clock(); var u = a && t || 1; return a + 1; } var result = f(2);", "f", true, 3);
+    common_register_test("func f(a, b, c) { return a + b + c; } var l = f([1], [2], [3]); var result = l[2] + f(1, 2, 3);", "f", true, 9);
+
+    common_register_test("func f(n, acc) { if (n == 0) return acc; return f(n - 1, acc + n); } var result = f(10000, 0);", "f", true, 50005000);
+
+    //functions using instructions without a register form stay on the stack tier
+    common_register_test("class A { init() { this.v = 2; } } func f() { return A().v; } var result = f();", "f", false, 2);
+    common_register_test("func f(n) { var g = 1; func h() { return g; } return h() + n; } var result = f(1);", "f", false, 2);
+
+    common_register_error_test("func f(a) { return a - 1; } f([1]);");
+    common_register_error_test("func f(a) { if (a < 1) return 0; return 1; } f([1]);");
+    common_register_error_test("func f() { return g(); } f();");
+    //extra arguments are an error on both tiers rather than left in the callee's slots
+    common_register_error_test("func g(a) { var x = a * 2; x = x + 1; return x; } var result = g(1, 100);");
+}
+
+void symbol_test(){
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "class A { init() { this.x = 1; } get() { return 1; } both() { return 10; } }"
+                                 "class B < A { get() { return 2; } }"
+                                 "class C { both() { return 100; } }"
+                                 "var l = [A(), B(), C()]; var result = 0;"
+                                 "for (var i = 0; i < 3; i += 1) { result += l[i].both(); }"
+                                 "result += l[0].get() + l[1].get() + B().both();") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 133);
+
+    //a method name has one symbol however many classes define it
+    ObjString* both = copy_string(vm, "both", 4);
+    ObjString* get = copy_string(vm, "get", 3);
+    assert(both->symbol >= 0 && get->symbol >= 0 && both->symbol != get->symbol);
+    assert(AS_STRING(vm->symbols.value[both->symbol]) == both);
+
+    //fields never get symbols, and a class's vtable is indexed by them
+    assert(copy_string(vm, "x", 1)->symbol == -1);
+    ObjClass* b = AS_CLASS(module_value(vm, "test", "B"));
+    Value method;
+    assert(method_get(&b->methods, both, &method) && IS_CLOSURE(method));
+    assert(!method_get(&AS_CLASS(module_value(vm, "test", "C"))->methods, get, &method));
+    free_vm(vm);
+
+    common_interpret_test("class A { f() { return 1; } } class B < A { g() { return super.f() + this.f(); } } var b = B(); var m = b.g; var result = m();", 2);
+    common_error_test("class A { f() { return 1; } } A().g();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("class A { f() { return 1; } } class B { g() { return 1; } } B().f();", INTERPRET_RUNTIME_ERROR);
+}
+
+static bool has_opcode(Chunk* chunk, Opcode opcode){
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == opcode) return true;
+    }
+    return false;
+}
+
+static int bound_method_count(LnVM* vm){
+    int count = 0;
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        if(object->type == OBJ_BOUND_METHOD) count++;
+    }
+    return count;
+}
+
+void invoke_test(){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    assert(interpret(vm, "test", "class A { init() { this.n = 1; } get(v) { return this.n + v; } }"
+                                 "func f(o) { var t = 0; for (var i = 0; i < 100; i += 1) { t += o.get(i) + (o.get)(1); } return t; }"
+                                 "var result = f(A());") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 5250);
+
+    //direct calls, parenthesized or not, never bind the method
+    Chunk* chunk = &AS_CLOSURE(module_value(vm, "test", "f"))->function->chunk;
+    assert(has_opcode(chunk, OP_INVOKE) && !has_opcode(chunk, OP_GET_PROPERTY));
+    assert(bound_method_count(vm) == 0);
+    free_vm(vm);
+
+    //methods used as values are still bound
+    common_interpret_test("class A { get() { return 3; } } var a = A(); var m = a.get; var result = m() + (false || a.get)();", 6);
+    common_interpret_test("class A { init() { this.f = nil; } get() { return 3; } } func g() { return 4; } var a = A(); a.f = g; var result = (a.f)() + (a.get)();", 7);
+
+    //a parenthesized call finds and fails on exactly what the property get does
+    common_interpret_test("class A {} A.f = clock; var a = A(); var t = (a.f)() + (A.f)(); func two() { return 2; } A.g = two; var result = (a.g)() + (A.g)();", 4);
+    common_error_test("var x = nil; (x.foo)();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("class A {} var a = A(); (a.foo)();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f() {} (f.foo)();", INTERPRET_RUNTIME_ERROR);
+}
+
+void class_property_test(){
+    //inherited properties resolve through the flattened table and follow later changes to a superclass
+    common_interpret_test("class A {} A.x = 1; class B < A {} class C < B {} var result = C.x; A.x = 5; result += C.x + C().x;", 11);
+    common_interpret_test("class A {} A.x = 1; class B < A {} B.x = 2; A.x = 3; A.y = 4; var result = B.x * 10 + B.y + A.x * 100;", 324);
+    common_interpret_test("class A {} class B < A {} var result = 0; for (var i = 0; i < 5; i += 1) { B.n = i; result += B.n; } A.n = 100; result += B.n;", 14);
+    //called through an instance like it is read through one
+    common_interpret_test("func two() { return 2; } func add(a, b) { return a + b; } class A {} class B < A {} A.f = two; var b = B(); var result = b.f(); A.f = add; result += b.f(3, 4) * 10;", 72);
+    common_error_test("class A {} class B < A {} B.x = 1; var result = A.x;", INTERPRET_RUNTIME_ERROR);
+    common_error_test("class A {} A.x = 1; A().y();", INTERPRET_RUNTIME_ERROR);
+
+    //deep hierarchies cost one probe
+    char source[4096] = "class K0 {} K0.v = 7; ";
+    for (int i = 1; i < 50; i++) {
+        sprintf(source + strlen(source), "class K%d < K%d {} ", i, i - 1);
+    }
+    strcat(source, "var result = K49.v + K49().v; K0.v = 1; result += K49.v;");
+    common_interpret_test(source, 15);
+
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "class A {} A.x = 1; class B < A {} B.y = 2; var result = B.x + B.y;") == INTERPRET_OK);
+    ObjClass* b = AS_CLASS(module_value(vm, "test", "B"));
+    assert(b->members_epoch == vm->class_epoch);
+    assert(b->members.count == 2 && b->properties.count == 1);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 3);
+    free_vm(vm);
+}
+
+void int_test(){
+    //integral literals and folded constants narrow to the int32 form
+    assert(IS_INT(narrow_number(42)) && AS_INT(narrow_number(-7)) == -7);
+    assert(IS_DOUBLE(narrow_number(0.5)) && IS_DOUBLE(narrow_number(4294967296.0)));
+    assert(narrow_number(3.0) == INT_VAL(3) && AS_NUMBER(INT_VAL(-3)) == -3);
+    assert(IS_NUMBER(NUMBER_VAL(3.0)) && IS_NUMBER(INT_VAL(3)) && AS_NUMBER(NUMBER_VAL(3.0)) == AS_NUMBER(INT_VAL(3)));
+    assert(IS_DOUBLE(narrow_number(-0.0)) && !IS_INT(NIL_VAL) && !IS_INT(TRUE_VAL) && !IS_INT(EMPTY_VAL));
+
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "var i = 0; while (i < 1000) { i += 1; } var half = 7 / 2; var whole = 1.5 + 1.5;"
+                                 "var big = 2147483647 + 1; var low = -2147483647 - 2; var product = 65536 * 65536;"
+                                 "var negzero = 1 / (0 * -1);") == INTERPRET_OK);
+    assert(IS_INT(module_value(vm, "test", "i")) && AS_INT(module_value(vm, "test", "i")) == 1000);
+    assert(IS_DOUBLE(module_value(vm, "test", "half")) && AS_NUMBER(module_value(vm, "test", "half")) == 3.5);
+    assert(IS_INT(module_value(vm, "test", "whole")) && AS_INT(module_value(vm, "test", "whole")) == 3);
+
+    //overflow moves to doubles
+    assert(IS_DOUBLE(module_value(vm, "test", "big")) && AS_NUMBER(module_value(vm, "test", "big")) == 2147483648.0);
+    assert(IS_DOUBLE(module_value(vm, "test", "low")) && AS_NUMBER(module_value(vm, "test", "low")) == -2147483649.0);
+    assert(AS_NUMBER(module_value(vm, "test", "product")) == 4294967296.0);
+    assert(AS_NUMBER(module_value(vm, "test", "negzero")) < -1e308);
+    free_vm(vm);
+
+    //bitwise operators on int32
+    common_interpret_test("var result = (5 & 3) | 8;", 9);
+    common_interpret_test("var result = -8 >> 1;", -4);
+    common_interpret_test("var result = 1 << 31;", -2147483648.0);
+    common_interpret_test("var result = 6.9 & 3;", 2);
+
+    //ints and doubles of the same value are the same number
+    common_interpret_test("var m = {1: 5}; var h = 0.5; var result = m[h + h]; m[0] = 1; result += m[0 * -1]; if (2 == 4 / 2) result += 1;", 7);
+    common_register_test("func f(n) { var t = 1; var i = 0; while (i < n) { t = t * 3; i = i + 1; } return t; } var result = f(25);", "f", true, 847288609443.0);
+    common_register_test("func f(n) { var t = 0; var i = 0; while (i < n) { t = t + 0.5; i = i + 1; } return t - 2; } var result = f(5);", "f", true, 0.5);
+}
+
+void stack_test(){
+    LnVM* vm = init_vm(0, NULL);
+    assert(vm->stack_capacity == STACK_INITIAL);
+
+    //deep non-tail recursion grows the stack, the open upvalue of every frame moves with it
+    assert(interpret(vm, "test", "func f(n) { var x = n; func g() { return x; } if (n == 0) return 0; var r = f(n - 1); return r + g(); }"
+                                 "func m(a) { var b = a + 1; var l = [a, b, 3]; return l; }"
+                                 "func v(o) { o.a(); o.b(); o.c(); return [o, o, o, o]; }"
+                                 "var result = f(2000);") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 2001000);
+    assert(vm->stack_capacity > STACK_INITIAL);
+
+    //b, then l over b while the list literal takes a, b and 3
+    assert(AS_CLOSURE(module_value(vm, "test", "m"))->function->max_stack == 4);
+    //an INVOKE takes its arguments, whatever its cache index
+    assert(AS_CLOSURE(module_value(vm, "test", "v"))->function->max_stack == 4);
+    free_vm(vm);
+
+    common_interpret_test("func f(n) { if (n == 0) return 0; return n + f(n - 1); } var result = f(4000);", 8002000);
+    common_interpret_test("func f(n) { var t = 0; for (var i = 0; i < n; i += 1) { var l = [i, i, i]; t += l[0]; } if (n == 0) return t; return t + f(n - 1); } var result = f(300);", 4499950);
+}
+
+static Chunk* function_chunk(LnVM* vm, char* name){
+    return &AS_CLOSURE(module_value(vm, "test", name))->function->chunk;
+}
+
+//true when some jump lands on another unconditional jump
+static bool jumps_to_jump(Chunk* chunk){
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        uint8_t instruction = chunk->code[i];
+        if(instruction != OP_JUMP && instruction != OP_JUMP_IF_FALSE && instruction != OP_JUMP_IF_TRUE) continue;
+        int target = i + 3 + ((chunk->code[i + 1] << 8) | chunk->code[i + 2]);
+        if(chunk->code[target] == OP_JUMP || chunk->code[target] == OP_LOOP) return true;
+    }
+    return false;
+}
+
+void peephole_test(){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    assert(interpret(vm, "test", "func compare(a, b) { return [a >= b, a <= b, a != b]; }"
+                                 "func branch(a, b) { if (!(a < b)) return 1; if (a >= b) return 2; return 3; }"
+                                 "func either(a, b) { var r = a || b; return r; }"
+                                 "func dead(n) { return n; n = n + 1; }"
+                                 "func nested(a, b) { var x = 0; if (a) { if (b) x = 1; else x = 2; } else x = 3; return x; }"
+                                 "func assign(a) { var b = 0; b = a + 1; return b; }\n"
+                                 "func lines(a) {\n"
+                                 "    var b = nil;\n"
+                                 "    b;\n"
+                                 "    return a * 2;\n"
+                                 "}") == INTERPRET_OK);
+
+    //comparisons followed by NOT use their complement, NOT feeding a branch flips the branch
+    Chunk* chunk = function_chunk(vm, "compare");
+    assert(has_opcode(chunk, OP_GREATER_EQUAL) && has_opcode(chunk, OP_LESS_EQUAL) && has_opcode(chunk, OP_NOT_EQUAL));
+    assert(!has_opcode(chunk, OP_NOT));
+    chunk = function_chunk(vm, "branch");
+    assert(has_opcode(chunk, OP_JUMP_IF_TRUE) && !has_opcode(chunk, OP_NOT) && !has_opcode(chunk, OP_GREATER_EQUAL));
+
+    //`||` branches once, instead of over a JUMP
+    chunk = function_chunk(vm, "either");
+    assert(has_opcode(chunk, OP_JUMP_IF_TRUE) && !has_opcode(chunk, OP_JUMP) && !has_opcode(chunk, OP_JUMP_IF_FALSE));
+
+    //nothing is left after the explicit return, not even the implicit one
+    chunk = function_chunk(vm, "dead");
+    assert(!has_opcode(chunk, OP_ADD) && !has_opcode(chunk, OP_NIL) && chunk->code[chunk->count - 1] == OP_RETURN);
+
+    assert(!jumps_to_jump(function_chunk(vm, "nested")));
+
+    //the assigned value stays on the stack for the read right after it
+    chunk = function_chunk(vm, "assign");
+    assert(!has_opcode(chunk, OP_POP));
+
+    //lines follow their instructions through the compaction
+    chunk = function_chunk(vm, "lines");
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == OP_MUL) assert(chunk->lines[i] == 5);
+    }
+    assert(has_opcode(chunk, OP_MUL) && chunk->count == 7);
+    free_vm(vm);
+
+    //same results as the unoptimized sequences, NaN included
+    common_interpret_test("var nan = 0 / 0; var result = 0; if (nan >= 1) result += 1; if (nan <= 1) result += 10; if (!(nan < 1)) result += 100;", 111);
+    common_interpret_test("var result = 0; if (2 >= 2) result += 1; if (3 <= 2) result += 10; if (1 != 1.0) result += 100; if ([1] != nil) result += 1000;", 1001);
+    common_interpret_test("var a = false; var b = nil; var result = 0; if (a || b) result = 1; else if (!a && !b) result = 2;", 2);
+    common_interpret_test("var result = 0; for (var i = 0; i < 10; i += 1) { if (!(i < 5)) continue; if (i == 3) break; result += i; }", 3);
+    common_interpret_test("func f(a) { var b = 0; b = a; b = b + 1; return b; } var result = f(2);", 3);
+    common_register_test("func f(n) { var t = 0; for (var i = 0; i <= n; i += 1) { if (i != 3) t = t + i; } return t; } var result = f(5);", "f", true, 12);
+    common_register_test("func f(a, b) { if (!(a < b) || a == 0) return 1; return 2; } var result = f(1, 2) * 10 + f(3, 2);", "f", true, 21);
+}
+
+//instructions left in the chunk
+static int instruction_count(Chunk* chunk){
+    int count = 0;
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) count++;
+    return count;
+}
+
+void constant_fold_test(){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    assert(interpret(vm, "test", "func arithmetic() { return -(2 + 3) * 4 - 10 / 4; }"
+                                 "func compare() { return [1 < 2, 2 >= 3, 1 == 1.0, !nil, (6 & 3) | 8, (1 << 4) >> 2]; }"
+                                 "func dead() { if (1 > 2) return 1; while (false) { return 2; } return 3; }"
+                                 "func locals(a) { var size = 4; var half = size / 2; return a * half + size; }"
+                                 "func assigned(a) { var b = 1; if (a) b = 2; return b; }"
+                                 "func strings() { return \"ab\" + ('c' + \"d\"); }") == INTERPRET_OK);
+
+    //whole expressions fold, through groupings and unary operators
+    Chunk* chunk = function_chunk(vm, "arithmetic");
+    assert(instruction_count(chunk) == 2 && chunk->code[0] == OP_CONSTANT);
+    chunk = function_chunk(vm, "compare");
+    assert(instruction_count(chunk) == 8 && has_opcode(chunk, OP_NEW_LIST));
+
+    //a constant condition leaves only the branch that runs
+    chunk = function_chunk(vm, "dead");
+    assert(instruction_count(chunk) == 2 && !has_opcode(chunk, OP_JUMP) && !has_opcode(chunk, OP_JUMP_IF_FALSE));
+
+    //locals that are never assigned are read as their value, the parameter is still read
+    chunk = function_chunk(vm, "locals");
+    assert(!has_opcode(chunk, OP_DIV));
+    int reads = 0;
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == OP_GET_LOCAL) reads++;
+    }
+    assert(reads == 1);
+    assert(has_opcode(function_chunk(vm, "assigned"), OP_GET_LOCAL));
+
+    //strings are concatenated into one interned constant
+    chunk = function_chunk(vm, "strings");
+    assert(instruction_count(chunk) == 2 && chunk->code[0] == OP_CONSTANT);
+    assert(AS_STRING(chunk->constants.value[chunk->code[1]]) == copy_string(vm, "abcd", 4));
+    free_vm(vm);
+
+    //folded results match what the VM computes
+    common_interpret_test("func f() { return -(2 + 3) * 4 - 10 / 4; } var result = f();", -22.5);
+    common_interpret_test("var result = ((6 & 3) | 8) + ((1 << 4) >> 2) + (-1 >> 28) + (1 << 35);", 21);
+    common_interpret_test("var result = 2147483647 + 1;", 2147483648.0);
+    common_interpret_test("var result = 0; if (!(0 / 0 < 1)) result += 1; if (1 / -0 < 0) result += 10; if (!0) result += 100;", 111);
+    common_interpret_test("var result = 0; { var k = 3; var l = k * k; result = l + k; }", 12);
+    common_interpret_test("var result = 1.5 & 3;", 1);
+    common_interpret_test("func f() { return \"ab\" + \"cd\"; } func g(a) { return a + \"d\"; } var result = 0; if (f() == g(\"abc\")) result = 1;", 1);
+    common_register_test("func f(n) { var t = 0; for (var i = 0; i < n; i += 1) { var step = 2 * 3; t += step; } return t; } var result = f(4);", "f", true, 24);
+
+    //operands the VM would reject are left to fail at run time
+    common_error_test("func f() { return 1 + nil; } f();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f() { return -true; } f();", INTERPRET_RUNTIME_ERROR);
+    common_error_test("func f() { return 1 < nil; } f();", INTERPRET_RUNTIME_ERROR);
+}
+
+//runs source with the optimizer on both tiers
+void common_optimize_test(char* source, double expected){
+    for (int tier = 0; tier < 2; tier++) {
+        LnVM* vm = init_vm(0, NULL);
+        vm->register_tier = tier == 1;
+        vm->optimize_level = 1;
+
+        LnInterpretResult status = interpret(vm, "test", source);
+        assert(status == INTERPRET_OK);
+
+        Value result = module_value(vm, "test", "result");
+        assert(IS_NUMBER(result));
+        assert(AS_NUMBER(result) == expected);
+
+        free_vm(vm);
+    }
+}
+
+//instructions with opcode between the target of the first LOOP and the LOOP
+static int loop_opcode_count(Chunk* chunk, Opcode opcode){
+    int loop = 0;
+    while (chunk->code[loop] != OP_LOOP) loop += 1 + get_arg_count(chunk->code, chunk->constants, loop);
+    int header = loop + 3 - ((chunk->code[loop + 1] << 8) | chunk->code[loop + 2]);
+
+    int count = 0;
+    for (int i = header; i < loop; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == opcode) count++;
+    }
+    return count;
+}
+
+void optimizer_test(){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    vm->optimize_level = 1;
+    assert(interpret(vm, "test", "func hoist(n) { var k = n * 2; var t = 0; var i = 0; while (i < n) { t = t + k * k * i; i = i + 1; } return t; }"
+                                 "func unknown(n) { var t = 0; var i = 0; while (i < 3) { t = t + n * n; i = i + 1; } return t; }"
+                                 "func common(a, b) { var x = a * 1; var y = b * 1; return (x * y + 1) * (x * y + 2); }"
+                                 "func dead(a) { var x = a * 2; x = x + 1; return a; }"
+                                 "func copy(a) { var b = a; var c = b; return b + c; }") == INTERPRET_OK);
+
+    //k * k moves in front of the loop, into a temporary pushed on entry
+    Chunk* chunk = function_chunk(vm, "hoist");
+    assert(chunk->code[0] == OP_NIL && loop_opcode_count(chunk, OP_MUL) == 1);
+    //a parameter could hold anything, so n * n stays where it can fail
+    chunk = function_chunk(vm, "unknown");
+    assert(chunk->code[0] != OP_NIL && loop_opcode_count(chunk, OP_MUL) == 1);
+
+    //x * y is computed once
+    int products = 0;
+    chunk = function_chunk(vm, "common");
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == OP_MUL) products++;
+    }
+    assert(products == 4);
+
+    //the store to x is never read, and nothing else sees x + 1
+    chunk = function_chunk(vm, "dead");
+    assert(!has_opcode(chunk, OP_SET_LOCAL) && !has_opcode(chunk, OP_ADD));
+
+    //b and c are read from a
+    chunk = function_chunk(vm, "copy");
+    for (int i = 0; i < chunk->count; i += 1 + get_arg_count(chunk->code, chunk->constants, i)) {
+        if(chunk->code[i] == OP_GET_LOCAL) assert(chunk->code[i + 1] == 1);
+    }
+    free_vm(vm);
+
+    common_optimize_test("func f(n) { var k = n * 2; var t = 0; for (var i = 0; i < n; i = i + 1) { if (i == 3) continue; if (i == 8) break; var m = k * 3 + 1; t = t + m * i + (k - 1); } return t; } var result = f(10);", 1658);
+    common_optimize_test("func f(n) { var t = 0; var a = n + 1; var b = n - 1; for (var i = 0; i < n; i += 1) { for (var j = 0; j < n; j += 1) { t = t + a * b + i * a - j; } } return t; } var result = f(7);", 3381);
+    common_optimize_test("func f(n) { var t = 0; var k = n * 2; var i = 0; while (i < n) { k = k + 1; t = t + k * k; i = i + 1; } return t; } var result = f(4);", 446);
+    common_optimize_test("func f(n) { var k = n * 2; var t = 0; var i = 0; while (i < 0) { t = k / 0; i = i + 1; } return t; } var result = f(3);", 0);
+    common_optimize_test("func f(a, b) { var x = a * b; var y = x; x = 0; return y + x; } var result = f(3, 4);", 12);
+    //temporaries sit under the locals closures capture and the frames of recursive calls
+    common_optimize_test("func f(n) { var k = n * 2; var g = nil; var t = 0; var i = 0; while (i < n) { func h() { return k; } g = h; t = t + k * k; i = i + 1; } return t + g(); } var result = f(4);", 264);
+    common_optimize_test("func f(n) { if (n < 1) return 0; var a = n * 2; var b = a * a + a * a; return b + f(n - 1); } var result = f(5);", 440);
+    common_optimize_test("class A { init(n) { this.n = n; } sum(m) { var k = m * 2; var t = 0; var i = 0; while (i < m) { t = t + this.n * k * k; i = i + 1; } return t; } } var result = A(2).sum(3);", 216);
+    common_optimize_test("var result = 0; { var k = 3 * 2; var i = 0; while (i < 5) { result = result + k * k; i = i + 1; } }", 180);
+}
+
+void inline_test(){
+    LnVM* vm = init_vm(0, NULL);
+    vm->register_tier = false;
+    vm->optimize_level = 1;
+    assert(interpret(vm, "test", "func sq(x) { return x * x; }"
+                                 "func fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+                                 "func user(n) { return sq(n) + 1; }"
+                                 "func recursive(n) { return fib(n); }"
+                                 "func extra(n) { return sq(n, 1); }"
+                                 "func later(n) { return after(n); }"
+                                 "func after(n) { return n; }") == INTERPRET_OK);
+
+    //the call to sq is replaced by its body, the normal call stays behind the guard
+    Chunk* chunk = function_chunk(vm, "user");
+    assert(has_opcode(chunk, OP_INLINE_GUARD) && has_opcode(chunk, OP_INLINE_RETURN) && has_opcode(chunk, OP_MUL));
+    //fib branches, the argument count doesn't match and after isn't compiled yet
+    assert(!has_opcode(function_chunk(vm, "recursive"), OP_INLINE_GUARD));
+    assert(!has_opcode(function_chunk(vm, "extra"), OP_INLINE_GUARD));
+    assert(!has_opcode(function_chunk(vm, "later"), OP_INLINE_GUARD));
+    free_vm(vm);
+
+    common_optimize_test("func sq(x) { return x * x; } func f(n) { var t = 0; for (var i = 0; i < n; i = i + 1) { t = t + sq(i); } return t; } var result = f(100);", 328350);
+    common_optimize_test("func h(x) { var y = x * 2; var z = y + 1; return y * z; } func f(a) { var b = 3; return h(a) + h(b) + b; } var result = f(4);", 117);
+    common_optimize_test("func sq(x) { return x * x; } func f(n) { return sq(sq(sq(n))); } var result = f(2);", 256);
+    common_optimize_test("func inc(x) { x = x + 1; return x * 2; } func f() { var a = 5; return inc(a) + a; } var result = f();", 17);
+    common_optimize_test("class P { init(x, y) { this.x = x; this.y = y; } } func area(p) { return p.x * p.y; } func f() { return area(P(3, 4)) + area(P(1, 2)); } var result = f();", 14);
+    common_optimize_test("func mix(a, b, c, d) { return a * b - c + d; } func f() { return mix(1, 2, 3, 4) + mix(5, 6, 7, 8); } var result = f();", 34);
+    //the guard takes the normal call once the module variable changes
+    common_optimize_test("func sq(x) { return x * x; } func other(x) { return x + 1; } func f(n) { return sq(n); } var a = f(5); sq = other; var result = a * 100 + f(5);", 2506);
+    common_optimize_test("func sq(x) { return x * x; } func f(n) { return sq(n); } var a = f(5); func sq(x) { return x * 3; } var result = a * 100 + f(5);", 2515);
+}
+
+//appends to a generated source, the buffers are sized for the tests below
+static char* append(char* source, const char* format, ...){
+    va_list args;
+    va_start(args, format);
+    source += vsprintf(source, format, args);
+    va_end(args);
+    return source;
+}
+
+void wide_test(){
+    char* source = malloc(256 * 1024);
+
+    //constants past the first 256 are loaded behind WIDE
+    char* end = append(source, "func f() { var t = 0; ");
+    for (int i = 1; i <= 300; i++) end = append(end, "t = t + %d; ", i);
+    append(end, "return t; } var result = f();");
+    common_interpret_test(source, 45150);
+    common_optimize_test(source, 45150);
+
+    //locals above slot 255
+    end = append(source, "func f() { var a0 = 0; ");
+    for (int i = 1; i < 300; i++) end = append(end, "var a%d = a%d + 1; ", i, i - 1);
+    append(end, "a299 = a299 + a0 + 1; return a299 + a150; } var result = f();");
+    common_interpret_test(source, 450);
+    common_optimize_test(source, 450);
+
+    //captured locals above slot 255 and more than 256 upvalues, in h as upvalues of g
+    end = append(source, "func f() { var a0 = 0; ");
+    for (int i = 1; i < 300; i++) end = append(end, "var a%d = a%d + 1; ", i, i - 1);
+    end = append(end, "func g() { a299 = a299 + 1; func h() { return a0");
+    for (int i = 1; i < 300; i++) end = append(end, " + a%d", i);
+    append(end, "; } return h(); } return g(); } var result = f();");
+    common_interpret_test(source, 44851);
+    common_optimize_test(source, 44851);
+
+    //a module declaring more functions than one-byte constants reach
+    end = source;
+    for (int i = 0; i < 300; i++) end = append(end, "func f%d(x) { return x + %d; } ", i, i);
+    append(end, "func g() { var k = 2; func h() { return f299(k) + f150(k); } return h(); } var result = g();");
+    common_interpret_test(source, 453);
+    common_optimize_test(source, 453);
+
+    //names past the first 256 constants, at module level and in a method
+    end = append(source, "var t = 0; ");
+    for (int i = 1; i <= 300; i++) end = append(end, "t = t + %d; ", i);
+    append(end, "class A { init(v) { this.x = v; } get() { return this.x; } } class B < A { get() { return super.get() + 1; } }"
+                "var a = A(5); a.x = a.x + 1; A.y = 3; var result = t + a.x + a.get() + (a.get)() + B(1).get() + A.y;");
+    common_interpret_test(source, 45150 + 6 + 6 + 6 + 2 + 3);
+    common_optimize_test(source, 45150 + 6 + 6 + 6 + 2 + 3);
+
+    end = append(source, "class A { get(n) { return n; } } class B < A { get(n) { var t = 0; ");
+    for (int i = 1; i <= 300; i++) end = append(end, "t = t + %d; ", i);
+    append(end, "var g = super.get; return t + super.get(n) + g(n); } } var result = B().get(2);");
+    common_interpret_test(source, 45154);
+
+    end = append(source, "var t = 0; ");
+    for (int i = 1; i <= 300; i++) end = append(end, "t = t + %d; ", i);
+    append(end, "t.x = 1;");
+    common_error_test(source, INTERPRET_RUNTIME_ERROR);
+
+    //bodies too long for a 16 bit jump, the function is compiled again with long jumps
+    end = append(source, "var result = 0; if (result == 0) { ");
+    for (int i = 0; i < 7000; i++) end = append(end, "result = result + 1; ");
+    append(end, "}");
+    common_interpret_test(source, 7000);
+
+    end = append(source, "func f(n) { var t = 0; while (true) { if (t >= n) break; ");
+    for (int i = 0; i < 9000; i++) end = append(end, "t = t + 1; ");
+    append(end, "} return t; } var result = f(20000);");
+    common_interpret_test(source, 27000);
+    common_optimize_test(source, 27000);
+    free(source);
+
+    //the same value is added to the constants once
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func f(a) { return a + 7 + a + 7 + a * 7; }") == INTERPRET_OK);
+    assert(function_chunk(vm, "f")->constants.count == 1);
+    free_vm(vm);
+}
+
+//upvalue objects on the heap, cells copied into closures aren't counted
+static int upvalue_object_count(LnVM* vm){
+    int count = 0;
+    for (Obj* object = vm->objects; object != NULL; object = object->next) {
+        if(object->type == OBJ_UPVALUE) count++;
+    }
+    return count;
+}
+
+void closure_test(){
+    //captures that are never assigned are copied into the closure
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func make(n) { var k = n * 2; func get() { return n + k; } return get; }"
+                                 "var a = make(1); var b = make(2); var result = a() * 10 + b();") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 36);
+    assert(upvalue_object_count(vm) == 0);
+    assert(!has_opcode(function_chunk(vm, "make"), OP_CLOSE_UPVALUE));
+    free_vm(vm);
+
+    //assigned captures stay shared
+    vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func counter() { var c = 0; func inc() { c += 1; return c; } return inc; }"
+                                 "var f = counter(); f(); var result = f();") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 2);
+    assert(upvalue_object_count(vm) == 1);
+    free_vm(vm);
+
+    common_interpret_test("func f() { var k = 1; func g() { return k; } k = 5; return g(); } var result = f();", 5);
+    common_interpret_test("func f() { func fact(n) { if (n < 2) return 1; return n * fact(n - 1); } return fact(5); } var result = f();", 120);
+    common_interpret_test("func f() { var a = 2; func g() { func h() { return a * 10; } return h; } var hh = g(); return hh(); } var result = f();", 20);
+    common_interpret_test("func f() { var a = 2; func g() { func h() { a = a + 1; } h(); return a; } return g() + a; } var result = f();", 6);
+    common_interpret_test("func f() { var t = 0; for (var i = 0; i < 4; i += 1) { var j = i; func g() { return j; } if (j == 3) break; t = t + g(); } return t; } var result = f();", 3);
+    common_interpret_test("class A { init() { this.x = 4; } get() { func g() { return this.x; } return g(); } } var result = A().get();", 4);
+    common_optimize_test("func f(n) { var k = n + 1; func g(x) { return x * k; } var t = 0; for (var i = 0; i < 10; i = i + 1) { t = t + g(i); } return t; } var result = f(2);", 135);
+}
+
+void literal_test(){
+    //constant literals are copied from a template, changes stay with the copy
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func f(i) { var l = [1, -2, true, nil]; l[0] += i; var m = {1: 2, -1: 3}; m[1] += i; m[5] = 0; return l[0] + l[1] + m[1] + m[-1]; }"
+                                 "f(10); var result = f(1);") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 6);
+    assert(has_opcode(function_chunk(vm, "f"), OP_COPY_LITERAL));
+    assert(!has_opcode(function_chunk(vm, "f"), OP_NEW_LIST));
+    assert(!has_opcode(function_chunk(vm, "f"), OP_NEW_MAP));
+    free_vm(vm);
+
+    //any element that isn't a literal builds the container at run time
+    vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func f(i) { var l = [1, i]; return l[0] + l[1]; } var result = f(2);") == INTERPRET_OK);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 3);
+    assert(has_opcode(function_chunk(vm, "f"), OP_NEW_LIST));
+    assert(!has_opcode(function_chunk(vm, "f"), OP_COPY_LITERAL));
+    free_vm(vm);
+
+    common_interpret_test("var l = [[1, 2], [3]]; l[0][0] = 5; var m = {1: [1, 2]}; var result = l[0][0] + l[1][0] + m[1][1];", 10);
+    common_interpret_test("var m = {1: 2, 1: 3}; var result = m[1];", 3);
+    common_interpret_test("func f() { return [2, 3, 4]; } var a = f(); a[0] = 9; var result = f()[0];", 2);
+    common_optimize_test("func f() { return {1: 4}; } func g() { var m = f(); m[1] += 1; return m[1] + f()[1]; } var result = g();", 9);
 }
 
+void for_in_test(){
+    common_interpret_test("var result = 0; for (var x in [1, 2, 3]) result = result + x;", 6);
+    common_interpret_test("var m = {1: 5, 2: 6}; var result = 0; for (var k in m) result = result + k * 100 + m[k];", 311);
+    common_interpret_test("var result = 0; for (var i in range(5)) { if (i == 3) continue; result = result + i; }", 7);
+    common_interpret_test("var result = 0; for (var i in range(2, 4)) for (var j in range(i)) { if (j == 1) break; result = result + 1; }", 2);
+    common_interpret_test("var result = 0; for (var i in range(0.5, 3)) result = result + i; for (var i in range(-2)) result = -1;", 4.5);
+    common_interpret_test("var result = 0; for (var x in []) result = -1; for (var k in {}) result = -1;", 0);
+    common_interpret_test("var range = [4, 5]; var result = 0; for (var x in range) result = result + x;", 9);
+    common_interpret_test("var result = 0; for (var x in range([3, 4][1] - 2, [1, 4][1])) result = result + x;", 5);
+    //a range declared by the script is called like any other function
+    common_interpret_test("func range(n) { return [100, 200]; } var t = 0; for (var x in range(2)) t = t + x; var result = t + range(2)[0];", 400);
+    common_interpret_test("func f() { func range(n) { return [n]; } func g() { var t = 0; for (var x in range(5)) t = t + x; return t; } return g(); } var result = f();", 5);
+    common_interpret_test("func f() { func range(a, b) { return [a, b]; } var t = 0; for (var x in range(3, 4)) t = t + x; return t; } var result = f();", 7);
+    //the loop variable is shared like a for loop's, closures see its last value
+    common_interpret_test("func f() { var g0 = nil; for (var i in range(3)) { func g() { return i; } if (i == 0) g0 = g; } return g0(); } var result = f();", 2);
+    common_register_test("func f(l) { var t = 0; for (var x in l) t = t + x; return t; } var result = f([1, 2, 3]);", "f", false, 6);
+    common_optimize_test("func f(n) { var t = 0; for (var i in range(n)) t = t + i * 2; return t; } var result = f(10);", 90);
+    common_error_test("for (var x in 5) {}", INTERPRET_RUNTIME_ERROR);
+    common_error_test("for (var x in range(nil)) {}", INTERPRET_RUNTIME_ERROR);
+    common_error_test("for (var x in range(1, 2) {}", INTERPRET_COMPILER_ERROR);
+
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func f(l) { var t = 0; for (var x in l) t = t + x; for (var i in range(3)) t = t + i; return t; } f([1]);") == INTERPRET_OK);
+    assert(has_opcode(function_chunk(vm, "f"), OP_FOR_ITER));
+    assert(has_opcode(function_chunk(vm, "f"), OP_FOR_RANGE));
+    assert(!has_opcode(function_chunk(vm, "f"), OP_SUBSCRIPT));
+    free_vm(vm);
+
+    //bodies too long for a 16 bit jump
+    char* source = malloc(256 * 1024);
+    char* end = append(source, "func f() { var t = 0; for (var i in range(3)) { if (i == 2) break; ");
+    for (int i = 0; i < 9000; i++) end = append(end, "t = t + i; ");
+    end = append(end, "} for (var x in [1, 2]) { if (x == 1) continue; ");
+    for (int i = 0; i < 9000; i++) end = append(end, "t = t + x; ");
+    append(end, "} return t; } var result = f();");
+    common_interpret_test(source, 27000);
+    free(source);
+}
+
+void switch_test(){
+    char* pick = "func pick(x) { switch (x) { case 1: return 10; case 2, 3: return 20; case 5: { var y = 7; return y; } default: return -1; } } ";
+    char* source = malloc(1024);
+    sprintf(source, "%s var result = pick(1) + pick(3) * 10 + pick(5) * 100 + pick(4) * 1000 + pick(2.0) * 10000;", pick);
+    common_interpret_test(source, 10 + 200 + 700 - 1000 + 200000);
+    sprintf(source, "%s var result = pick(nil) + pick(-0.0) + pick(1.5) + pick([1]);", pick);
+    common_interpret_test(source, -4);
+    free(source);
+
+    //labels that aren't dense ints are looked up in a map
+    common_interpret_test("func f(x) { switch (x) { case 1000: return 1; case -7: return 2; case true: return 3; case nil: return 4; case 0.5: return 5; } return 0; }"
+                          "var result = f(1000) * 10000 + f(-7.0) * 1000 + f(true) * 100 + f(nil) * 10 + f(0.5) + f(false) + f(3);", 12345);
+    //no fallthrough, break leaves the switch and continue goes to the loop
+    common_interpret_test("var result = 0; for (var i in range(8)) { switch (i) { case 4: continue; case 6: break; case 1, 2: result = result + 1; default: result = result + 10; } result = result + 100; }", 742);
+    common_interpret_test("var result = 0; while (result < 3) switch (result) { case 0: result = 1; case 1: switch (result) { case 1: result = 2; } case 2: { var a = 1; result = result + a; break; } }", 3);
+    common_interpret_test("var result = 5; switch (result) {} switch (result) { default: result = result + 1; }", 6);
+    common_optimize_test("func f(n) { var t = 0; for (var i in range(n)) switch (i) { case 0: t = t + 1; case 1: t = t + 2; default: t = t + i; } return t; } var result = f(5);", 12);
+    common_register_test("func f(x) { switch (x) { case 1: return 2; } return 3; } var result = f(1);", "f", false, 2);
+    common_error_test("switch (1) { case 1: case 1: }", INTERPRET_COMPILER_ERROR);
+    common_error_test("var x = 1; switch (1) { case x: }", INTERPRET_COMPILER_ERROR);
+    common_error_test("switch (1) { default: default: }", INTERPRET_COMPILER_ERROR);
+    common_error_test("switch (1) { var x = 1; }", INTERPRET_COMPILER_ERROR);
+    common_error_test("switch (1) { case 1: continue; }", INTERPRET_COMPILER_ERROR);
+
+    //string labels are found by their interned pointer, a string built at run time included
+    common_interpret_test("func f(s) { switch (s) { case \"red\": return 1; case \"green\", 'blue': return 2; case \"\": return 3; default: return 0; } }"
+                          "func join(a, b) { return a + b; } var result = f(\"red\") + f(\"blue\") * 10 + f(join(\"re\", \"d\")) * 100 + f(join(\"\", \"\")) * 1000 + f(\"r\") + f(1);", 3121);
+    common_error_test("switch (\"a\") { case \"a\": case 'a': }", INTERPRET_COMPILER_ERROR);
+
+    LnVM* vm = init_vm(0, NULL);
+    assert(interpret(vm, "test", "func dense(x) { switch (x) { case 3: return 1; case 5: return 2; case 4: return 3; } return 0; }"
+                                 "func sparse(x) { switch (x) { case 3: return 1; case 500: return 2; } return 0; }"
+                                 "func named(x) { switch (x) { case \"a\": return 1; case \"b\": return 2; } return 0; }") == INTERPRET_OK);
+    assert(has_opcode(function_chunk(vm, "dense"), OP_TABLE_SWITCH));
+    assert(has_opcode(function_chunk(vm, "sparse"), OP_HASH_SWITCH));
+    assert(has_opcode(function_chunk(vm, "named"), OP_HASH_SWITCH));
+    free_vm(vm);
+
+    //arms too far back for the dispatch entries
+    source = malloc(256 * 1024);
+    char* end = append(source, "func f(x) { var t = 0; switch (x) { case 1: ");
+    for (int i = 0; i < 9000; i++) end = append(end, "t = t + 1; ");
+    end = append(end, "case 2: ");
+    for (int i = 0; i < 9000; i++) end = append(end, "t = t + 2; ");
+    append(end, "} return t; } var result = f(1) + f(2) + f(3);");
+    common_interpret_test(source, 27000);
+    free(source);
+}
+
+void compile_gc_test(){
+    //a module allocating well past the collection threshold while it compiles,
+    //every name and string constant has to survive until it runs
+    char* source = malloc(512 * 1024);
+    char* end = source;
+    for (int i = 0; i < 2000; i++) end = append(end, "func f%d(a) { var s = \"s%d\"; return [a, s]; } ", i, i);
+    append(end, "var result = 0; if (f1999(1)[1] == \"s1999\" && f0(2)[1] == \"s0\") result = f1999(1)[0] + f0(2)[0];");
+
+    LnVM* vm = init_vm(0, NULL);
+    vm->next_gc = 0;
+    assert(interpret(vm, "test", source) == INTERPRET_OK);
+    assert(vm->compiler == NULL);
+    assert(AS_NUMBER(module_value(vm, "test", "result")) == 3);
+    free_vm(vm);
+    free(source);
+}
 
 int main(){
     lex_test();
+    interpret_test();
+    superinstruction_test();
+    quicken_test();
+    register_test();
+    inline_cache_test();
+    shape_test();
+    stack_test();
+    symbol_test();
+    class_property_test();
+    invoke_test();
+    int_test();
+    peephole_test();
+    constant_fold_test();
+    optimizer_test();
+    inline_test();
+    wide_test();
+    closure_test();
+    literal_test();
+    for_in_test();
+    switch_test();
+    compile_gc_test();
     return 0;
 }
 